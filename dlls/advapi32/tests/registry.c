@@ -2368,6 +2368,85 @@ static void test_rw_order(void)
     ok(!RegDeleteKeyA(HKEY_CURRENT_USER, keyname), "Failed to delete key\n");
 }
 
+static void test_many_entries(void)
+{
+    static const int count = 1000;
+    char name[32], upper[32];
+    HKEY key, subkey;
+    DWORD dw, type, size, start;
+    LONG ret;
+    int i, j;
+
+    ret = RegCreateKeyA(hkey_main, "many", &key);
+    ok(!ret, "RegCreateKeyA failed: %d\n", ret);
+
+    /* create them in reverse order to move the existing entries around */
+    for (i = count - 1; i >= 0; i--)
+    {
+        sprintf(name, "entry%04d", i);
+        ret = RegCreateKeyA(key, name, &subkey);
+        ok(!ret, "RegCreateKeyA %s failed: %d\n", name, ret);
+        RegCloseKey(subkey);
+        dw = i;
+        ret = RegSetValueExA(key, name, 0, REG_DWORD, (BYTE *)&dw, sizeof(dw));
+        ok(!ret, "RegSetValueExA %s failed: %d\n", name, ret);
+    }
+
+    start = GetTickCount();
+    for (j = 0; j < 10; j++)
+    {
+        for (i = 0; i < count; i++)
+        {
+            sprintf(upper, "ENTRY%04d", i);
+            ret = RegOpenKeyExA(key, upper, 0, KEY_READ, &subkey);
+            ok(!ret, "RegOpenKeyExA %s failed: %d\n", upper, ret);
+            RegCloseKey(subkey);
+            sprintf(upper, "many\\Entry%04d", i);
+            ret = RegOpenKeyExA(hkey_main, upper, 0, KEY_READ, &subkey);
+            ok(!ret, "RegOpenKeyExA %s failed: %d\n", upper, ret);
+            RegCloseKey(subkey);
+            size = sizeof(dw);
+            ret = RegQueryValueExA(key, upper + 5, NULL, &type, (BYTE *)&dw, &size);
+            ok(!ret, "RegQueryValueExA %s failed: %d\n", upper + 5, ret);
+            ok(dw == (DWORD)i, "got %u for %s\n", dw, upper + 5);
+        }
+    }
+    trace("%d opens and queries took %u ms\n", 10 * count, GetTickCount() - start);
+
+    size = sizeof(name);
+    ret = RegEnumKeyExA(key, 0, name, &size, NULL, NULL, NULL, NULL);
+    ok(!ret, "RegEnumKeyExA failed: %d\n", ret);
+    ok(!strcmp(name, "entry0000"), "got %s\n", name);
+
+    for (i = 0; i < count; i += 2)
+    {
+        sprintf(name, "entry%04d", i);
+        ret = RegDeleteKeyA(key, name);
+        ok(!ret, "RegDeleteKeyA %s failed: %d\n", name, ret);
+        ret = RegDeleteValueA(key, name);
+        ok(!ret, "RegDeleteValueA %s failed: %d\n", name, ret);
+    }
+    for (i = 0; i < count; i++)
+    {
+        sprintf(name, "entry%04d", i);
+        ret = RegOpenKeyExA(key, name, 0, KEY_READ, &subkey);
+        ok(ret == (i & 1 ? ERROR_SUCCESS : ERROR_FILE_NOT_FOUND), "RegOpenKeyExA %s returned %d\n", name, ret);
+        if (!ret) RegCloseKey(subkey);
+        size = sizeof(dw);
+        ret = RegQueryValueExA(key, name, NULL, &type, (BYTE *)&dw, &size);
+        ok(ret == (i & 1 ? ERROR_SUCCESS : ERROR_FILE_NOT_FOUND), "RegQueryValueExA %s returned %d\n", name, ret);
+        if (!ret) ok(dw == (DWORD)i, "got %u for %s\n", dw, name);
+    }
+
+    ret = RegDeleteKeyA(key, "entry0001");
+    ok(!ret, "RegDeleteKeyA failed: %d\n", ret);
+    ret = RegOpenKeyExA(hkey_main, "many\\entry0001", 0, KEY_READ, &subkey);
+    ok(ret == ERROR_FILE_NOT_FOUND, "RegOpenKeyExA returned %d\n", ret);
+
+    delete_key(key);
+    RegCloseKey(key);
+}
+
 static void test_symlinks(void)
 {
     static const WCHAR targetW[] = {'\\','S','o','f','t','w','a','r','e','\\','W','i','n','e',
@@ -4256,6 +4335,7 @@ START_TEST(registry)
     test_reg_copy_tree();
     test_reg_delete_tree();
     test_rw_order();
+    test_many_entries();
     test_deleted_key();
     test_delete_value();
     test_delete_key_value();
@@ -39,6 +39,7 @@
 #define HEAP_VALIDATE_PARAMS  0x40000000
 
 static BOOL (WINAPI *pHeapQueryInformation)(HANDLE, HEAP_INFORMATION_CLASS, PVOID, SIZE_T, PSIZE_T);
+static BOOL (WINAPI *pHeapSetInformation)(HANDLE, HEAP_INFORMATION_CLASS, PVOID, SIZE_T);
 static BOOL (WINAPI *pGetPhysicallyInstalledSystemMemory)(ULONGLONG *);
 static ULONG (WINAPI *pRtlGetNtGlobalFlags)(void);
 
@@ -892,6 +893,135 @@ static void test_HeapQueryInformation(void)
     ok(info == 0 || info == 1 || info == 2, "expected 0, 1 or 2, got %u\n", info);
 }
 
+static void test_HeapSetInformation(void)
+{
+    PROCESS_HEAP_ENTRY entry;
+    void *ptrs[256];
+    HANDLE heap;
+    ULONG info;
+    SIZE_T size;
+    BOOL ret;
+    int i;
+
+    pHeapSetInformation = (void *)GetProcAddress(GetModuleHandleA("kernel32.dll"), "HeapSetInformation");
+    if (!pHeapSetInformation || !pHeapQueryInformation)
+    {
+        win_skip("HeapSetInformation is not available\n");
+        return;
+    }
+
+    heap = HeapCreate(0, 0, 0);
+    ok(heap != NULL, "HeapCreate failed\n");
+
+    info = 2;
+    SetLastError(0xdeadbeef);
+    ret = pHeapSetInformation(heap, HeapCompatibilityInformation, &info, sizeof(info) - 1);
+    ok(!ret, "HeapSetInformation should fail\n");
+
+    ret = pHeapSetInformation(heap, HeapCompatibilityInformation, &info, sizeof(info));
+    ok(ret, "HeapSetInformation error %u\n", GetLastError());
+
+    info = 0xdeadbeef;
+    ret = pHeapQueryInformation(heap, HeapCompatibilityInformation, &info, sizeof(info), &size);
+    ok(ret, "HeapQueryInformation error %u\n", GetLastError());
+    ok(info == 2, "expected 2, got %u\n", info);
+
+    /* the front-end cannot be disabled again */
+    info = 0;
+    ret = pHeapSetInformation(heap, HeapCompatibilityInformation, &info, sizeof(info));
+    ok(!ret, "HeapSetInformation should fail\n");
+
+    for (i = 0; i < ARRAY_SIZE(ptrs); i++)
+    {
+        ptrs[i] = HeapAlloc(heap, HEAP_ZERO_MEMORY, 1 + (i % 64) * 8);
+        ok(ptrs[i] != NULL, "%u: HeapAlloc failed\n", i);
+        ok(!*(BYTE *)ptrs[i], "%u: block not zeroed\n", i);
+        ok(HeapSize(heap, 0, ptrs[i]) == 1 + (i % 64) * 8, "%u: wrong size %lu\n", i, HeapSize(heap, 0, ptrs[i]));
+    }
+    for (i = 0; i < ARRAY_SIZE(ptrs); i += 2)
+    {
+        ret = HeapFree(heap, 0, ptrs[i]);
+        ok(ret, "%u: HeapFree failed\n", i);
+    }
+    for (i = 0; i < ARRAY_SIZE(ptrs); i += 2)
+    {
+        ptrs[i] = HeapAlloc(heap, 0, 1 + (i % 64) * 8);
+        ok(ptrs[i] != NULL, "%u: HeapAlloc failed\n", i);
+    }
+    ok(HeapValidate(heap, 0, NULL), "HeapValidate failed\n");
+    for (i = 0; i < ARRAY_SIZE(ptrs); i++)
+        ok(HeapValidate(heap, 0, ptrs[i]), "%u: HeapValidate failed\n", i);
+
+    memset(&entry, 0, sizeof(entry));
+    for (i = 0; HeapWalk(heap, &entry); i++)
+        if (entry.wFlags & PROCESS_HEAP_ENTRY_BUSY) ok(entry.cbData != 0, "got empty busy block\n");
+    ok(i > 0, "HeapWalk didn't return any entry\n");
+
+    for (i = 0; i < ARRAY_SIZE(ptrs); i++)
+    {
+        ret = HeapFree(heap, 0, ptrs[i]);
+        ok(ret, "%u: HeapFree failed\n", i);
+    }
+    ok(HeapValidate(heap, 0, NULL), "HeapValidate failed\n");
+
+    ret = HeapDestroy(heap);
+    ok(ret, "HeapDestroy failed\n");
+
+    heap = HeapCreate(HEAP_NO_SERIALIZE, 0, 0);
+    ok(heap != NULL, "HeapCreate failed\n");
+    info = 2;
+    ret = pHeapSetInformation(heap, HeapCompatibilityInformation, &info, sizeof(info));
+    ok(!ret, "HeapSetInformation should fail on a non-serialized heap\n");
+    HeapDestroy(heap);
+}
+
+static void test_heap_statistics(void)
+{
+    HEAP_WINE_STATISTICS stats;
+    void *ptr, *large;
+    HANDLE heap;
+    SIZE_T size;
+    BOOL ret;
+
+    heap = HeapCreate(0, 0, 0);
+    ok(heap != NULL, "HeapCreate failed\n");
+
+    size = 0;
+    ret = pHeapQueryInformation(heap, HeapWineStatistics, &stats, sizeof(stats), &size);
+    if (!ret)
+    {
+        win_skip("HeapWineStatistics is not supported\n");
+        HeapDestroy(heap);
+        return;
+    }
+    ok(size == sizeof(stats), "got size %lu\n", size);
+    ok(stats.SubHeaps == 1, "got %u sub-heaps\n", stats.SubHeaps);
+    ok(stats.FreeBlocks >= 1, "got %u free blocks\n", stats.FreeBlocks);
+    ok(stats.CommittedSize <= stats.ReservedSize, "got committed %#lx reserved %#lx\n",
+       stats.CommittedSize, stats.ReservedSize);
+    ok(!stats.LargeBlocks, "got %u large blocks\n", stats.LargeBlocks);
+
+    ptr = HeapAlloc(heap, 0, 100);
+    large = HeapAlloc(heap, 0, 4 * 1024 * 1024);
+    ok(ptr && large, "HeapAlloc failed\n");
+
+    ret = pHeapQueryInformation(heap, HeapWineStatistics, &stats, sizeof(stats), NULL);
+    ok(ret, "HeapQueryInformation error %u\n", GetLastError());
+    ok(stats.LargeBlocks == 1, "got %u large blocks\n", stats.LargeBlocks);
+    ok(stats.LargeSize >= 4 * 1024 * 1024, "got large size %#lx\n", stats.LargeSize);
+    ok(stats.AllocationsBySize[2] == 1, "got %s allocations\n", wine_dbgstr_longlong(stats.AllocationsBySize[2]));
+    ok(stats.LockAcquisitions >= 2, "got %s lock acquisitions\n", wine_dbgstr_longlong(stats.LockAcquisitions));
+
+    SetLastError(0xdeadbeef);
+    ret = pHeapQueryInformation(heap, HeapWineStatistics, &stats, sizeof(stats) - 1, &size);
+    ok(!ret, "HeapQueryInformation should fail\n");
+    ok(GetLastError() == ERROR_INSUFFICIENT_BUFFER, "got error %u\n", GetLastError());
+
+    HeapFree(heap, 0, ptr);
+    HeapFree(heap, 0, large);
+    HeapDestroy(heap);
+}
+
 static void test_heap_checks( DWORD flags )
 {
     BYTE old, *p, *p2;
@@ -1245,6 +1375,8 @@ START_TEST(heap)
     test_sized_HeapReAlloc((1 << 20), 1);
 
     test_HeapQueryInformation();
+    test_HeapSetInformation();
+    test_heap_statistics();
     test_GetPhysicallyInstalledSystemMemory();
 
     if (pRtlGetNtGlobalFlags)
@@ -1726,8 +1726,9 @@ static void test_image_mapping(const char *dll_name, DWORD scn_page_access, BOOL
     NTSTATUS status;
     LARGE_INTEGER offset;
     SIZE_T size;
-    void *addr1, *addr2;
+    void *addr1, *addr2, *addr3;
     MEMORY_BASIC_INFORMATION info;
+    char *copy;
 
     if (!pNtMapViewOfSection) return;
 
@@ -1779,9 +1780,30 @@ static void test_image_mapping(const char *dll_name, DWORD scn_page_access, BOOL
     ok(info.State == MEM_COMMIT, "%#x != MEM_COMMIT\n", info.State);
     ok(info.Type == SEC_IMAGE, "%#x != SEC_IMAGE\n", info.Type);
 
+    copy = HeapAlloc(GetProcessHeap(), 0, page_size + section.SizeOfRawData);
+    memcpy(copy, addr2, page_size);
+    if (scn_page_access != PAGE_NOACCESS)
+        memcpy(copy + page_size, (char *)addr2 + section.VirtualAddress, section.SizeOfRawData);
+
+    /* mapping the image again at the same address reuses its relocated pages */
     status = pNtUnmapViewOfSection(GetCurrentProcess(), addr2);
     ok(status == STATUS_SUCCESS, "NtUnmapViewOfSection error %x\n", status);
 
+    addr3 = addr2;
+    size = 0;
+    status = pNtMapViewOfSection(hmap, GetCurrentProcess(), &addr3, 0, 0, &offset,
+                                 &size, 1 /* ViewShare */, 0, PAGE_READONLY);
+    ok(status == STATUS_IMAGE_NOT_AT_BASE, "expected STATUS_IMAGE_NOT_AT_BASE, got %x\n", status);
+    ok(addr3 == addr2, "got %p, expected %p\n", addr3, addr2);
+    ok(!memcmp(addr3, copy, page_size), "headers differ\n");
+    if (scn_page_access != PAGE_NOACCESS)
+        ok(!memcmp((char *)addr3 + section.VirtualAddress, copy + page_size, section.SizeOfRawData),
+           "section differs\n");
+
+    status = pNtUnmapViewOfSection(GetCurrentProcess(), addr3);
+    ok(status == STATUS_SUCCESS, "NtUnmapViewOfSection error %x\n", status);
+    HeapFree(GetProcessHeap(), 0, copy);
+
     addr2 = MapViewOfFile(hmap, 0, 0, 0, 0);
     ok(addr2 != 0, "mapped address should be valid\n");
     ok(addr2 != addr1, "mapped addresses should be different\n");
@@ -4121,6 +4143,93 @@ static void test_HashLinks(void)
     ok(found, "Could not find kernel32\n");
 }
 
+static void test_export_lookup( const char *name )
+{
+    HMODULE module = GetModuleHandleA( name );
+    const IMAGE_EXPORT_DIRECTORY *exports;
+    const DWORD *names;
+    const WORD *ordinals;
+    DWORD i, size, start, pass;
+    void *proc;
+
+    exports = pRtlImageDirectoryEntryToData( module, TRUE, IMAGE_DIRECTORY_ENTRY_EXPORT, &size );
+    ok( exports != NULL, "%s: no export directory\n", name );
+    if (!exports) return;
+    names = (const DWORD *)((const char *)module + exports->AddressOfNames);
+    ordinals = (const WORD *)((const char *)module + exports->AddressOfNameOrdinals);
+
+    for (i = 0; i < exports->NumberOfNames; i++)
+    {
+        const char *export = (const char *)module + names[i];
+        proc = GetProcAddress( module, export );
+        ok( proc == GetProcAddress( module, MAKEINTRESOURCEA(exports->Base + ordinals[i]) ),
+            "%s: wrong address %p for %s\n", name, proc, export );
+    }
+    proc = GetProcAddress( module, "NonexistentExport" );
+    ok( !proc, "%s: got %p for nonexistent export\n", name, proc );
+
+    start = GetTickCount();
+    for (pass = 0; pass < 20; pass++)
+        for (i = 0; i < exports->NumberOfNames; i++)
+            GetProcAddress( module, (const char *)module + names[i] );
+    trace( "%s: %u lookups of %u names in %u ms\n", name, pass * exports->NumberOfNames,
+           exports->NumberOfNames, GetTickCount() - start );
+}
+
+static const char *startup_dlls[] =
+{
+    "advapi32.dll", "comctl32.dll", "comdlg32.dll", "gdi32.dll", "ole32.dll",
+    "oleaut32.dll", "rpcrt4.dll", "shell32.dll", "shlwapi.dll", "user32.dll",
+    "version.dll", "winmm.dll", "ws2_32.dll"
+};
+
+static void startup_child(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(startup_dlls); i++)
+        ok( LoadLibraryA( startup_dlls[i] ) != NULL, "failed to load %s: %u\n",
+            startup_dlls[i], GetLastError() );
+}
+
+static DWORD run_startup_child( const char *parallel )
+{
+    PROCESS_INFORMATION pi;
+    STARTUPINFOA si = { sizeof(si) };
+    char cmdline[MAX_PATH + 32];
+    char **argv;
+    DWORD ret, start;
+
+    winetest_get_mainargs( &argv );
+    SetEnvironmentVariableA( "WINE_PARALLEL_LOADER", parallel );
+    sprintf( cmdline, "\"%s\" loader startup", argv[0] );
+    start = GetTickCount();
+    ret = CreateProcessA( argv[0], cmdline, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi );
+    ok( ret, "CreateProcess(%s) error %u\n", cmdline, GetLastError() );
+    SetEnvironmentVariableA( "WINE_PARALLEL_LOADER", NULL );
+    if (!ret) return 0;
+    ret = WaitForSingleObject( pi.hProcess, 30000 );
+    ok( ret == WAIT_OBJECT_0, "child process failed to terminate\n" );
+    if (ret != WAIT_OBJECT_0) TerminateProcess( pi.hProcess, 1 );
+    GetExitCodeProcess( pi.hProcess, &ret );
+    ok( !ret, "child process failed with %u\n", ret );
+    CloseHandle( pi.hThread );
+    CloseHandle( pi.hProcess );
+    return GetTickCount() - start;
+}
+
+static void test_startup_time(void)
+{
+    DWORD serial, parallel;
+
+    /* the first run populates the file cache */
+    run_startup_child( "0" );
+    serial = run_startup_child( "0" );
+    parallel = run_startup_child( "1" );
+    trace( "loading %u dlls: %u ms serial, %u ms with WINE_PARALLEL_LOADER\n",
+           (unsigned int)ARRAY_SIZE(startup_dlls), serial, parallel );
+}
+
 START_TEST(loader)
 {
     int argc;
@@ -4176,6 +4285,11 @@ START_TEST(loader)
         *child_failures = -1;
 
     argc = winetest_get_mainargs(&argv);
+    if (argc > 2 && !strcmp( argv[2], "startup" ))
+    {
+        startup_child();
+        return;
+    }
     if (argc > 4)
     {
         test_dll_phase = atoi(argv[4]);
@@ -4197,6 +4311,10 @@ START_TEST(loader)
     test_dll_file( "kernel32.dll" );
     test_dll_file( "advapi32.dll" );
     test_dll_file( "user32.dll" );
+    test_export_lookup( "ntdll.dll" );
+    test_export_lookup( "kernel32.dll" );
+    test_export_lookup( "user32.dll" );
+    test_startup_time();
 
     /* loader test must be last, it can corrupt the internal loader state on Windows */
     test_Loader();
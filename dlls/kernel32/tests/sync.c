@@ -976,6 +976,107 @@ static void test_waitable_timer(void)
     CloseHandle( handle );
 }
 
+static void test_many_waitable_timers(void)
+{
+    static const int count = 100000;
+    HANDLE *timers, short_timers[3];
+    LARGE_INTEGER due;
+    DWORD start, ret;
+    BOOL res;
+    int i;
+
+    timers = HeapAlloc( GetProcessHeap(), 0, count * sizeof(*timers) );
+
+    start = GetTickCount();
+    for (i = 0; i < count; i++)
+    {
+        timers[i] = CreateWaitableTimerA( NULL, TRUE, NULL );
+        ok( timers[i] != NULL, "CreateWaitableTimer failed with error %u\n", GetLastError() );
+        /* spread the due times so that they are not added in order */
+        due.QuadPart = -(LONGLONG)(1000 + (i * 7919) % count) * 10000000;
+        res = SetWaitableTimer( timers[i], &due, 0, NULL, NULL, FALSE );
+        ok( res, "SetWaitableTimer failed with error %u\n", GetLastError() );
+    }
+    trace( "setting %d timers took %u ms\n", count, GetTickCount() - start );
+
+    /* the earliest timer has to fire first, whatever the number of pending ones */
+    for (i = 0; i < 3; i++)
+    {
+        short_timers[i] = CreateWaitableTimerA( NULL, TRUE, NULL );
+        due.QuadPart = -(LONGLONG)(i == 1 ? 100 : 400 + 100 * i) * 10000;
+        res = SetWaitableTimer( short_timers[i], &due, 0, NULL, NULL, FALSE );
+        ok( res, "SetWaitableTimer failed with error %u\n", GetLastError() );
+    }
+    ret = WaitForMultipleObjects( 3, short_timers, FALSE, 5000 );
+    ok( ret == WAIT_OBJECT_0 + 1, "got %u\n", ret );
+    ret = WaitForMultipleObjects( 3, short_timers, TRUE, 5000 );
+    ok( ret < WAIT_OBJECT_0 + 3, "got %u\n", ret );
+    for (i = 0; i < 3; i++) CloseHandle( short_timers[i] );
+
+    start = GetTickCount();
+    for (i = 0; i < count; i++)
+    {
+        if (i % 2) CancelWaitableTimer( timers[i] );
+        CloseHandle( timers[i] );
+    }
+    trace( "cancelling %d timers took %u ms\n", count, GetTickCount() - start );
+
+    HeapFree( GetProcessHeap(), 0, timers );
+}
+
+static void test_handle_reuse(void)
+{
+    HANDLE event, semaphore, handle;
+    DWORD ret;
+    BOOL res;
+    int i;
+
+    event = CreateEventA( NULL, TRUE, TRUE, NULL );
+    ok( event != NULL, "CreateEvent failed with error %u\n", GetLastError() );
+    semaphore = CreateSemaphoreA( NULL, 0, 1, NULL );
+    ok( semaphore != NULL, "CreateSemaphore failed with error %u\n", GetLastError() );
+
+    /* the duplicated handles usually get the slot that was just freed, which
+     * must not keep anything of the object it referred to before */
+    for (i = 0; i < 16; i++)
+    {
+        res = DuplicateHandle( GetCurrentProcess(), event, GetCurrentProcess(), &handle,
+                               0, FALSE, DUPLICATE_SAME_ACCESS );
+        ok( res, "DuplicateHandle failed with error %u\n", GetLastError() );
+        ret = WaitForSingleObject( handle, 0 );
+        ok( ret == WAIT_OBJECT_0, "%d: got %u\n", i, ret );
+        CloseHandle( handle );
+
+        SetLastError( 0xdeadbeef );
+        ret = WaitForSingleObject( handle, 0 );
+        ok( ret == WAIT_FAILED, "%d: got %u\n", i, ret );
+        ok( GetLastError() == ERROR_INVALID_HANDLE, "%d: got error %u\n", i, GetLastError() );
+
+        res = DuplicateHandle( GetCurrentProcess(), semaphore, GetCurrentProcess(), &handle,
+                               0, FALSE, DUPLICATE_SAME_ACCESS );
+        ok( res, "DuplicateHandle failed with error %u\n", GetLastError() );
+        ret = WaitForSingleObject( handle, 0 );
+        ok( ret == WAIT_TIMEOUT, "%d: got %u\n", i, ret );
+        res = ReleaseSemaphore( handle, 1, NULL );
+        ok( res, "%d: ReleaseSemaphore failed with error %u\n", i, GetLastError() );
+        ret = WaitForSingleObject( semaphore, 0 );
+        ok( ret == WAIT_OBJECT_0, "%d: got %u\n", i, ret );
+        CloseHandle( handle );
+
+        res = DuplicateHandle( GetCurrentProcess(), event, GetCurrentProcess(), &handle,
+                               EVENT_MODIFY_STATE, FALSE, 0 );
+        ok( res, "DuplicateHandle failed with error %u\n", GetLastError() );
+        SetLastError( 0xdeadbeef );
+        ret = WaitForSingleObject( handle, 0 );
+        ok( ret == WAIT_FAILED, "%d: got %u\n", i, ret );
+        ok( GetLastError() == ERROR_ACCESS_DENIED, "%d: got error %u\n", i, GetLastError() );
+        CloseHandle( handle );
+    }
+
+    CloseHandle( event );
+    CloseHandle( semaphore );
+}
+
 static HANDLE sem = 0;
 
 static void CALLBACK iocp_callback(DWORD dwErrorCode, DWORD dwNumberOfBytesTransferred, LPOVERLAPPED lpOverlapped)
@@ -3170,7 +3271,9 @@ START_TEST(sync)
     test_slist();
     test_event();
     test_semaphore();
+    test_handle_reuse();
     test_waitable_timer();
+    test_many_waitable_timers();
     test_iocp_callback();
     test_timer_queue();
     test_WaitForSingleObject();
@@ -39,15 +39,7 @@
 
 WINE_DEFAULT_DEBUG_CHANNEL(ntdll);
 WINE_DECLARE_DEBUG_CHANNEL(relay);
-
-static inline void small_pause(void)
-{
-#ifdef __i386__
-    __asm__ __volatile__( "rep;nop" : : : "memory" );
-#else
-    __asm__ __volatile__( "" : : : "memory" );
-#endif
-}
+WINE_DECLARE_DEBUG_CHANNEL(csstat);
 
 static void *no_debug_info_marker = (void *)(ULONG_PTR)-1;
 
@@ -56,6 +48,122 @@ static BOOL crit_section_has_debuginfo(const RTL_CRITICAL_SECTION *crit)
     return crit->DebugInfo != NULL && crit->DebugInfo != no_debug_info_marker;
 }
 
+/* A contended section spins for a while before blocking, even without an
+ * explicit spin count. The spin estimate is kept in the otherwise unused
+ * EntryCount field of the debug info; an explicit spin count is used as
+ * upper bound. */
+static inline ULONG get_spin_count( const RTL_CRITICAL_SECTION *crit )
+{
+    if (!crit_section_has_debuginfo( crit )) return crit->SpinCount;
+    if (NtCurrentTeb()->Peb->NumberOfProcessors <= 1) return 0;
+    return adaptive_spin_count( crit->DebugInfo->EntryCount,
+                                crit->SpinCount ? crit->SpinCount : MAX_ADAPTIVE_SPIN_COUNT );
+}
+
+static inline void update_spin_count( RTL_CRITICAL_SECTION *crit, ULONG spins )
+{
+    LONG count, new_count;
+
+    if (!crit_section_has_debuginfo( crit )) return;
+    /* racy, but it's only a hint */
+    count = crit->DebugInfo->EntryCount;
+    new_count = adaptive_spin_update( count, spins );
+    if (new_count != count) crit->DebugInfo->EntryCount = new_count;
+}
+
+/* contention profile of the named Wine internal sections, dumped on the
+ * csstat channel at process exit; all other sections share the first entry */
+struct crit_profile
+{
+    const char *name;
+    LONG        acquires;
+    LONG        contended;
+    LONGLONG    wait_time;  /* in 100ns units */
+};
+
+#define CRIT_PROFILE_SIZE 256
+
+static struct crit_profile crit_profiles[CRIT_PROFILE_SIZE];
+
+BOOL crit_section_profiling = FALSE;
+
+static struct crit_profile *get_crit_profile( const RTL_CRITICAL_SECTION *crit )
+{
+    const char *name = NULL;
+    unsigned int i, hash;
+
+    if (crit_section_has_debuginfo( crit )) name = (const char *)crit->DebugInfo->Spare[0];
+    if (!name) return &crit_profiles[0];
+
+    hash = ((ULONG_PTR)name >> 3) % (CRIT_PROFILE_SIZE - 1);
+    for (i = 0; i < CRIT_PROFILE_SIZE - 1; i++)
+    {
+        struct crit_profile *profile = &crit_profiles[1 + (hash + i) % (CRIT_PROFILE_SIZE - 1)];
+
+        if (profile->name == name) return profile;
+        if (!profile->name && !interlocked_cmpxchg_ptr( (void **)&profile->name, (void *)name, NULL ))
+            return profile;
+        if (profile->name == name) return profile;
+    }
+    return &crit_profiles[0];
+}
+
+static inline LONGLONG crit_profile_time(void)
+{
+    LARGE_INTEGER now;
+    NtQueryPerformanceCounter( &now, NULL );
+    return now.QuadPart;
+}
+
+static inline void crit_profile_add_time( struct crit_profile *profile, LONGLONG time )
+{
+    LONGLONG old;
+
+    do old = profile->wait_time;
+    while (interlocked_cmpxchg64( &profile->wait_time, old + time, old ) != old);
+}
+
+/***********************************************************************
+ *           init_critical_section_stats
+ *
+ * Send all sections through RtlEnterCriticalSection when profiling.
+ */
+void init_critical_section_stats(void)
+{
+    crit_section_profiling = TRACE_ON(csstat);
+}
+
+/***********************************************************************
+ *           dump_critical_section_stats
+ *
+ * Dump the contention profile, sorted by total wait time.
+ */
+void dump_critical_section_stats(void)
+{
+    struct crit_profile *sorted[CRIT_PROFILE_SIZE], *tmp;
+    unsigned int i, j, count = 0;
+
+    if (!TRACE_ON(csstat)) return;
+
+    for (i = 0; i < CRIT_PROFILE_SIZE; i++)
+    {
+        if (!crit_profiles[i].acquires) continue;
+        for (j = count++; j > 0 && sorted[j - 1]->wait_time < crit_profiles[i].wait_time; j--)
+            sorted[j] = sorted[j - 1];
+        sorted[j] = &crit_profiles[i];
+    }
+
+    TRACE_(csstat)( "%10s %10s %10s %10s  section\n", "acquires", "contended", "wait ms", "avg us" );
+    for (i = 0; i < count; i++)
+    {
+        tmp = sorted[i];
+        TRACE_(csstat)( "%10d %10d %10.1f %10.2f  %s\n", tmp->acquires, tmp->contended,
+                        tmp->wait_time / 10000.0,
+                        tmp->contended ? tmp->wait_time / 10.0 / tmp->contended : 0.0,
+                        tmp->name ? debugstr_a(tmp->name) : "(unnamed)" );
+    }
+}
+
 #ifdef __linux__
 
 static int wait_op = 128; /*FUTEX_WAIT|FUTEX_PRIVATE_FLAG*/
@@ -524,38 +632,34 @@ NTSTATUS WINAPI RtlpUnWaitCriticalSection( RTL_CRITICAL_SECTION *crit )
 
 
 /***********************************************************************
- *           RtlEnterCriticalSection   (NTDLL.@)
- *
- * Enters a critical section, waiting for it to become available if necessary.
- *
- * PARAMS
- *  crit [I/O] Critical section to enter
- *
- * RETURNS
- *  STATUS_SUCCESS. The critical section is held by the caller.
- *  
- * SEE
- *  RtlInitializeCriticalSectionEx(),
- *  RtlInitializeCriticalSection(), RtlInitializeCriticalSectionAndSpinCount(),
- *  RtlDeleteCriticalSection(), RtlSetCriticalSectionSpinCount(),
- *  RtlLeaveCriticalSection(), RtlTryEnterCriticalSection()
+ *           do_enter_critical_section
  */
-NTSTATUS WINAPI RtlEnterCriticalSection( RTL_CRITICAL_SECTION *crit )
+static inline void do_enter_critical_section( RTL_CRITICAL_SECTION *crit )
 {
-    if (crit->SpinCount)
-    {
-        ULONG count;
+    ULONG count, spins;
 
-        if (RtlTryEnterCriticalSection( crit )) return STATUS_SUCCESS;
-        for (count = crit->SpinCount; count > 0; count--)
+    if ((spins = get_spin_count( crit )))
+    {
+        if (RtlTryEnterCriticalSection( crit ))
+        {
+            update_spin_count( crit, 0 );
+            return;
+        }
+        for (count = 0; count < spins; count++)
         {
             if (crit->LockCount > 0) break;  /* more than one waiter, don't bother spinning */
             if (crit->LockCount == -1)       /* try again */
             {
-                if (interlocked_cmpxchg( &crit->LockCount, 0, -1 ) == -1) goto done;
+                if (interlocked_cmpxchg( &crit->LockCount, 0, -1 ) == -1)
+                {
+                    update_spin_count( crit, count );
+                    goto done;
+                }
             }
             small_pause();
         }
+        /* the section is held for longer than spinning is worth */
+        if (count == spins) update_spin_count( crit, 0 );
     }
 
     if (interlocked_inc( &crit->LockCount ))
@@ -563,7 +667,7 @@ NTSTATUS WINAPI RtlEnterCriticalSection( RTL_CRITICAL_SECTION *crit )
         if (crit->OwningThread == ULongToHandle(GetCurrentThreadId()))
         {
             crit->RecursionCount++;
-            return STATUS_SUCCESS;
+            return;
         }
 
         /* Now wait for it */
@@ -572,6 +676,44 @@ NTSTATUS WINAPI RtlEnterCriticalSection( RTL_CRITICAL_SECTION *crit )
 done:
     crit->OwningThread   = ULongToHandle(GetCurrentThreadId());
     crit->RecursionCount = 1;
+}
+
+/***********************************************************************
+ *           RtlEnterCriticalSection   (NTDLL.@)
+ *
+ * Enters a critical section, waiting for it to become available if necessary.
+ *
+ * PARAMS
+ *  crit [I/O] Critical section to enter
+ *
+ * RETURNS
+ *  STATUS_SUCCESS. The critical section is held by the caller.
+ *  
+ * SEE
+ *  RtlInitializeCriticalSectionEx(),
+ *  RtlInitializeCriticalSection(), RtlInitializeCriticalSectionAndSpinCount(),
+ *  RtlDeleteCriticalSection(), RtlSetCriticalSectionSpinCount(),
+ *  RtlLeaveCriticalSection(), RtlTryEnterCriticalSection()
+ */
+NTSTATUS WINAPI RtlEnterCriticalSection( RTL_CRITICAL_SECTION *crit )
+{
+    struct crit_profile *profile;
+    LONGLONG start;
+
+    if (!crit_section_profiling)
+    {
+        do_enter_critical_section( crit );
+        return STATUS_SUCCESS;
+    }
+
+    profile = get_crit_profile( crit );
+    interlocked_inc( &profile->acquires );
+    if (RtlTryEnterCriticalSection( crit )) return STATUS_SUCCESS;
+
+    start = crit_profile_time();
+    do_enter_critical_section( crit );
+    interlocked_inc( &profile->contended );
+    crit_profile_add_time( profile, crit_profile_time() - start );
     return STATUS_SUCCESS;
 }
 
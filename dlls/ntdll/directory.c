@@ -211,6 +211,42 @@ static const unsigned int dir_data_names_initial_size  = 64;
 static struct dir_data **dir_data_cache;
 static unsigned int dir_data_cache_size;
 
+/* cached contents of a directory, used for case-insensitive lookups */
+struct dir_lookup_name
+{
+    unsigned int            unix_name;  /* offset of the Unix file name in the data buffer */
+    unsigned int            name;       /* offset of the Unicode file name in the data buffer */
+    unsigned int            len;        /* length of the Unicode file name */
+    unsigned int            hash;       /* case-insensitive hash of the Unicode file name */
+};
+
+struct dir_lookup_short_name
+{
+    WCHAR                   name[12];   /* generated short name, empty if the name is valid 8.3 */
+    unsigned int            len;
+    unsigned int            hash;
+};
+
+struct dir_lookup
+{
+    struct list             entry;      /* entry in the lookup cache, most recently used first */
+    struct file_identity    id;         /* directory file identity */
+    time_t                  mtime;      /* directory modification time when it was read */
+    long                    mtime_nsec;
+    unsigned int            count;      /* count of names in the directory */
+    struct dir_lookup_name *names;      /* directory file names */
+    char                   *data;       /* buffer holding the names */
+    unsigned int            hash_size;  /* size of the hash tables, a power of 2 */
+    unsigned int           *hash;       /* hash table of the names, as indexes in names + 1 */
+    struct dir_lookup_short_name *short_names; /* generated short names, created on first use */
+    unsigned int           *short_hash; /* hash table of the generated short names */
+};
+
+static const unsigned int dir_lookup_cache_max_size = 64;
+
+static struct list dir_lookup_cache = LIST_INIT( dir_lookup_cache );
+static unsigned int dir_lookup_cache_size;
+
 static BOOL show_dot_files;
 static RTL_RUN_ONCE init_once = RTL_RUN_ONCE_INIT;
 
@@ -2026,6 +2062,281 @@ NTSTATUS WINAPI DECLSPEC_HOTPATCH NtQueryDirectoryFile( HANDLE handle, HANDLE ev
 }
 
 
+static inline long get_mtime_nsec( const struct stat *st )
+{
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    return st->st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC)
+    return st->st_mtimespec.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+/* case-insensitive hash of a file name, folded the same way as strncmpiW */
+static inline unsigned int hash_dir_lookup_name( const WCHAR *name, unsigned int len )
+{
+    unsigned int i, hash = 0x811c9dc5;
+
+    for (i = 0; i < len; i++) hash = (hash ^ tolowerW( name[i] )) * 0x01000193;
+    return hash;
+}
+
+static inline void insert_dir_lookup_hash( unsigned int *table, unsigned int size,
+                                           unsigned int hash, unsigned int index )
+{
+    unsigned int pos;
+
+    /* linear probing keeps the names with identical hashes in directory order */
+    for (pos = hash & (size - 1); table[pos]; pos = (pos + 1) & (size - 1)) ;
+    table[pos] = index + 1;
+}
+
+static void free_dir_lookup( struct dir_lookup *lookup )
+{
+    RtlFreeHeap( GetProcessHeap(), 0, lookup->hash );
+    RtlFreeHeap( GetProcessHeap(), 0, lookup->short_hash );
+    RtlFreeHeap( GetProcessHeap(), 0, lookup->short_names );
+    RtlFreeHeap( GetProcessHeap(), 0, lookup->names );
+    RtlFreeHeap( GetProcessHeap(), 0, lookup->data );
+    RtlFreeHeap( GetProcessHeap(), 0, lookup );
+}
+
+
+/***********************************************************************
+ *           read_dir_lookup
+ *
+ * Read the names of a directory into a new lookup cache entry.
+ */
+static struct dir_lookup *read_dir_lookup( const char *unix_name, const struct stat *st )
+{
+    struct dir_lookup *lookup;
+    struct dirent *de;
+    WCHAR buffer[MAX_DIR_ENTRY_LEN];
+    unsigned int names_size = 64, data_size = 4096, data_pos = 0, len;
+    void *ptr;
+    DIR *dir;
+    int ret;
+
+    if (!(lookup = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*lookup) ))) return NULL;
+    lookup->id.dev     = st->st_dev;
+    lookup->id.ino     = st->st_ino;
+    lookup->mtime      = st->st_mtime;
+    lookup->mtime_nsec = get_mtime_nsec( st );
+    if (!(lookup->names = RtlAllocateHeap( GetProcessHeap(), 0, names_size * sizeof(*lookup->names) )) ||
+        !(lookup->data = RtlAllocateHeap( GetProcessHeap(), 0, data_size )) ||
+        !(dir = opendir( unix_name )))
+    {
+        free_dir_lookup( lookup );
+        return NULL;
+    }
+
+    while ((de = readdir( dir )))
+    {
+        if ((ret = ntdll_umbstowcs( 0, de->d_name, strlen(de->d_name), buffer, MAX_DIR_ENTRY_LEN )) == -1)
+            continue;
+        /* keep the Unicode name aligned */
+        len = (strlen( de->d_name ) + sizeof(WCHAR)) & ~(sizeof(WCHAR) - 1);
+
+        if (lookup->count == names_size)
+        {
+            if (!(ptr = RtlReAllocateHeap( GetProcessHeap(), 0, lookup->names,
+                                           2 * names_size * sizeof(*lookup->names) ))) goto failed;
+            lookup->names = ptr;
+            names_size *= 2;
+        }
+        if (data_pos + len + ret * sizeof(WCHAR) > data_size)
+        {
+            unsigned int new_size = max( 2 * data_size, data_pos + len + ret * sizeof(WCHAR) );
+            if (!(ptr = RtlReAllocateHeap( GetProcessHeap(), 0, lookup->data, new_size ))) goto failed;
+            lookup->data = ptr;
+            data_size = new_size;
+        }
+        lookup->names[lookup->count].unix_name = data_pos;
+        strcpy( lookup->data + data_pos, de->d_name );
+        data_pos += len;
+        lookup->names[lookup->count].name = data_pos;
+        lookup->names[lookup->count].len  = ret;
+        lookup->names[lookup->count].hash = hash_dir_lookup_name( buffer, ret );
+        memcpy( lookup->data + data_pos, buffer, ret * sizeof(WCHAR) );
+        data_pos += ret * sizeof(WCHAR);
+        lookup->count++;
+    }
+    closedir( dir );
+
+    /* keep the hash table at most half full */
+    for (lookup->hash_size = 16; lookup->hash_size < 2 * lookup->count; lookup->hash_size *= 2) ;
+    if (!(lookup->hash = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY,
+                                          lookup->hash_size * sizeof(*lookup->hash) )))
+    {
+        free_dir_lookup( lookup );
+        return NULL;
+    }
+    for (len = 0; len < lookup->count; len++)
+        insert_dir_lookup_hash( lookup->hash, lookup->hash_size, lookup->names[len].hash, len );
+    return lookup;
+
+failed:
+    closedir( dir );
+    free_dir_lookup( lookup );
+    return NULL;
+}
+
+
+/***********************************************************************
+ *           get_dir_lookup
+ *
+ * Retrieve the lookup cache entry for a directory, reading it if necessary.
+ * Must be called with dir_section held.
+ */
+static struct dir_lookup *get_dir_lookup( const char *unix_name, const struct stat *st )
+{
+    struct dir_lookup *lookup;
+
+    LIST_FOR_EACH_ENTRY( lookup, &dir_lookup_cache, struct dir_lookup, entry )
+    {
+        if (!is_same_file( &lookup->id, st )) continue;
+        list_remove( &lookup->entry );
+        if (lookup->mtime == st->st_mtime && lookup->mtime_nsec == get_mtime_nsec( st ))
+        {
+            list_add_head( &dir_lookup_cache, &lookup->entry );
+            return lookup;
+        }
+        TRACE( "%s modified, discarding cached names\n", debugstr_a(unix_name) );
+        free_dir_lookup( lookup );
+        dir_lookup_cache_size--;
+        break;
+    }
+
+    /* a directory modified within the timestamp granularity could change
+     * again without its mtime changing, don't cache it yet */
+    if (st->st_mtime >= time( NULL ) - 1) return NULL;
+
+    if (!(lookup = read_dir_lookup( unix_name, st ))) return NULL;
+
+    if (dir_lookup_cache_size == dir_lookup_cache_max_size)
+    {
+        struct dir_lookup *oldest = LIST_ENTRY( list_tail( &dir_lookup_cache ), struct dir_lookup, entry );
+        list_remove( &oldest->entry );
+        free_dir_lookup( oldest );
+        dir_lookup_cache_size--;
+    }
+    list_add_head( &dir_lookup_cache, &lookup->entry );
+    dir_lookup_cache_size++;
+    TRACE( "cached %u names for %s\n", lookup->count, debugstr_a(unix_name) );
+    return lookup;
+}
+
+
+/***********************************************************************
+ *           init_dir_lookup_short_names
+ *
+ * Generate the short names of a cached directory, and their hash table.
+ */
+static BOOL init_dir_lookup_short_names( struct dir_lookup *lookup )
+{
+    struct dir_lookup_short_name *short_name;
+    UNICODE_STRING str;
+    BOOLEAN spaces;
+    unsigned int i;
+
+    if (lookup->short_hash) return TRUE;
+
+    if (!(lookup->short_names = RtlAllocateHeap( GetProcessHeap(), 0,
+                                                 max( 1, lookup->count ) * sizeof(*lookup->short_names) )))
+        return FALSE;
+    if (!(lookup->short_hash = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY,
+                                                lookup->hash_size * sizeof(*lookup->short_hash) )))
+    {
+        RtlFreeHeap( GetProcessHeap(), 0, lookup->short_names );
+        lookup->short_names = NULL;
+        return FALSE;
+    }
+
+    for (i = 0; i < lookup->count; i++)
+    {
+        short_name = &lookup->short_names[i];
+        str.Buffer = (WCHAR *)(lookup->data + lookup->names[i].name);
+        str.Length = str.MaximumLength = lookup->names[i].len * sizeof(WCHAR);
+        short_name->len = 0;
+        if (!RtlIsNameLegalDOS8Dot3( &str, NULL, &spaces ) || spaces)
+            short_name->len = hash_short_file_name( &str, short_name->name );
+        if (!short_name->len) continue;
+        short_name->hash = hash_dir_lookup_name( short_name->name, short_name->len );
+        insert_dir_lookup_hash( lookup->short_hash, lookup->hash_size, short_name->hash, i );
+    }
+    return TRUE;
+}
+
+
+/***********************************************************************
+ *           find_file_in_dir_cache
+ *
+ * Look for a file in the cached names of a directory, instead of reading it again.
+ * unix_name contains the directory, the file found is appended to it at pos.
+ * Returns -1 if the cache can't be used.
+ */
+static int find_file_in_dir_cache( char *unix_name, int pos, const WCHAR *name, int length,
+                                   BOOLEAN is_name_8_dot_3 )
+{
+    struct dir_lookup *lookup;
+    const struct dir_lookup_name *entry = NULL;
+    const struct dir_lookup_short_name *short_name;
+    unsigned int slot, index, hash, mask;
+    struct stat st;
+    int ret = 0;
+
+    if (stat( unix_name, &st ) == -1) return -1;
+
+    RtlEnterCriticalSection( &dir_section );
+
+    if (!(lookup = get_dir_lookup( unix_name, &st )))
+    {
+        RtlLeaveCriticalSection( &dir_section );
+        return -1;
+    }
+
+    hash = hash_dir_lookup_name( name, length );
+    mask = lookup->hash_size - 1;
+
+    for (slot = hash & mask; (index = lookup->hash[slot]); slot = (slot + 1) & mask)
+    {
+        entry = &lookup->names[index - 1];
+        if (entry->hash == hash && entry->len == length &&
+            !strncmpiW( (const WCHAR *)(lookup->data + entry->name), name, length )) break;
+        entry = NULL;
+    }
+
+    if (!entry && is_name_8_dot_3)
+    {
+        if (!init_dir_lookup_short_names( lookup )) ret = -1;  /* fall back to readdir */
+        else
+        {
+            for (slot = hash & mask; (index = lookup->short_hash[slot]); slot = (slot + 1) & mask)
+            {
+                short_name = &lookup->short_names[index - 1];
+                if (short_name->hash == hash && short_name->len == length &&
+                    !strncmpiW( short_name->name, name, length ))
+                {
+                    entry = &lookup->names[index - 1];
+                    break;
+                }
+            }
+        }
+    }
+
+    if (entry)
+    {
+        unix_name[pos - 1] = '/';
+        strcpy( unix_name + pos, lookup->data + entry->unix_name );
+        ret = 1;
+    }
+
+    RtlLeaveCriticalSection( &dir_section );
+    return ret;
+}
+
+
 /***********************************************************************
  *           find_file_in_dir
  *
@@ -2136,6 +2447,12 @@ static NTSTATUS find_file_in_dir( char *unix_name, int pos, const WCHAR *name, i
     }
 #endif /* VFAT_IOCTL_READDIR_BOTH */
 
+    switch (find_file_in_dir_cache( unix_name, pos, name, length, is_name_8_dot_3 ))
+    {
+    case 1: goto success;
+    case 0: goto not_found;
+    }
+
     if (!(dir = opendir( unix_name )))
     {
         if (errno == ENOENT) return STATUS_OBJECT_PATH_NOT_FOUND;
@@ -525,15 +525,6 @@ NTSTATUS esync_open_event( HANDLE *handle, ACCESS_MASK access,
     return open_esync( ESYNC_AUTO_EVENT, handle, access, attr ); /* doesn't matter which */
 }
 
-static inline void small_pause(void)
-{
-#ifdef __i386__
-    __asm__ __volatile__( "rep;nop" : : : "memory" );
-#else
-    __asm__ __volatile__( "" : : : "memory" );
-#endif
-}
-
 /* Manual-reset events are actually racier than other objects in terms of shm
  * state. With other objects, races don't matter, because we only treat the shm
  * state as a hint that lets us skip poll()—we still have to read(). But with
@@ -963,6 +963,13 @@ NTSTATUS WINAPI NtReadFile(HANDLE hFile, HANDLE hEvent,
             goto done;
         }
 
+        /* let the server queue it, so that it doesn't block the thread */
+        if (async_read && server_async_file_io && length <= MAX_ASYNC_FILE_IO_SIZE)
+        {
+            if (needs_close) close( unix_handle );
+            return server_read_file( hFile, hEvent, apc, apc_user, io_status, buffer, length, offset, key );
+        }
+
         if (offset && offset->QuadPart != FILE_USE_FILE_POINTER_POSITION)
         {
             /* async I/O doesn't make sense on regular files */
@@ -1349,6 +1356,14 @@ NTSTATUS WINAPI NtWriteFile(HANDLE hFile, HANDLE hEvent,
             offset = &offset_eof;
         }
 
+        /* let the server queue it, so that it doesn't block the thread */
+        if (async_write && server_async_file_io && offset->QuadPart >= 0 &&
+            length <= MAX_ASYNC_FILE_IO_SIZE)
+        {
+            if (needs_close) close( unix_handle );
+            return server_write_file( hFile, hEvent, apc, apc_user, io_status, buffer, length, offset, key );
+        }
+
         if (offset && offset->QuadPart != FILE_USE_FILE_POINTER_POSITION)
         {
             off_t off = offset->QuadPart;
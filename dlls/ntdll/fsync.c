@@ -27,6 +27,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #ifdef HAVE_SYS_MMAN_H
 # include <sys/mman.h>
 #endif
@@ -51,6 +52,7 @@
 #include "fsync.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(fsync);
+WINE_DECLARE_DEBUG_CHANNEL(fsyncstat);
 
 #include "pshpack4.h"
 struct futex_wait_block
@@ -64,18 +66,70 @@ struct futex_wait_block
 };
 #include "poppack.h"
 
+/* mainline replacement for FUTEX_WAIT_MULTIPLE, available since Linux 5.16 */
+#ifndef __NR_futex_waitv
+#define __NR_futex_waitv 449
+#endif
+#define FUTEX2_SIZE_U32 0x02
+
+struct futex_waitv_block
+{
+    ULONGLONG    val;
+    ULONGLONG    uaddr;
+    unsigned int flags;
+    unsigned int reserved;
+};
+
+/* struct __kernel_timespec, 64-bit even where time_t is 32-bit */
+struct futex_waitv_timespec
+{
+    LONGLONG tv_sec;
+    LONGLONG tv_nsec;
+};
+
+static int use_futex_waitv;
+
 static inline int futex_wait_multiple( const struct futex_wait_block *futexes,
         int count, const struct timespec *timeout )
 {
+    if (use_futex_waitv)
+    {
+        struct futex_waitv_block waitv[MAXIMUM_WAIT_OBJECTS + 1];
+        struct futex_waitv_timespec end;
+        struct timespec now;
+        int i;
+
+        for (i = 0; i < count; i++)
+        {
+            waitv[i].val      = (unsigned int)futexes[i].val;
+            waitv[i].uaddr    = (ULONG_PTR)futexes[i].addr;
+            waitv[i].flags    = FUTEX2_SIZE_U32;
+            waitv[i].reserved = 0;
+        }
+
+        /* futex_waitv() takes an absolute timeout */
+        if (timeout)
+        {
+            clock_gettime( CLOCK_MONOTONIC, &now );
+            end.tv_sec  = (LONGLONG)now.tv_sec + timeout->tv_sec;
+            end.tv_nsec = (LONGLONG)now.tv_nsec + timeout->tv_nsec;
+            if (end.tv_nsec >= 1000000000)
+            {
+                end.tv_sec++;
+                end.tv_nsec -= 1000000000;
+            }
+        }
+        return syscall( __NR_futex_waitv, waitv, count, 0, timeout ? &end : NULL, CLOCK_MONOTONIC );
+    }
     return syscall( __NR_futex, futexes, 31, count, timeout, 0, 0 );
 }
 
-static inline int futex_wake( int *addr, int val )
+int fsync_futex_wake( int *addr, int val )
 {
     return syscall( __NR_futex, addr, 1, val, NULL, 0, 0 );
 }
 
-static inline int futex_wait( int *addr, int val, struct timespec *timeout )
+int fsync_futex_wait( int *addr, int val, struct timespec *timeout )
 {
     return syscall( __NR_futex, addr, 0, val, timeout, 0, 0 );
 }
@@ -88,8 +142,15 @@ int do_fsync(void)
     if (do_fsync_cached == -1)
     {
         static const struct timespec zero;
-        futex_wait_multiple( NULL, 0, &zero );
+
+        /* an empty futex_waitv() fails with EINVAL if the syscall exists */
+        if (syscall( __NR_futex_waitv, NULL, 0, 0, NULL, 0 ) == -1 && errno == ENOSYS)
+            futex_wait_multiple( NULL, 0, &zero );
+        else
+            use_futex_waitv = 1;
         do_fsync_cached = getenv("WINEFSYNC") && atoi(getenv("WINEFSYNC")) && errno != ENOSYS;
+        if (do_fsync_cached)
+            TRACE( "using %s\n", use_futex_waitv ? "futex_waitv" : "FUTEX_WAIT_MULTIPLE" );
     }
 
     return do_fsync_cached;
@@ -104,6 +165,7 @@ int do_fsync(void)
 struct fsync
 {
     enum fsync_type type;
+    int spins;              /* average spin count needed to acquire the object */
     void *shm;              /* pointer to shm section */
 };
 
@@ -217,7 +279,10 @@ static struct fsync *add_to_list( HANDLE handle, enum fsync_type type, void *shm
     }
 
     if (!__sync_val_compare_and_swap((int *)&fsync_list[entry][idx].type, 0, type ))
+    {
+        fsync_list[entry][idx].spins = 0;
         fsync_list[entry][idx].shm = shm;
+    }
 
     return &fsync_list[entry][idx];
 }
@@ -240,6 +305,7 @@ static NTSTATUS get_object( HANDLE handle, struct fsync **obj )
 {
     NTSTATUS ret = STATUS_SUCCESS;
     unsigned int shm_idx = 0;
+    handle_shm_entry_t info;
     enum fsync_type type;
 
     if ((*obj = get_cached_object( handle ))) return STATUS_SUCCESS;
@@ -250,6 +316,14 @@ static NTSTATUS get_object( HANDLE handle, struct fsync **obj )
         return STATUS_NOT_IMPLEMENTED;
     }
 
+    /* The server mirrors the handle table, try that before asking it. */
+    if (server_get_handle_entry( handle, &info ) && (info.access & SYNCHRONIZE) && info.fsync_idx)
+    {
+        TRACE("Got shm index %d for handle %p from the handle table.\n", info.fsync_idx, handle);
+        *obj = add_to_list( handle, info.fsync_type, get_shm( info.fsync_idx ) );
+        return ret;
+    }
+
     /* We need to try grabbing it from the server. */
     SERVER_START_REQ( get_fsync_idx )
     {
@@ -441,7 +515,7 @@ NTSTATUS fsync_release_semaphore( HANDLE handle, ULONG count, ULONG *prev )
 
     if (prev) *prev = current;
 
-    futex_wake( &semaphore->count, INT_MAX );
+    fsync_futex_wake( &semaphore->count, INT_MAX );
 
     return STATUS_SUCCESS;
 }
@@ -505,7 +579,7 @@ NTSTATUS fsync_set_event( HANDLE handle, LONG *prev )
     event = obj->shm;
 
     if (!(current = __atomic_exchange_n( &event->signaled, 1, __ATOMIC_SEQ_CST )))
-        futex_wake( &event->signaled, INT_MAX );
+        fsync_futex_wake( &event->signaled, INT_MAX );
 
     if (prev) *prev = current;
 
@@ -547,7 +621,7 @@ NTSTATUS fsync_pulse_event( HANDLE handle, LONG *prev )
      * Unfortunately we can't really do much better. Fortunately this is rarely
      * used (and publicly deprecated). */
     if (!(current = __atomic_exchange_n( &event->signaled, 1, __ATOMIC_SEQ_CST )))
-        futex_wake( &event->signaled, INT_MAX );
+        fsync_futex_wake( &event->signaled, INT_MAX );
 
     /* Try to give other threads a chance to wake up. Hopefully erring on this
      * side is the better thing to do... */
@@ -622,7 +696,7 @@ NTSTATUS fsync_release_mutex( HANDLE handle, LONG *prev )
     if (!--mutex->count)
     {
         __atomic_store_n( &mutex->tid, 0, __ATOMIC_SEQ_CST );
-        futex_wake( &mutex->tid, INT_MAX );
+        fsync_futex_wake( &mutex->tid, INT_MAX );
     }
 
     return STATUS_SUCCESS;
@@ -711,10 +785,10 @@ static NTSTATUS do_single_wait( int *addr, int val, ULONGLONG *end, BOOLEAN aler
             struct timespec tmo_p;
             tmo_p.tv_sec = timeleft / (ULONGLONG)TICKSPERSEC;
             tmo_p.tv_nsec = (timeleft % TICKSPERSEC) * 100;
-            ret = futex_wait( addr, val, &tmo_p );
+            ret = fsync_futex_wait( addr, val, &tmo_p );
         }
         else
-            ret = futex_wait( addr, val, NULL );
+            ret = fsync_futex_wait( addr, val, NULL );
     }
 
     if (!ret)
@@ -725,6 +799,77 @@ static NTSTATUS do_single_wait( int *addr, int val, ULONGLONG *end, BOOLEAN aler
         return STATUS_PENDING;
 }
 
+/* Before blocking, a wait-any spins for a while in case the object is only
+ * held for a short time; each object keeps its own spin estimate. */
+
+static int get_spin_count( struct fsync * const *objs, DWORD count, const LARGE_INTEGER *timeout )
+{
+    int i, spins = 0;
+
+    if (NtCurrentTeb()->Peb->NumberOfProcessors <= 1) return 0;
+    if (timeout && !timeout->QuadPart) return 0;
+
+    for (i = 0; i < count; i++)
+    {
+        if (!objs[i]) return 0;
+        switch (objs[i]->type)
+        {
+        case FSYNC_SEMAPHORE:
+        case FSYNC_MUTEX:
+        case FSYNC_AUTO_EVENT:
+        case FSYNC_MANUAL_EVENT:
+            spins = max( spins, adaptive_spin_count( objs[i]->spins, MAX_ADAPTIVE_SPIN_COUNT ) );
+            break;
+        default:
+            /* server objects are signaled by a server call, spinning won't help */
+            return 0;
+        }
+    }
+    return spins;
+}
+
+static void update_spin_count( struct fsync * const *objs, DWORD count, int spins )
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        int new_spins = adaptive_spin_update( objs[i]->spins, spins );
+        if (new_spins != objs[i]->spins) objs[i]->spins = new_spins;
+    }
+}
+
+/* contention statistics per object type, dumped on the fsyncstat channel */
+enum contention_stat
+{
+    STAT_UNCONTENDED,   /* acquired at the first try */
+    STAT_SPIN,          /* acquired while spinning */
+    STAT_BLOCK,         /* blocked in the kernel */
+    STAT_COUNT
+};
+
+static unsigned int contention_stats[FSYNC_QUEUE + 1][STAT_COUNT];
+
+static void add_contention_stat( enum fsync_type type, enum contention_stat stat )
+{
+    static const char * const names[] =
+    {
+        "unknown", "semaphore", "auto event", "manual event", "mutex",
+        "auto server", "manual server", "queue"
+    };
+    static unsigned int total;
+    int i;
+
+    if (type > FSYNC_QUEUE) type = 0;
+    __atomic_fetch_add( &contention_stats[type][stat], 1, __ATOMIC_RELAXED );
+    if (!stats_dump_due( __atomic_add_fetch( &total, 1, __ATOMIC_RELAXED ))) return;
+
+    for (i = 1; i <= FSYNC_QUEUE; i++)
+        TRACE_(fsyncstat)( "%s: %u uncontended, %u after spinning, %u blocked\n", names[i],
+                           contention_stats[i][STAT_UNCONTENDED], contention_stats[i][STAT_SPIN],
+                           contention_stats[i][STAT_BLOCK] );
+}
+
 static NTSTATUS __fsync_wait_objects( DWORD count, const HANDLE *handles,
     BOOLEAN wait_any, BOOLEAN alertable, const LARGE_INTEGER *timeout )
 {
@@ -733,6 +878,8 @@ static NTSTATUS __fsync_wait_objects( DWORD count, const HANDLE *handles,
     struct futex_wait_block futexes[MAXIMUM_WAIT_OBJECTS + 1];
     struct fsync *objs[MAXIMUM_WAIT_OBJECTS];
     int has_fsync = 0, has_server = 0;
+    int spin = 0, max_spin = 0;
+    BOOL blocked = FALSE;
     BOOL msgwait = FALSE;
     int dummy_futex = 0;
     LONGLONG timeleft;
@@ -812,6 +959,8 @@ static NTSTATUS __fsync_wait_objects( DWORD count, const HANDLE *handles,
 
     if (wait_any || count == 1)
     {
+        if (!msgwait) max_spin = get_spin_count( objs, count, timeout );
+
         while (1)
         {
             /* Try to grab anything. */
@@ -852,7 +1001,7 @@ static NTSTATUS __fsync_wait_objects( DWORD count, const HANDLE *handles,
                         if (current)
                         {
                             TRACE("Woken up by handle %p [%d].\n", handles[i], i);
-                            return i;
+                            goto acquired;
                         }
 
                         futexes[i].addr = &semaphore->count;
@@ -868,14 +1017,14 @@ static NTSTATUS __fsync_wait_objects( DWORD count, const HANDLE *handles,
                         {
                             TRACE("Woken up by handle %p [%d].\n", handles[i], i);
                             mutex->count++;
-                            return i;
+                            goto acquired;
                         }
 
                         if (!(tid = __sync_val_compare_and_swap( &mutex->tid, 0, GetCurrentThreadId() )))
                         {
                             TRACE("Woken up by handle %p [%d].\n", handles[i], i);
                             mutex->count = 1;
-                            return i;
+                            goto acquired;
                         }
 
                         futexes[i].addr = &mutex->tid;
@@ -890,7 +1039,7 @@ static NTSTATUS __fsync_wait_objects( DWORD count, const HANDLE *handles,
                         if (__sync_val_compare_and_swap( &event->signaled, 1, 0 ))
                         {
                             TRACE("Woken up by handle %p [%d].\n", handles[i], i);
-                            return i;
+                            goto acquired;
                         }
 
                         futexes[i].addr = &event->signaled;
@@ -906,7 +1055,7 @@ static NTSTATUS __fsync_wait_objects( DWORD count, const HANDLE *handles,
                         if (__atomic_load_n( &event->signaled, __ATOMIC_SEQ_CST ))
                         {
                             TRACE("Woken up by handle %p [%d].\n", handles[i], i);
-                            return i;
+                            goto acquired;
                         }
 
                         futexes[i].addr = &event->signaled;
@@ -944,6 +1093,18 @@ static NTSTATUS __fsync_wait_objects( DWORD count, const HANDLE *handles,
             }
             waitcount = i;
 
+            if (max_spin)
+            {
+                if (spin++ < max_spin)
+                {
+                    small_pause();
+                    continue;
+                }
+                /* the objects are held for longer than spinning is worth */
+                update_spin_count( objs, count, 0 );
+                max_spin = 0;
+            }
+
             /* Looks like everything is contended, so wait. */
 
             if (timeout && !timeout->QuadPart)
@@ -953,7 +1114,15 @@ static NTSTATUS __fsync_wait_objects( DWORD count, const HANDLE *handles,
                 TRACE("Wait timed out.\n");
                 return STATUS_TIMEOUT;
             }
-            else if (timeout)
+
+            if (TRACE_ON(fsyncstat))
+            {
+                for (i = 0; i < count; i++)
+                    if (objs[i]) add_contention_stat( objs[i]->type, STAT_BLOCK );
+            }
+            blocked = TRUE;
+
+            if (timeout)
             {
                 LONGLONG timeleft = update_timeout( end );
                 struct timespec tmo_p;
@@ -975,6 +1144,12 @@ static NTSTATUS __fsync_wait_objects( DWORD count, const HANDLE *handles,
                 return STATUS_TIMEOUT;
             }
         } /* while (1) */
+
+acquired:
+        if (max_spin) update_spin_count( objs, count, spin );
+        if (TRACE_ON(fsyncstat) && !blocked)
+            add_contention_stat( objs[i]->type, spin ? STAT_SPIN : STAT_UNCONTENDED );
+        return i;
     }
     else
     {
@@ -21,6 +21,8 @@
 extern int do_fsync(void) DECLSPEC_HIDDEN;
 extern void fsync_init(void) DECLSPEC_HIDDEN;
 extern NTSTATUS fsync_close( HANDLE handle ) DECLSPEC_HIDDEN;
+extern int fsync_futex_wake( int *addr, int val ) DECLSPEC_HIDDEN;
+extern int fsync_futex_wait( int *addr, int val, struct timespec *timeout ) DECLSPEC_HIDDEN;
 
 extern NTSTATUS fsync_create_semaphore(HANDLE *handle, ACCESS_MASK access,
     const OBJECT_ATTRIBUTES *attr, LONG initial, LONG max) DECLSPEC_HIDDEN;
@@ -47,6 +47,7 @@
 #include "wine/server.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(heap);
+WINE_DECLARE_DEBUG_CHANNEL(heapstats);
 
 /* Note: the heap data structures are loosely based on what Pietrek describes in his
  * book 'Windows 95 System Programming Secrets', with some adaptations for
@@ -93,6 +94,7 @@ typedef struct
 #define ARENA_PENDING_MAGIC    0xbedead
 #define ARENA_FREE_MAGIC       0x45455246
 #define ARENA_LARGE_MAGIC      0x6752614c
+#define ARENA_LFH_MAGIC        0x48464c    /* block cached by the low-fragmentation front-end */
 
 #define ARENA_INUSE_FILLER     0x55
 #define ARENA_TAIL_FILLER      0xab
@@ -130,6 +132,28 @@ C_ASSERT( sizeof(ARENA_LARGE) % LARGE_ALIGNMENT == 0 );
 /* number of free lists */
 #define HEAP_NB_FREE_LISTS  128
 
+/* largest block size served by the low-fragmentation front-end */
+#define HEAP_LFH_MAX_SIZE     0x400
+/* returns the front-end bin for a given block size */
+#define HEAP_SIZE_TO_LFH_BIN(size)  (((size) - HEAP_MIN_DATA_SIZE) / ALIGNMENT)
+/* number of front-end bins, one per block size */
+#define HEAP_LFH_NB_BINS      (HEAP_SIZE_TO_LFH_BIN( HEAP_LFH_MAX_SIZE ) + 1)
+/* number of thread affinity slots per bin */
+#define HEAP_LFH_NB_SLOTS     4
+/* max number of bytes cached in a bin slot */
+#define HEAP_LFH_SLOT_BYTES   0x4000
+/* number of backend allocations of a given size before its bin gets refilled */
+#define HEAP_LFH_ACTIVATION   16
+/* number of bytes carved at once from the backend when refilling a bin */
+#define HEAP_LFH_REFILL_BYTES 0x1000
+
+typedef struct
+{
+    SLIST_HEADER     bins[HEAP_LFH_NB_SLOTS][HEAP_LFH_NB_BINS]; /* cached blocks, per slot and size */
+    LONG             usage[HEAP_LFH_NB_BINS];  /* backend allocations per size, protected by the heap lock */
+    LONG             hits[HEAP_LFH_NB_SLOTS][HEAP_LFH_NB_BINS];  /* allocations served from the bins */
+} HEAP_LFH;
+
 struct tagHEAP;
 
 typedef struct tagSUBHEAP
@@ -160,10 +184,15 @@ typedef struct tagHEAP
     DWORD            magic;         /* Magic number */
     DWORD            pending_pos;   /* Position in pending free requests ring */
     ARENA_INUSE    **pending_free;  /* Ring buffer for pending free requests */
+    HEAP_LFH        *lfh;           /* Low-fragmentation front-end, if enabled */
     RTL_CRITICAL_SECTION critSection; /* Critical section for serialization */
     struct list     *freeList;      /* Free lists */
     struct wine_rb_tree freeTree;   /* Free tree */
     unsigned long    freeMask[HEAP_NB_FREE_LISTS / (8 * sizeof(unsigned long))];
+    ULONGLONG        lock_count;    /* Number of lock acquisitions */
+    ULONGLONG        lock_waits;    /* Number of lock acquisitions that had to wait */
+    ULONGLONG        alloc_count[HEAP_WINE_STATS_CLASSES];  /* Locked allocations per size class */
+    DWORD            stats_time;    /* Time of the last statistics dump */
 } HEAP;
 
 #define HEAP_FREEMASK_BLOCK    (8 * sizeof(unsigned long))
@@ -177,6 +206,7 @@ C_ASSERT( HEAP_NB_FREE_LISTS % HEAP_FREEMASK_BLOCK == 0 );
 #define HEAP_DEF_SIZE        0x110000   /* Default heap size = 1Mb + 64Kb */
 #define COMMIT_MASK          0xffff  /* bitmask for commit/decommit granularity */
 #define MAX_FREE_PENDING     1024    /* max number of free requests to delay */
+#define STATS_DUMP_INTERVAL  10000   /* interval between statistics dumps in ms */
 
 /* some undocumented flags (names are made up) */
 #define HEAP_PAGE_ALLOCS      0x01000000
@@ -184,6 +214,10 @@ C_ASSERT( HEAP_NB_FREE_LISTS % HEAP_FREEMASK_BLOCK == 0 );
 #define HEAP_VALIDATE_ALL     0x20000000
 #define HEAP_VALIDATE_PARAMS  0x40000000
 
+/* heap flags that prevent the use of the low-fragmentation front-end */
+#define HEAP_LFH_DISABLE_FLAGS (HEAP_NO_SERIALIZE | HEAP_SHARED | HEAP_PAGE_ALLOCS | HEAP_VALIDATE | \
+                                HEAP_TAIL_CHECKING_ENABLED | HEAP_FREE_CHECKING_ENABLED)
+
 static HEAP *processHeap;  /* main process heap */
 
 static BOOL HEAP_IsRealArena( HEAP *heapPtr, DWORD flags, LPCVOID block, BOOL quiet );
@@ -326,7 +360,8 @@ static void subheap_notify_free_all(SUBHEAP const *subheap)
         {
             ARENA_INUSE const *pArena = (ARENA_INUSE const *)ptr;
             if (pArena->magic == ARENA_INUSE_MAGIC) notify_free(pArena + 1);
-            else if (pArena->magic != ARENA_PENDING_MAGIC) ERR("bad inuse_magic @%p\n", pArena);
+            else if (pArena->magic != ARENA_PENDING_MAGIC && pArena->magic != ARENA_LFH_MAGIC)
+                ERR("bad inuse_magic @%p\n", pArena);
             ptr += sizeof(*pArena) + (pArena->size & ARENA_SIZE_MASK);
         }
     }
@@ -442,7 +477,8 @@ static void HEAP_Dump( HEAP *heap )
             {
                 ARENA_INUSE *pArena = (ARENA_INUSE *)ptr;
                 TRACE( "%p %08x %s %08x\n",
-                         pArena, pArena->magic, pArena->magic == ARENA_INUSE_MAGIC ? "used" : "pend",
+                         pArena, pArena->magic, pArena->magic == ARENA_INUSE_MAGIC ? "used" :
+                         (pArena->magic == ARENA_LFH_MAGIC ? "lfh " : "pend"),
                          pArena->size & ARENA_SIZE_MASK );
                 ptr += sizeof(*pArena) + (pArena->size & ARENA_SIZE_MASK);
                 arenaSize += sizeof(ARENA_INUSE);
@@ -525,6 +561,37 @@ static HEAP *HEAP_GetPtr(
 }
 
 
+/***********************************************************************
+ *           heap_lock
+ *
+ * Acquire the heap lock, keeping track of contention.
+ */
+static inline void heap_lock( HEAP *heap, DWORD flags )
+{
+    if (flags & HEAP_NO_SERIALIZE) return;
+    if (!RtlTryEnterCriticalSection( &heap->critSection ))
+    {
+        enter_critical_section( &heap->critSection );
+        heap->lock_waits++;
+    }
+    heap->lock_count++;
+}
+
+
+/***********************************************************************
+ *           get_stats_class
+ *
+ * Get the statistics size class for a given block size.
+ */
+static inline unsigned int get_stats_class( SIZE_T size )
+{
+    unsigned int class = 0;
+
+    for (size >>= 5; size && class < HEAP_WINE_STATS_CLASSES - 1; size >>= 1) class++;
+    return class;
+}
+
+
 /***********************************************************************
  *           HEAP_InsertFreeBlock
  *
@@ -745,10 +812,11 @@ static void HEAP_MakeInUseBlockFree( SUBHEAP *subheap, ARENA_INUSE *pArena )
     if ((char *)pFree + size < (char *)subheap->base + subheap->size)
         return;  /* Not the last block, so nothing more to do */
 
-    /* Free the whole sub-heap if it's empty and not the original one */
+    /* Free the whole sub-heap if it's empty and not the original one. Sub-heaps
+     * are kept once the front-end is enabled, as it looks them up without locking. */
 
     if (((char *)pFree == (char *)subheap->base + subheap->headerSize) &&
-        (subheap != &subheap->heap->subheap))
+        (subheap != &subheap->heap->subheap) && !heap->lfh)
     {
         void *addr = subheap->base;
 
@@ -999,7 +1067,13 @@ static SUBHEAP *HEAP_CreateSubHeap( HEAP *heap, LPVOID address, DWORD flags,
         subheap->commitSize = commitSize;
         subheap->magic      = SUBHEAP_MAGIC;
         subheap->headerSize = ROUND_SIZE( sizeof(SUBHEAP) );
-        list_add_head( &heap->subheap_list, &subheap->entry );
+
+        /* the list can be walked by the front-end without the heap lock,
+         * so make sure the entry is complete before linking it in */
+        subheap->entry.next = heap->subheap_list.next;
+        subheap->entry.prev = &heap->subheap_list;
+        heap->subheap_list.next->prev = &subheap->entry;
+        interlocked_xchg_ptr( (void **)&heap->subheap_list.next, &subheap->entry );
     }
     else
     {
@@ -1352,7 +1426,8 @@ static BOOL HEAP_ValidateInUseArena( const SUBHEAP *subheap, const ARENA_INUSE *
     }
 
     /* Check magic number */
-    if (pArena->magic != ARENA_INUSE_MAGIC && pArena->magic != ARENA_PENDING_MAGIC)
+    if (pArena->magic != ARENA_INUSE_MAGIC && pArena->magic != ARENA_PENDING_MAGIC &&
+        pArena->magic != ARENA_LFH_MAGIC)
     {
         if (quiet == NOISY) {
             ERR("Heap %p: invalid in-use arena magic %08x for %p\n", subheap->heap, pArena->magic, pArena );
@@ -1439,7 +1514,7 @@ static BOOL HEAP_ValidateInUseArena( const SUBHEAP *subheap, const ARENA_INUSE *
             ptr++;
         }
     }
-    else if (flags & HEAP_TAIL_CHECKING_ENABLED)
+    else if ((flags & HEAP_TAIL_CHECKING_ENABLED) && pArena->magic == ARENA_INUSE_MAGIC)
     {
         const unsigned char *data = (const unsigned char *)(pArena + 1) + size - pArena->unused_bytes;
 
@@ -1567,7 +1642,7 @@ static BOOL validate_block_pointer( HEAP *heap, SUBHEAP **ret_subheap, const ARE
         ret = HEAP_ValidateInUseArena( subheap, arena, QUIET );
     else if ((ULONG_PTR)arena % ALIGNMENT != ARENA_OFFSET)
         WARN( "Heap %p: unaligned arena pointer %p\n", subheap->heap, arena );
-    else if (arena->magic == ARENA_PENDING_MAGIC)
+    else if (arena->magic == ARENA_PENDING_MAGIC || arena->magic == ARENA_LFH_MAGIC)
         WARN( "Heap %p: block %p used after free\n", subheap->heap, arena + 1 );
     else if (arena->magic != ARENA_INUSE_MAGIC)
         WARN( "Heap %p: invalid in-use arena magic %08x for %p\n", subheap->heap, arena->magic, arena );
@@ -1585,6 +1660,286 @@ static BOOL validate_block_pointer( HEAP *heap, SUBHEAP **ret_subheap, const ARE
 }
 
 
+/***********************************************************************
+ *           lfh_usable
+ *
+ * Check whether the low-fragmentation front-end can be used for a heap.
+ */
+static inline BOOL lfh_usable( const HEAP *heap )
+{
+    return heap->lfh && !(heap->flags & HEAP_LFH_DISABLE_FLAGS);
+}
+
+
+/***********************************************************************
+ *           lfh_get_slot
+ *
+ * Get the front-end affinity slot for the current thread.
+ */
+static inline unsigned int lfh_get_slot(void)
+{
+    return (HandleToULong( NtCurrentTeb()->ClientId.UniqueThread ) >> 2) % HEAP_LFH_NB_SLOTS;
+}
+
+
+/***********************************************************************
+ *           lfh_allocate_block
+ *
+ * Lock-free allocation of a cached block from the front-end.
+ */
+static void *lfh_allocate_block( HEAP *heap, DWORD flags, SIZE_T size, SIZE_T rounded_size )
+{
+    unsigned int i, slot = lfh_get_slot(), bin = HEAP_SIZE_TO_LFH_BIN( rounded_size );
+    SLIST_ENTRY *entry = NULL;
+    ARENA_INUSE *arena;
+
+    /* try our own slot first, then steal from the other ones */
+    for (i = 0; i < HEAP_LFH_NB_SLOTS && !entry; i++)
+        entry = RtlInterlockedPopEntrySList( &heap->lfh->bins[(slot + i) % HEAP_LFH_NB_SLOTS][bin] );
+    if (!entry) return NULL;
+    interlocked_inc( &heap->lfh->hits[slot][bin] );
+
+    arena = (ARENA_INUSE *)entry - 1;
+    arena->magic = ARENA_INUSE_MAGIC;
+    arena->unused_bytes = (arena->size & ARENA_SIZE_MASK) - size;
+
+    notify_alloc( arena + 1, size, flags & HEAP_ZERO_MEMORY );
+    initialize_block( arena + 1, size, arena->unused_bytes, flags );
+    return arena + 1;
+}
+
+
+/***********************************************************************
+ *           lfh_free_block
+ *
+ * Lock-free release of a block to the front-end. Returns FALSE if the
+ * block has to go through the normal free path instead.
+ */
+static BOOL lfh_free_block( HEAP *heap, ARENA_INUSE *arena )
+{
+    ARENA_INUSE old, new;
+    SLIST_HEADER *list;
+    SUBHEAP *subheap;
+    SIZE_T size;
+
+    if ((ULONG_PTR)arena % ALIGNMENT != ARENA_OFFSET) return FALSE;
+    if (!(subheap = HEAP_FindSubHeap( heap, arena ))) return FALSE;
+    if ((const char *)arena < (char *)subheap->base + subheap->headerSize) return FALSE;
+
+    old = *arena;
+    size = old.size & ARENA_SIZE_MASK;
+    if ((old.size & ARENA_FLAG_FREE) || old.magic != ARENA_INUSE_MAGIC) return FALSE;
+    if (size < HEAP_MIN_DATA_SIZE || size > HEAP_LFH_MAX_SIZE) return FALSE;
+
+    list = &heap->lfh->bins[lfh_get_slot()][HEAP_SIZE_TO_LFH_BIN( size )];
+    if (RtlQueryDepthSList( list ) >= HEAP_LFH_SLOT_BYTES / (size + sizeof(ARENA_INUSE))) return FALSE;
+
+    /* atomically switch the magic so that concurrent double frees are caught */
+    new = old;
+    new.magic = ARENA_LFH_MAGIC;
+    if (interlocked_cmpxchg( (int *)arena + 1, ((int *)&new)[1], ((int *)&old)[1] ) != ((int *)&old)[1])
+        return FALSE;
+
+    RtlInterlockedPushEntrySList( list, (SLIST_ENTRY *)(arena + 1) );
+    return TRUE;
+}
+
+
+/***********************************************************************
+ *           lfh_refill
+ *
+ * Carve a batch of blocks of a given size from the backend into the
+ * front-end bins of the current thread. Must be called with the heap lock held.
+ */
+static void lfh_refill( HEAP *heap, SIZE_T rounded_size )
+{
+    unsigned int slot = lfh_get_slot(), bin = HEAP_SIZE_TO_LFH_BIN( rounded_size );
+    SIZE_T count = HEAP_LFH_REFILL_BYTES / (rounded_size + sizeof(ARENA_INUSE));
+    ARENA_FREE *pArena;
+    ARENA_INUSE *pInUse;
+    SUBHEAP *subheap;
+
+    /* only cache sizes that are actually in use */
+    if (heap->lfh->usage[bin] < HEAP_LFH_ACTIVATION)
+    {
+        heap->lfh->usage[bin]++;
+        return;
+    }
+    if (RtlFirstEntrySList( &heap->lfh->bins[slot][bin] )) return;
+
+    while (count--)
+    {
+        if (!(pArena = HEAP_FindFreeBlock( heap, rounded_size, &subheap ))) break;
+        HEAP_DeleteFreeBlock( heap, pArena );
+
+        pInUse = (ARENA_INUSE *)pArena;
+        pInUse->size  = (pInUse->size & ~ARENA_FLAG_FREE) + sizeof(ARENA_FREE) - sizeof(ARENA_INUSE);
+        pInUse->magic = ARENA_LFH_MAGIC;
+        pInUse->unused_bytes = 0;
+        HEAP_ShrinkBlock( subheap, pInUse, rounded_size );
+
+        bin = HEAP_SIZE_TO_LFH_BIN( pInUse->size & ARENA_SIZE_MASK );
+        RtlInterlockedPushEntrySList( &heap->lfh->bins[slot][bin], (SLIST_ENTRY *)(pInUse + 1) );
+    }
+}
+
+
+/***********************************************************************
+ *           lfh_flush
+ *
+ * Return all the cached blocks to the backend. Must be called with the heap lock held.
+ */
+static void lfh_flush( HEAP *heap )
+{
+    SLIST_ENTRY *entry, *next;
+    ARENA_INUSE *arena;
+    unsigned int i, j;
+
+    for (i = 0; i < HEAP_LFH_NB_SLOTS; i++)
+    {
+        for (j = 0; j < HEAP_LFH_NB_BINS; j++)
+        {
+            for (entry = RtlInterlockedFlushSList( &heap->lfh->bins[i][j] ); entry; entry = next)
+            {
+                next = entry->Next;
+                arena = (ARENA_INUSE *)entry - 1;
+                arena->magic = ARENA_INUSE_MAGIC;
+                HEAP_MakeInUseBlockFree( HEAP_FindSubHeap( heap, arena ), arena );
+            }
+        }
+    }
+}
+
+
+/***********************************************************************
+ *           heap_enable_lfh
+ *
+ * Enable the low-fragmentation front-end for a heap.
+ */
+static NTSTATUS heap_enable_lfh( HEAP *heap )
+{
+    SIZE_T size = sizeof(*heap->lfh);
+    void *ptr = NULL;
+
+    if (heap->lfh) return STATUS_SUCCESS;
+    if ((heap->flags & HEAP_LFH_DISABLE_FLAGS) || heap->pending_free) return STATUS_UNSUCCESSFUL;
+
+    if (virtual_alloc_aligned( &ptr, 0, &size, MEM_COMMIT, PAGE_READWRITE, 4 ))
+        return STATUS_NO_MEMORY;
+
+    enter_critical_section( &heap->critSection );
+    if (!heap->lfh)
+    {
+        heap->lfh = ptr;
+        ptr = NULL;
+    }
+    leave_critical_section( &heap->critSection );
+
+    if (ptr)
+    {
+        size = 0;
+        NtFreeVirtualMemory( NtCurrentProcess(), &ptr, &size, MEM_RELEASE );
+    }
+    TRACE( "enabled low-fragmentation front-end for heap %p\n", heap );
+    return STATUS_SUCCESS;
+}
+
+
+/***********************************************************************
+ *           heap_get_statistics
+ */
+static void heap_get_statistics( HEAP *heap, HEAP_WINE_STATISTICS *stats )
+{
+    SUBHEAP *subheap;
+    ARENA_LARGE *large;
+    unsigned int i, j;
+    char *ptr;
+
+    memset( stats, 0, sizeof(*stats) );
+
+    if (!(heap->flags & HEAP_NO_SERIALIZE)) enter_critical_section( &heap->critSection );
+
+    LIST_FOR_EACH_ENTRY( subheap, &heap->subheap_list, SUBHEAP, entry )
+    {
+        stats->SubHeaps++;
+        stats->ReservedSize += subheap->size;
+        stats->CommittedSize += subheap->commitSize;
+
+        ptr = (char *)subheap->base + subheap->headerSize;
+        while (ptr < (char *)subheap->base + subheap->size)
+        {
+            DWORD size = *(DWORD *)ptr & ARENA_SIZE_MASK;
+
+            if (*(DWORD *)ptr & ARENA_FLAG_FREE)
+            {
+                stats->FreeBlocks++;
+                stats->FreeSize += size;
+                stats->FreeBlocksBySize[get_stats_class( size )]++;
+                ptr += sizeof(ARENA_FREE) + size;
+            }
+            else
+            {
+                if (((ARENA_INUSE *)ptr)->magic == ARENA_LFH_MAGIC)
+                {
+                    stats->CachedBlocks++;
+                    stats->CachedSize += size;
+                }
+                ptr += sizeof(ARENA_INUSE) + size;
+            }
+        }
+    }
+
+    LIST_FOR_EACH_ENTRY( large, &heap->large_list, ARENA_LARGE, entry )
+    {
+        stats->LargeBlocks++;
+        stats->LargeSize += large->block_size;
+    }
+    stats->ReservedSize += stats->LargeSize;
+    stats->CommittedSize += stats->LargeSize;
+
+    stats->LockAcquisitions = heap->lock_count;
+    stats->LockContentions = heap->lock_waits;
+    for (i = 0; i < HEAP_WINE_STATS_CLASSES; i++)
+        stats->AllocationsBySize[i] = heap->alloc_count[i];
+    if (heap->lfh)
+    {
+        for (i = 0; i < HEAP_LFH_NB_SLOTS; i++)
+            for (j = 0; j < HEAP_LFH_NB_BINS; j++)
+                stats->AllocationsBySize[get_stats_class( HEAP_MIN_DATA_SIZE + j * ALIGNMENT )] += heap->lfh->hits[i][j];
+    }
+
+    if (!(heap->flags & HEAP_NO_SERIALIZE)) leave_critical_section( &heap->critSection );
+}
+
+
+/***********************************************************************
+ *           heap_dump_statistics
+ */
+static void heap_dump_statistics( HEAP *heap )
+{
+    HEAP_WINE_STATISTICS stats;
+    unsigned int i;
+
+    heap_get_statistics( heap, &stats );
+
+    TRACE_(heapstats)( "heap %p: %u sub-heaps, reserved %#lx committed %#lx\n",
+                       heap, stats.SubHeaps, stats.ReservedSize, stats.CommittedSize );
+    TRACE_(heapstats)( "heap %p: free %#lx in %u blocks, cached %#lx in %u blocks, large %#lx in %u blocks\n",
+                       heap, stats.FreeSize, stats.FreeBlocks, stats.CachedSize, stats.CachedBlocks,
+                       stats.LargeSize, stats.LargeBlocks );
+    TRACE_(heapstats)( "heap %p: lock acquired %s times, %s contended\n", heap,
+                       wine_dbgstr_longlong( stats.LockAcquisitions ),
+                       wine_dbgstr_longlong( stats.LockContentions ));
+    for (i = 0; i < HEAP_WINE_STATS_CLASSES; i++)
+    {
+        if (!stats.FreeBlocksBySize[i] && !stats.AllocationsBySize[i]) continue;
+        TRACE_(heapstats)( "heap %p: size >= %#lx: %u free blocks, %s allocations\n", heap,
+                           i ? (SIZE_T)16 << i : 0, stats.FreeBlocksBySize[i],
+                           wine_dbgstr_longlong( stats.AllocationsBySize[i] ));
+    }
+}
+
+
 /***********************************************************************
  *           heap_set_debug_flags
  */
@@ -1611,6 +1966,13 @@ void heap_set_debug_flags( HANDLE handle )
 
     if (RUNNING_ON_VALGRIND) flags = 0; /* no sense in validating since Valgrind catches accesses */
 
+    if (heap->lfh && (flags & HEAP_LFH_DISABLE_FLAGS))  /* debugging requires the plain backend */
+    {
+        enter_critical_section( &heap->critSection );
+        lfh_flush( heap );
+        leave_critical_section( &heap->critSection );
+    }
+
     heap->flags |= flags;
     heap->force_flags |= flags & ~(HEAP_VALIDATE | HEAP_DISABLE_COALESCE_ON_FREE);
 
@@ -1714,6 +2076,7 @@ HANDLE WINAPI RtlCreateHeap( ULONG flags, PVOID addr, SIZE_T totalSize, SIZE_T c
     {
         processHeap = subheap->heap;  /* assume the first heap we create is the process main heap */
         list_init( &processHeap->entry );
+        heap_enable_lfh( processHeap );
     }
 
     return subheap->heap;
@@ -1745,6 +2108,8 @@ HANDLE WINAPI RtlDestroyHeap( HANDLE heap )
 
     if (heap == processHeap) return heap; /* cannot delete the main process heap */
 
+    if (TRACE_ON(heapstats)) heap_dump_statistics( heapPtr );
+
     /* remove it from the per-process list */
     enter_critical_section( &processHeap->critSection );
     list_remove( &heapPtr->entry );
@@ -1776,6 +2141,12 @@ HANDLE WINAPI RtlDestroyHeap( HANDLE heap )
         addr = heapPtr->pending_free;
         NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
     }
+    if (heapPtr->lfh)
+    {
+        size = 0;
+        addr = heapPtr->lfh;
+        NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
+    }
     size = 0;
     addr = heapPtr->subheap.base;
     NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
@@ -1807,6 +2178,7 @@ void * WINAPI DECLSPEC_HOTPATCH RtlAllocateHeap( HANDLE heap, ULONG flags, SIZE_
     SUBHEAP *subheap;
     HEAP *heapPtr = HEAP_GetPtr( heap );
     SIZE_T rounded_size;
+    void *ptr;
 
     /* Validate the parameters */
 
@@ -1821,7 +2193,23 @@ void * WINAPI DECLSPEC_HOTPATCH RtlAllocateHeap( HANDLE heap, ULONG flags, SIZE_
     }
     if (rounded_size < HEAP_MIN_DATA_SIZE) rounded_size = HEAP_MIN_DATA_SIZE;
 
-    if (!(flags & HEAP_NO_SERIALIZE)) enter_critical_section( &heapPtr->critSection );
+    /* Try the front-end first for small blocks */
+
+    if (rounded_size <= HEAP_LFH_MAX_SIZE && lfh_usable( heapPtr ) &&
+        (ptr = lfh_allocate_block( heapPtr, flags, size, rounded_size )))
+    {
+        TRACE("(%p,%08x,%08lx): returning %p\n", heap, flags, size, ptr );
+        return ptr;
+    }
+
+    heap_lock( heapPtr, flags );
+
+    heapPtr->alloc_count[get_stats_class( size )]++;
+    if (TRACE_ON(heapstats) && NtGetTickCount() - heapPtr->stats_time >= STATS_DUMP_INTERVAL)
+    {
+        heapPtr->stats_time = NtGetTickCount();
+        heap_dump_statistics( heapPtr );
+    }
 
     if (rounded_size >= HEAP_MIN_LARGE_BLOCK_SIZE && (flags & HEAP_GROWABLE))
     {
@@ -1864,6 +2252,11 @@ void * WINAPI DECLSPEC_HOTPATCH RtlAllocateHeap( HANDLE heap, ULONG flags, SIZE_
     notify_alloc( pInUse + 1, size, flags & HEAP_ZERO_MEMORY );
     initialize_block( pInUse + 1, size, pInUse->unused_bytes, flags );
 
+    /* Prepare the next allocations of that size */
+
+    if (rounded_size + HEAP_MIN_SHRINK_SIZE <= HEAP_LFH_MAX_SIZE && lfh_usable( heapPtr ))
+        lfh_refill( heapPtr, rounded_size );
+
     if (!(flags & HEAP_NO_SERIALIZE)) leave_critical_section( &heapPtr->critSection );
 
     TRACE("(%p,%08x,%08lx): returning %p\n", heap, flags, size, pInUse + 1 );
@@ -1904,13 +2297,22 @@ BOOLEAN WINAPI DECLSPEC_HOTPATCH RtlFreeHeap( HANDLE heap, ULONG flags, void *pt
 
     flags &= HEAP_NO_SERIALIZE;
     flags |= heapPtr->flags;
-    if (!(flags & HEAP_NO_SERIALIZE)) enter_critical_section( &heapPtr->critSection );
+    pInUse  = (ARENA_INUSE *)ptr - 1;
+
+    /* Small blocks go back to the front-end if possible */
+    if (lfh_usable( heapPtr ) && lfh_free_block( heapPtr, pInUse ))
+    {
+        notify_free( ptr );
+        TRACE("(%p,%08x,%p): returning TRUE\n", heap, flags, ptr );
+        return TRUE;
+    }
+
+    heap_lock( heapPtr, flags );
 
     /* Inform valgrind we are trying to free memory, so it can throw up an error message */
     notify_free( ptr );
 
     /* Some sanity checks */
-    pInUse  = (ARENA_INUSE *)ptr - 1;
     if (!validate_block_pointer( heapPtr, &subheap, pInUse )) goto error;
 
     if (!subheap)
@@ -1965,7 +2367,7 @@ PVOID WINAPI RtlReAllocateHeap( HANDLE heap, ULONG flags, PVOID ptr, SIZE_T size
     flags &= HEAP_GENERATE_EXCEPTIONS | HEAP_NO_SERIALIZE | HEAP_ZERO_MEMORY |
              HEAP_REALLOC_IN_PLACE_ONLY;
     flags |= heapPtr->flags;
-    if (!(flags & HEAP_NO_SERIALIZE)) enter_critical_section( &heapPtr->critSection );
+    heap_lock( heapPtr, flags );
 
     rounded_size = ROUND_SIZE(size) + HEAP_TAIL_EXTRA_SIZE;
     if (rounded_size < size) goto oom;  /* overflow */
@@ -2174,7 +2576,7 @@ SIZE_T WINAPI RtlSizeHeap( HANDLE heap, ULONG flags, const void *ptr )
     }
     flags &= HEAP_NO_SERIALIZE;
     flags |= heapPtr->flags;
-    if (!(flags & HEAP_NO_SERIALIZE)) enter_critical_section( &heapPtr->critSection );
+    heap_lock( heapPtr, flags );
 
     pArena = (const ARENA_INUSE *)ptr - 1;
     if (!validate_block_pointer( heapPtr, &subheap, pArena ))
@@ -2271,7 +2673,8 @@ NTSTATUS WINAPI RtlWalkHeap( HANDLE heap, PVOID entry_ptr )
         }
 
         if (((ARENA_INUSE *)ptr - 1)->magic == ARENA_INUSE_MAGIC ||
-            ((ARENA_INUSE *)ptr - 1)->magic == ARENA_PENDING_MAGIC)
+            ((ARENA_INUSE *)ptr - 1)->magic == ARENA_PENDING_MAGIC ||
+            ((ARENA_INUSE *)ptr - 1)->magic == ARENA_LFH_MAGIC)
         {
             ARENA_INUSE *pArena = (ARENA_INUSE *)ptr - 1;
             ptr += pArena->size & ARENA_SIZE_MASK;
@@ -2319,7 +2722,7 @@ NTSTATUS WINAPI RtlWalkHeap( HANDLE heap, PVOID entry_ptr )
         entry->lpData = pArena + 1;
         entry->cbData = pArena->size & ARENA_SIZE_MASK;
         entry->cbOverhead = sizeof(ARENA_INUSE);
-        entry->wFlags = (pArena->magic == ARENA_PENDING_MAGIC) ?
+        entry->wFlags = (pArena->magic == ARENA_PENDING_MAGIC || pArena->magic == ARENA_LFH_MAGIC) ?
                         PROCESS_HEAP_UNCOMMITTED_RANGE : PROCESS_HEAP_ENTRY_BUSY;
         /* FIXME: can't handle PROCESS_HEAP_ENTRY_MOVEABLE
         and PROCESS_HEAP_ENTRY_DDESHARE yet */
@@ -2384,6 +2787,20 @@ ULONG WINAPI RtlGetProcessHeaps( ULONG count, HANDLE *heaps )
 NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS info_class,
                                          PVOID info, SIZE_T size_in, PSIZE_T size_out)
 {
+    HEAP *heapPtr;
+
+    if (info_class == HeapWineStatistics)  /* not part of the enumeration */
+    {
+        if (size_out) *size_out = sizeof(HEAP_WINE_STATISTICS);
+
+        if (size_in < sizeof(HEAP_WINE_STATISTICS))
+            return STATUS_BUFFER_TOO_SMALL;
+
+        if (!(heapPtr = HEAP_GetPtr( heap ))) return STATUS_INVALID_PARAMETER;
+        heap_get_statistics( heapPtr, info );
+        return STATUS_SUCCESS;
+    }
+
     switch (info_class)
     {
     case HeapCompatibilityInformation:
@@ -2392,7 +2809,8 @@ NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS inf
         if (size_in < sizeof(ULONG))
             return STATUS_BUFFER_TOO_SMALL;
 
-        *(ULONG *)info = 0; /* standard heap */
+        if (!(heapPtr = HEAP_GetPtr( heap ))) return STATUS_INVALID_PARAMETER;
+        *(ULONG *)info = lfh_usable( heapPtr ) ? 2 : 0; /* low-fragmentation or standard heap */
         return STATUS_SUCCESS;
 
     default:
@@ -2406,6 +2824,28 @@ NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS inf
  */
 NTSTATUS WINAPI RtlSetHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS info_class, PVOID info, SIZE_T size)
 {
-    FIXME("%p %d %p %ld stub\n", heap, info_class, info, size);
-    return STATUS_SUCCESS;
+    HEAP *heapPtr;
+
+    switch (info_class)
+    {
+    case HeapCompatibilityInformation:
+        if (size < sizeof(ULONG))
+            return STATUS_BUFFER_TOO_SMALL;
+
+        if (!(heapPtr = HEAP_GetPtr( heap ))) return STATUS_INVALID_PARAMETER;
+        switch (*(ULONG *)info)
+        {
+        case 0:  /* the front-end cannot be disabled once enabled */
+            return heapPtr->lfh ? STATUS_UNSUCCESSFUL : STATUS_SUCCESS;
+        case 2:
+            return heap_enable_lfh( heapPtr );
+        default:
+            FIXME("%p: unsupported compatibility mode %u\n", heap, *(ULONG *)info);
+            return STATUS_SUCCESS;
+        }
+
+    default:
+        FIXME("%p %d %p %ld stub\n", heap, info_class, info, size);
+        return STATUS_SUCCESS;
+    }
 }
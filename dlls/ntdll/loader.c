@@ -24,6 +24,7 @@
 
 #include <assert.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #ifdef HAVE_SYS_MMAN_H
 # include <sys/mman.h>
 #endif
@@ -124,8 +125,35 @@ typedef struct _wine_modref
     int                   alloc_deps;
     int                   nDeps;
     struct _wine_modref **deps;
+    DWORD                *export_hash;      /* hash table of exported names, built on first use */
+    DWORD                 export_hash_mask;
 } WINE_MODREF;
 
+/* minimum number of exported names for building a hash table */
+#define EXPORT_HASH_MIN_NAMES 64
+
+enum prefetch_state
+{
+    PREFETCH_PENDING,   /* waiting for a prefetch thread */
+    PREFETCH_RUNNING,   /* being looked up by a prefetch thread */
+    PREFETCH_DONE,      /* result available */
+    PREFETCH_TAKEN      /* result consumed, or looked up by the loader itself */
+};
+
+/* an imported dll looked up and mapped ahead of time by a prefetch thread */
+struct prefetch_dll
+{
+    struct list         entry;      /* entry in prefetch_list */
+    enum prefetch_state state;
+    const WCHAR        *load_path;
+    WCHAR              *name;
+    NTSTATUS            status;
+    UNICODE_STRING      nt_name;
+    void               *module;
+    pe_image_info_t     image_info;
+    struct stat         st;
+};
+
 /* info about the current builtin dll load */
 /* used to keep track of things across the register_dll constructor call */
 struct builtin_load_info
@@ -161,6 +189,20 @@ static CRITICAL_SECTION_DEBUG dlldir_critsect_debug =
 };
 static CRITICAL_SECTION dlldir_section = { &dlldir_critsect_debug, -1, 0, 0, 0, 0 };
 
+static RTL_CRITICAL_SECTION prefetch_section;
+static RTL_CRITICAL_SECTION_DEBUG prefetch_critsect_debug =
+{
+    0, 0, &prefetch_section,
+    { &prefetch_critsect_debug.ProcessLocksList, &prefetch_critsect_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": prefetch_section") }
+};
+static RTL_CRITICAL_SECTION prefetch_section = { &prefetch_critsect_debug, -1, 0, 0, 0, 0 };
+
+static struct list prefetch_list = LIST_INIT( prefetch_list );
+static RTL_CONDITION_VARIABLE prefetch_work = RTL_CONDITION_VARIABLE_INIT;
+static RTL_CONDITION_VARIABLE prefetch_done = RTL_CONDITION_VARIABLE_INIT;
+static int prefetch_threads;      /* number of running prefetch threads */
+
 static WINE_MODREF *cached_modref;
 static WINE_MODREF *current_modref;
 static WINE_MODREF *last_failed_modref;
@@ -172,6 +214,9 @@ static FARPROC find_ordinal_export( HMODULE module, const IMAGE_EXPORT_DIRECTORY
                                     DWORD exp_size, DWORD ordinal, LPCWSTR load_path );
 static FARPROC find_named_export( HMODULE module, const IMAGE_EXPORT_DIRECTORY *exports,
                                   DWORD exp_size, const char *name, int hint, LPCWSTR load_path );
+static int prefetch_imports( HMODULE module, const IMAGE_IMPORT_DESCRIPTOR *imports, int count,
+                             LPCWSTR load_path, struct prefetch_dll **dlls );
+static void release_prefetched_dlls( struct prefetch_dll *dlls, int count );
 
 /* convert PE image VirtualAddress to Real Address */
 static inline void *get_rva( HMODULE module, DWORD va )
@@ -714,6 +759,52 @@ static FARPROC find_ordinal_export( HMODULE module, const IMAGE_EXPORT_DIRECTORY
 }
 
 
+/*************************************************************************
+ *		hash_export_name
+ */
+static inline DWORD hash_export_name( const char *name )
+{
+    DWORD hash = 2166136261u;  /* FNV-1a */
+
+    while (*name) hash = (hash ^ (unsigned char)*name++) * 16777619;
+    return hash;
+}
+
+
+/*************************************************************************
+ *		build_export_hash
+ *
+ * Build the hash table of the exported names of a module.
+ * The loader_section must be locked while calling this function.
+ */
+static BOOL build_export_hash( WINE_MODREF *wm, const IMAGE_EXPORT_DIRECTORY *exports, DWORD exp_size )
+{
+    const DWORD *names = get_rva( wm->ldr.BaseAddress, exports->AddressOfNames );
+    DWORD i, pos, size = 2 * EXPORT_HASH_MIN_NAMES;
+
+    /* the count of a corrupt image can't be trusted, leave it to the binary search */
+    if (exports->NumberOfNames > exp_size / sizeof(DWORD) ||
+        exports->NumberOfNames > wm->ldr.SizeOfImage / sizeof(DWORD))
+        return FALSE;
+
+    while (size < 2 * exports->NumberOfNames) size *= 2;
+    if (size > ~(SIZE_T)0 / sizeof(DWORD)) return FALSE;
+    if (!(wm->export_hash = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY, size * sizeof(DWORD) )))
+        return FALSE;
+    wm->export_hash_mask = size - 1;
+
+    for (i = 0; i < exports->NumberOfNames; i++)
+    {
+        pos = hash_export_name( get_rva( wm->ldr.BaseAddress, names[i] )) & wm->export_hash_mask;
+        while (wm->export_hash[pos]) pos = (pos + 1) & wm->export_hash_mask;
+        wm->export_hash[pos] = i + 1;
+    }
+    TRACE( "%s: %u names in %u buckets\n", debugstr_w(wm->ldr.BaseDllName.Buffer),
+           exports->NumberOfNames, size );
+    return TRUE;
+}
+
+
 /*************************************************************************
  *		find_named_export
  *
@@ -726,6 +817,7 @@ static FARPROC find_named_export( HMODULE module, const IMAGE_EXPORT_DIRECTORY *
     const WORD *ordinals = get_rva( module, exports->AddressOfNameOrdinals );
     const DWORD *names = get_rva( module, exports->AddressOfNames );
     int min = 0, max = exports->NumberOfNames - 1;
+    WINE_MODREF *wm;
 
     /* first check the hint */
     if (hint >= 0 && hint <= max)
@@ -735,7 +827,23 @@ static FARPROC find_named_export( HMODULE module, const IMAGE_EXPORT_DIRECTORY *
             return find_ordinal_export( module, exports, exp_size, ordinals[hint], load_path );
     }
 
-    /* then do a binary search */
+    /* then use the hash table for large export tables */
+    if (exports->NumberOfNames >= EXPORT_HASH_MIN_NAMES && (wm = get_modref( module )) &&
+        (wm->export_hash || build_export_hash( wm, exports, exp_size )))
+    {
+        DWORD pos = hash_export_name( name ) & wm->export_hash_mask;
+
+        while (wm->export_hash[pos])
+        {
+            DWORD index = wm->export_hash[pos] - 1;
+            if (!strcmp( get_rva( module, names[index] ), name ))
+                return find_ordinal_export( module, exports, exp_size, ordinals[index], load_path );
+            pos = (pos + 1) & wm->export_hash_mask;
+        }
+        return NULL;
+    }
+
+    /* else do a binary search */
     while (min <= max)
     {
         int res, pos = (min + max) / 2;
@@ -1117,8 +1225,9 @@ static NTSTATUS fixup_imports_ilonly( WINE_MODREF *wm, LPCWSTR load_path, void *
  */
 static NTSTATUS fixup_imports( WINE_MODREF *wm, LPCWSTR load_path )
 {
-    int i, dep, nb_imports;
+    int i, dep, nb_imports, nb_prefetch;
     const IMAGE_IMPORT_DESCRIPTOR *imports;
+    struct prefetch_dll *prefetch;
     WINE_MODREF *prev, *imp;
     DWORD size;
     NTSTATUS status;
@@ -1148,6 +1257,8 @@ static NTSTATUS fixup_imports( WINE_MODREF *wm, LPCWSTR load_path )
     /* load the imported modules. They are automatically
      * added to the modref list of the process.
      */
+    nb_prefetch = prefetch_imports( wm->ldr.BaseAddress, imports, nb_imports, load_path, &prefetch );
+
     prev = current_modref;
     current_modref = wm;
     status = STATUS_SUCCESS;
@@ -1163,6 +1274,7 @@ static NTSTATUS fixup_imports( WINE_MODREF *wm, LPCWSTR load_path )
         wm->deps[dep] = imp;
     }
     current_modref = prev;
+    release_prefetched_dlls( prefetch, nb_prefetch );
     if (wm->ldr.ActivationContext) RtlDeactivateActivationContext( 0, cookie );
     return status;
 }
@@ -2253,6 +2365,8 @@ static NTSTATUS get_dll_load_path_search_flags( LPCWSTR module, DWORD flags, WCH
  *	open_dll_file
  *
  * Open a file for a new dll. Helper for find_dll_file.
+ * If pwm is NULL the list of loaded modules is not checked, this is used
+ * by the prefetch threads that run without holding the loader_section.
  */
 static NTSTATUS open_dll_file( UNICODE_STRING *nt_name, WINE_MODREF **pwm,
                                void **module, pe_image_info_t *image_info, struct stat *st )
@@ -2266,7 +2380,7 @@ static NTSTATUS open_dll_file( UNICODE_STRING *nt_name, WINE_MODREF **pwm,
     HANDLE handle, mapping;
     int fd, needs_close;
 
-    if ((*pwm = find_fullname_module( nt_name )))
+    if (pwm && (*pwm = find_fullname_module( nt_name )))
     {
         NtUnmapViewOfSection( NtCurrentProcess(), *module );
         *module = NULL;
@@ -2298,7 +2412,7 @@ static NTSTATUS open_dll_file( UNICODE_STRING *nt_name, WINE_MODREF **pwm,
     {
         fstat( fd, st );
         if (needs_close) close( fd );
-        if ((*pwm = find_fileid_module( st )))
+        if (pwm && (*pwm = find_fileid_module( st )))
         {
             TRACE( "%s is the same file as existing module %p %s\n", debugstr_w( nt_name->Buffer ),
                    (*pwm)->ldr.BaseAddress, debugstr_w( (*pwm)->ldr.FullDllName.Buffer ));
@@ -2871,6 +2985,239 @@ done:
 }
 
 
+/***********************************************************************
+ *	prefetch_thread
+ *
+ * Look up and map the pending entries of the prefetch list.
+ */
+static DWORD WINAPI prefetch_thread( void *arg )
+{
+    struct prefetch_dll *dll;
+    LARGE_INTEGER timeout;
+    ULONG wow64_old_value = 0;
+    BOOL idle = FALSE;
+
+    /* same redirection as find_dll_file */
+    if (is_wow64) RtlWow64EnableFsRedirectionEx( 0, &wow64_old_value );
+
+    timeout.QuadPart = (ULONGLONG)1000 * -10000;  /* exit after one second without work */
+
+    RtlEnterCriticalSection( &prefetch_section );
+    for (;;)
+    {
+        LIST_FOR_EACH_ENTRY( dll, &prefetch_list, struct prefetch_dll, entry )
+            if (dll->state == PREFETCH_PENDING) break;
+
+        if (&dll->entry == &prefetch_list)
+        {
+            if (idle) break;
+            idle = RtlSleepConditionVariableCS( &prefetch_work, &prefetch_section, &timeout ) == STATUS_TIMEOUT;
+            continue;
+        }
+        idle = FALSE;
+
+        dll->state = PREFETCH_RUNNING;
+        RtlLeaveCriticalSection( &prefetch_section );
+        dll->status = search_dll_file( dll->load_path, dll->name, &dll->nt_name, NULL,
+                                       &dll->module, &dll->image_info, &dll->st );
+        RtlEnterCriticalSection( &prefetch_section );
+        dll->state = PREFETCH_DONE;
+        RtlWakeAllConditionVariable( &prefetch_done );
+    }
+    prefetch_threads--;
+    RtlLeaveCriticalSection( &prefetch_section );
+    return 0;
+}
+
+
+/***********************************************************************
+ *	find_prefetch_dll
+ *
+ * Find a prefetch entry that hasn't been consumed yet.
+ * The prefetch_section must be locked while calling this function.
+ */
+static struct prefetch_dll *find_prefetch_dll( LPCWSTR load_path, LPCWSTR name )
+{
+    struct prefetch_dll *dll;
+
+    LIST_FOR_EACH_ENTRY( dll, &prefetch_list, struct prefetch_dll, entry )
+    {
+        if (dll->state == PREFETCH_TAKEN) continue;
+        if (!strcmpiW( dll->name, name ) && !strcmpW( dll->load_path, load_path )) return dll;
+    }
+    return NULL;
+}
+
+
+/***********************************************************************
+ *	prefetch_imports
+ *
+ * Queue the dlls imported by a module to be looked up and mapped by the
+ * prefetch threads, if enabled with WINE_PARALLEL_LOADER. The modules are
+ * still loaded, snapped and initialized in import order by the caller.
+ * The loader_section must be locked while calling this function.
+ */
+static int prefetch_imports( HMODULE module, const IMAGE_IMPORT_DESCRIPTOR *imports, int count,
+                             LPCWSTR load_path, struct prefetch_dll **ret )
+{
+    static int enabled = -1;
+    struct prefetch_dll *dlls;
+    int i, nb_dlls = 0, threads;
+    WCHAR *fullname;
+    DWORD len;
+
+    *ret = NULL;
+    if (enabled == -1)
+    {
+        const char *env = getenv( "WINE_PARALLEL_LOADER" );
+        enabled = env && atoi( env );
+    }
+    if (!enabled || count < 2) return 0;
+
+    if (!(dlls = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY, count * sizeof(*dlls) ))) return 0;
+
+    for (i = 0; i < count; i++)
+    {
+        const char *name = get_rva( module, imports[i].Name );
+        const IMAGE_THUNK_DATA *import_list;
+        struct prefetch_dll *dll = &dlls[nb_dlls], *queued;
+        NTSTATUS status;
+
+        import_list = get_rva( module, imports[i].u.OriginalFirstThunk ?
+                               (DWORD)imports[i].u.OriginalFirstThunk : (DWORD)imports[i].FirstThunk );
+        if (!import_list->u1.Ordinal) continue;  /* unused import */
+
+        len = strlen( name );
+        while (len && name[len - 1] == ' ') len--;
+        if (!(dll->name = RtlAllocateHeap( GetProcessHeap(), 0, (len + 5) * sizeof(WCHAR) ))) break;
+        ascii_to_unicode( dll->name, name, len );
+        dll->name[len] = 0;
+        if (!strchrW( dll->name, '.' )) strcatW( dll->name, dllW );
+
+        /* skip the dlls that find_dll_file resolves without searching the path */
+        if (!contains_path( dll->name ) && !find_basename_module( dll->name ))
+        {
+            status = find_actctx_dll( dll->name, &fullname );
+            if (!status) RtlFreeHeap( GetProcessHeap(), 0, fullname );
+            if (status == STATUS_SXS_KEY_NOT_FOUND)
+            {
+                RtlEnterCriticalSection( &prefetch_section );
+                queued = find_prefetch_dll( load_path, dll->name );
+                RtlLeaveCriticalSection( &prefetch_section );
+                if (!queued)
+                {
+                    dll->load_path = load_path;
+                    nb_dlls++;
+                    continue;
+                }
+            }
+        }
+        RtlFreeHeap( GetProcessHeap(), 0, dll->name );
+        dll->name = NULL;
+    }
+
+    if (!nb_dlls)
+    {
+        RtlFreeHeap( GetProcessHeap(), 0, dlls );
+        return 0;
+    }
+
+    threads = min( nb_dlls, min( NtCurrentTeb()->Peb->NumberOfProcessors, 8 ));
+
+    RtlEnterCriticalSection( &prefetch_section );
+    /* newest entries first, they are the ones the loader needs next */
+    for (i = nb_dlls - 1; i >= 0; i--) list_add_head( &prefetch_list, &dlls[i].entry );
+    while (prefetch_threads < threads && !create_internal_thread( prefetch_thread, NULL ))
+        prefetch_threads++;
+    RtlWakeAllConditionVariable( &prefetch_work );
+    RtlLeaveCriticalSection( &prefetch_section );
+
+    TRACE( "prefetching %d dlls with %d threads\n", nb_dlls, prefetch_threads );
+    *ret = dlls;
+    return nb_dlls;
+}
+
+
+/***********************************************************************
+ *	release_prefetched_dlls
+ *
+ * Release the prefetch entries queued by prefetch_imports.
+ * The loader_section must be locked while calling this function.
+ */
+static void release_prefetched_dlls( struct prefetch_dll *dlls, int count )
+{
+    int i;
+
+    if (!dlls) return;
+
+    RtlEnterCriticalSection( &prefetch_section );
+    for (i = 0; i < count; i++)
+    {
+        while (dlls[i].state == PREFETCH_RUNNING)
+            RtlSleepConditionVariableCS( &prefetch_done, &prefetch_section, NULL );
+        list_remove( &dlls[i].entry );
+    }
+    RtlLeaveCriticalSection( &prefetch_section );
+
+    for (i = 0; i < count; i++)
+    {
+        if (dlls[i].module) NtUnmapViewOfSection( NtCurrentProcess(), dlls[i].module );
+        RtlFreeUnicodeString( &dlls[i].nt_name );
+        RtlFreeHeap( GetProcessHeap(), 0, dlls[i].name );
+    }
+    RtlFreeHeap( GetProcessHeap(), 0, dlls );
+}
+
+
+/***********************************************************************
+ *	get_prefetched_dll
+ *
+ * Retrieve the result of a prefetched search_dll_file call.
+ * The loader_section must be locked while calling this function.
+ */
+static BOOL get_prefetched_dll( LPCWSTR load_path, LPCWSTR name, UNICODE_STRING *nt_name,
+                                WINE_MODREF **pwm, void **module, pe_image_info_t *image_info,
+                                struct stat *st, NTSTATUS *status )
+{
+    struct prefetch_dll *dll;
+    BOOL found = FALSE;
+
+    /* entries are only added and removed by the thread owning the loader_section */
+    if (list_empty( &prefetch_list )) return FALSE;
+
+    RtlEnterCriticalSection( &prefetch_section );
+    if ((dll = find_prefetch_dll( load_path, name )))
+    {
+        /* look it up ourselves if no prefetch thread got to it yet */
+        while (dll->state == PREFETCH_RUNNING)
+            RtlSleepConditionVariableCS( &prefetch_done, &prefetch_section, NULL );
+        found = (dll->state == PREFETCH_DONE);
+        dll->state = PREFETCH_TAKEN;
+    }
+    RtlLeaveCriticalSection( &prefetch_section );
+    if (!found) return FALSE;
+
+    *status = dll->status;
+    *nt_name = dll->nt_name;
+    *module = dll->module;
+    *image_info = dll->image_info;
+    *st = dll->st;
+    dll->nt_name.Buffer = NULL;
+    dll->module = NULL;
+
+    /* the module may have been loaded from the same file in the meantime */
+    if (*module && ((*pwm = find_fullname_module( nt_name )) ||
+                    ((st->st_dev || st->st_ino) && (*pwm = find_fileid_module( st )))))
+    {
+        NtUnmapViewOfSection( NtCurrentProcess(), *module );
+        *module = NULL;
+        *status = STATUS_SUCCESS;
+    }
+    TRACE( "using prefetched %s for %s, status %x\n", debugstr_us(nt_name), debugstr_w(name), *status );
+    return TRUE;
+}
+
+
 /***********************************************************************
  *	find_dll_file
  *
@@ -2929,7 +3276,10 @@ static NTSTATUS find_dll_file( const WCHAR *load_path, const WCHAR *libname, con
     }
 
     if (RtlDetermineDosPathNameType_U( libname ) == RELATIVE_PATH)
-        status = search_dll_file( load_path, libname, nt_name, pwm, module, image_info, st );
+    {
+        if (!get_prefetched_dll( load_path, libname, nt_name, pwm, module, image_info, st, &status ))
+            status = search_dll_file( load_path, libname, nt_name, pwm, module, image_info, st );
+    }
     else if (!(status = RtlDosPathNameToNtPathName_U_WithStatus( libname, nt_name, NULL, NULL )))
         status = open_dll_file( nt_name, pwm, module, image_info, st );
 
@@ -3494,6 +3844,7 @@ void WINAPI LdrShutdownProcess(void)
     TRACE("()\n");
     process_detaching = TRUE;
     process_detach();
+    dump_critical_section_stats();
 }
 
 
@@ -3526,20 +3877,26 @@ void WINAPI LdrShutdownThread(void)
     /* don't do any detach calls if process is exiting */
     if (process_detaching) return;
 
+    /* internal threads never went through LdrInitializeThunk */
+    if (ntdll_get_thread_data()->internal) return;
+
     RtlEnterCriticalSection( &loader_section );
 
     mark = &NtCurrentTeb()->Peb->LdrData->InInitializationOrderModuleList;
-    for (entry = mark->Blink; entry != mark; entry = entry->Blink)
+    if (!ntdll_get_thread_data()->skip_attach)
     {
-        mod = CONTAINING_RECORD(entry, LDR_MODULE, 
-                                InInitializationOrderModuleList);
-        if ( !(mod->Flags & LDR_PROCESS_ATTACHED) )
-            continue;
-        if ( mod->Flags & LDR_NO_DLL_CALLS )
-            continue;
+        for (entry = mark->Blink; entry != mark; entry = entry->Blink)
+        {
+            mod = CONTAINING_RECORD(entry, LDR_MODULE,
+                                    InInitializationOrderModuleList);
+            if ( !(mod->Flags & LDR_PROCESS_ATTACHED) )
+                continue;
+            if ( mod->Flags & LDR_NO_DLL_CALLS )
+                continue;
 
-        MODULE_InitDLL( CONTAINING_RECORD(mod, WINE_MODREF, ldr), 
-                        DLL_THREAD_DETACH, NULL );
+            MODULE_InitDLL( CONTAINING_RECORD(mod, WINE_MODREF, ldr),
+                            DLL_THREAD_DETACH, NULL );
+        }
     }
 
     RtlAcquirePebLock();
@@ -3588,6 +3945,7 @@ static void free_modref( WINE_MODREF *wm )
     NtUnmapViewOfSection( NtCurrentProcess(), wm->ldr.BaseAddress );
     if (cached_modref == wm) cached_modref = NULL;
     RtlFreeUnicodeString( &wm->ldr.FullDllName );
+    RtlFreeHeap( GetProcessHeap(), 0, wm->export_hash );
     RtlFreeHeap( GetProcessHeap(), 0, wm->deps );
     RtlFreeHeap( GetProcessHeap(), 0, wm );
 }
@@ -3745,6 +4103,9 @@ void WINAPI LdrInitializeThunk( CONTEXT *context, void **entry, ULONG_PTR unknow
 
     if (process_detaching) return;
 
+    /* internal threads don't wait for the loader */
+    if (ntdll_get_thread_data()->internal) return;
+
     RtlEnterCriticalSection( &loader_section );
 
     wm = get_modref( NtCurrentTeb()->Peb->ImageBaseAddress );
@@ -3795,7 +4156,7 @@ void WINAPI LdrInitializeThunk( CONTEXT *context, void **entry, ULONG_PTR unknow
     {
         if ((status = alloc_thread_tls()) != STATUS_SUCCESS)
             NtTerminateThread( GetCurrentThread(), status );
-        thread_attach();
+        if (!ntdll_get_thread_data()->skip_attach) thread_attach();
     }
 
     RtlLeaveCriticalSection( &loader_section );
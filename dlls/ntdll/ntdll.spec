@@ -1552,6 +1552,7 @@
 
 # Server interface
 @ cdecl -norelay wine_server_call(ptr)
+@ cdecl wine_server_call_batch(ptr long)
 @ cdecl wine_server_close_fds_by_type(long)
 @ cdecl wine_server_fd_to_handle(long long long ptr)
 @ cdecl wine_server_handle_to_fd(long long ptr ptr)
@@ -1592,4 +1593,7 @@
 # User shared data
 @ cdecl __wine_user_shared_data()
 
+# Thread pool
+@ cdecl wine_threadpool_get_statistics(ptr ptr long)
+
 @ cdecl IsTransgaming()
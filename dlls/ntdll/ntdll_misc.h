@@ -59,6 +59,7 @@ extern NTSTATUS context_to_server( context_t *to, const CONTEXT *from ) DECLSPEC
 extern NTSTATUS context_from_server( CONTEXT *to, const context_t *from ) DECLSPEC_HIDDEN;
 extern NTSTATUS set_thread_context( HANDLE handle, const context_t *context, BOOL *self ) DECLSPEC_HIDDEN;
 extern NTSTATUS get_thread_context( HANDLE handle, context_t *context, unsigned int flags, BOOL *self ) DECLSPEC_HIDDEN;
+extern NTSTATUS create_internal_thread( LPTHREAD_START_ROUTINE start, void *param ) DECLSPEC_HIDDEN;
 extern LONG WINAPI call_unhandled_exception_filter( PEXCEPTION_POINTERS eptr ) DECLSPEC_HIDDEN;
 
 #if defined(__x86_64__) || defined(__arm__) || defined(__aarch64__)
@@ -87,6 +88,9 @@ extern void virtual_init(void) DECLSPEC_HIDDEN;
 extern void virtual_init_threading(void) DECLSPEC_HIDDEN;
 extern void fill_cpu_info(void) DECLSPEC_HIDDEN;
 extern void heap_set_debug_flags( HANDLE handle ) DECLSPEC_HIDDEN;
+extern void init_critical_section_stats(void) DECLSPEC_HIDDEN;
+extern void dump_critical_section_stats(void) DECLSPEC_HIDDEN;
+extern BOOL crit_section_profiling DECLSPEC_HIDDEN;
 extern void init_unix_codepage(void) DECLSPEC_HIDDEN;
 extern void init_locale( HMODULE module ) DECLSPEC_HIDDEN;
 extern void init_user_process_params( SIZE_T data_size ) DECLSPEC_HIDDEN;
@@ -99,6 +103,7 @@ extern HANDLE CDECL __wine_create_default_token(BOOL admin);
 /* server support */
 extern timeout_t server_start_time DECLSPEC_HIDDEN;
 extern unsigned int server_cpus DECLSPEC_HIDDEN;
+extern BOOL server_async_file_io DECLSPEC_HIDDEN;
 extern BOOL is_wow64 DECLSPEC_HIDDEN;
 extern void server_init_process(void) DECLSPEC_HIDDEN;
 extern void server_init_process_done(void) DECLSPEC_HIDDEN;
@@ -123,6 +128,7 @@ extern NTSTATUS validate_open_object_attributes( const OBJECT_ATTRIBUTES *attr )
 extern int wait_select_reply( void *cookie ) DECLSPEC_HIDDEN;
 extern BOOL invoke_apc( const apc_call_t *call, apc_result_t *result, sigset_t *user_sigset ) DECLSPEC_HIDDEN;
 extern void *server_get_shared_memory( HANDLE thread ) DECLSPEC_HIDDEN;
+extern BOOL server_get_handle_entry( HANDLE handle, handle_shm_entry_t *info ) DECLSPEC_HIDDEN;
 
 /* module handling */
 extern LIST_ENTRY tls_links DECLSPEC_HIDDEN;
@@ -185,6 +191,7 @@ extern NTSTATUS virtual_map_section( HANDLE handle, PVOID *addr_ptr, unsigned sh
                                      const LARGE_INTEGER *offset_ptr, SIZE_T *size_ptr, ULONG alloc_type,
                                      ULONG protect, pe_image_info_t *image_info ) DECLSPEC_HIDDEN;
 extern void virtual_get_system_info( SYSTEM_BASIC_INFORMATION *info ) DECLSPEC_HIDDEN;
+extern SIZE_T virtual_get_large_page_size(void) DECLSPEC_HIDDEN;
 extern NTSTATUS virtual_create_builtin_view( void *base ) DECLSPEC_HIDDEN;
 extern NTSTATUS virtual_alloc_thread_stack( INITIAL_TEB *stack, SIZE_T reserve_size,
                                             SIZE_T commit_size, SIZE_T *pthread_size ) DECLSPEC_HIDDEN;
@@ -223,22 +230,55 @@ extern int ntdll_wcstoumbs(DWORD flags, const WCHAR* src, int srclen, char* dst,
 extern int CDECL NTDLL__vsnprintf( char *str, SIZE_T len, const char *format, __ms_va_list args ) DECLSPEC_HIDDEN;
 extern int CDECL NTDLL__vsnwprintf( WCHAR *str, SIZE_T len, const WCHAR *format, __ms_va_list args ) DECLSPEC_HIDDEN;
 
+static inline void small_pause(void)
+{
+#ifdef __i386__
+    __asm__ __volatile__( "rep;nop" : : : "memory" );
+#else
+    __asm__ __volatile__( "" : : : "memory" );
+#endif
+}
+
+/* the statistics traced on the *stat debug channels that have no natural end
+ * are dumped periodically, after every STATS_DUMP_INTERVAL counted events */
+#define STATS_DUMP_INTERVAL 0x10000
+
+static inline BOOL stats_dump_due( unsigned int count )
+{
+    return !(count % STATS_DUMP_INTERVAL);
+}
+
+/* Adaptive spinning for critical sections and fsync objects. Like glibc
+ * adaptive mutexes, a lock spins for about twice the number of spins that
+ * were recently needed to acquire it, so the spin follows the typical hold
+ * time. Acquiring the lock without spinning, or running out of spins because
+ * it is held for too long, both pull the estimate back down. */
+#define MAX_ADAPTIVE_SPIN_COUNT 100
+
+static inline int adaptive_spin_count( int estimate, int limit )
+{
+    int spins = estimate * 2 + 10;
+    return spins < limit ? spins : limit;
+}
+
+static inline int adaptive_spin_update( int estimate, int spins )
+{
+    return estimate + (spins - estimate) / 8;
+}
+
 #ifdef __WINE_WINE_PORT_H
 
-/* inline version of RtlEnterCriticalSection */
+/* inline version of RtlEnterCriticalSection, the contended case is left to
+ * RtlEnterCriticalSection so that it spins and gets profiled */
 static inline void enter_critical_section( RTL_CRITICAL_SECTION *crit )
 {
-    if (interlocked_inc( &crit->LockCount ))
+    if (!crit_section_profiling && interlocked_cmpxchg( &crit->LockCount, 0, -1 ) == -1)
     {
-        if (crit->OwningThread == ULongToHandle(GetCurrentThreadId()))
-        {
-            crit->RecursionCount++;
-            return;
-        }
-        RtlpWaitForCriticalSection( crit );
+        crit->OwningThread   = ULongToHandle(GetCurrentThreadId());
+        crit->RecursionCount = 1;
+        return;
     }
-    crit->OwningThread   = ULongToHandle(GetCurrentThreadId());
-    crit->RecursionCount = 1;
+    RtlEnterCriticalSection( crit );
 }
 
 /* inline version of RtlLeaveCriticalSection */
@@ -294,9 +334,12 @@ struct ntdll_thread_data
     int                request_fd;    /* fd for sending server requests */
     int                reply_fd;      /* fd for receiving server replies */
     int                wait_fd[2];    /* fd for sleeping server requests */
+    request_shm_t     *request_shm;   /* shared memory for server requests */
     BOOL               wow64_redir;   /* Wow64 filesystem redirection flag */
     pthread_t          pthread_id;    /* pthread thread id */
     void              *pthread_stack; /* pthread stack */
+    BOOL               skip_attach;   /* skip the dll thread attach/detach notifications */
+    BOOL               internal;      /* ntdll internal thread, never enters the loader */
 };
 
 C_ASSERT( sizeof(struct ntdll_thread_data) <= sizeof(((TEB *)0)->GdiTebBatch) );
@@ -34,6 +34,12 @@
 #ifdef HAVE_PTHREAD_NP_H
 # include <pthread_np.h>
 #endif
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+#ifdef HAVE_SYS_POLL_H
+# include <sys/poll.h>
+#endif
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -88,6 +94,7 @@
 #include "wine/debug.h"
 #include "ntdll_misc.h"
 #include "esync.h"
+#include "fsync.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(server);
 WINE_DECLARE_DEBUG_CHANNEL(winediag);
@@ -138,6 +145,7 @@ unsigned int server_cpus = 0;
 BOOL is_wow64 = FALSE;
 
 timeout_t server_start_time = 0;  /* time of server startup */
+BOOL server_async_file_io = FALSE;  /* does the server do overlapped regular file I/O? */
 
 sigset_t server_block_set;  /* signals to block during server calls */
 static int fd_socket = -1;  /* socket to exchange file descriptors with the server */
@@ -301,14 +309,112 @@ static inline unsigned int wait_reply( struct __server_request_info *req )
 }
 
 
+/* number of times to check for the reply before waiting on the futex */
+#define MAX_REQUEST_SHM_SPIN_COUNT 1000
+
+/***********************************************************************
+ *           send_request_shm
+ *
+ * Send a request to the server through the request shared memory.
+ */
+static unsigned int send_request_shm( request_shm_t *shm, const struct __server_request_info *req )
+{
+    static const char doorbell;
+    char *ptr = shm->data;
+    unsigned int i;
+    int ret, state = REQUEST_SHM_REQUEST;
+
+    memcpy( ptr, &req->u.req, sizeof(req->u.req) );
+    ptr += sizeof(req->u.req);
+    for (i = 0; i < req->data_count; i++)
+    {
+        memcpy( ptr, req->data[i].ptr, req->data[i].size );
+        ptr += req->data[i].size;
+    }
+    __atomic_store_n( &shm->state, REQUEST_SHM_REQUEST, __ATOMIC_SEQ_CST );
+
+    /* the server checks the state a last time after it stops polling */
+    if (__atomic_load_n( &shm->server_polling, __ATOMIC_SEQ_CST )) return STATUS_SUCCESS;
+
+    /* otherwise a single byte on the request pipe wakes it up, unless it picked up the request already */
+    if (!__atomic_compare_exchange_n( &shm->state, &state, REQUEST_SHM_SIGNALED, 0,
+                                      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST ))
+        return STATUS_SUCCESS;
+    for (;;)
+    {
+        if ((ret = write( ntdll_get_thread_data()->request_fd, &doorbell, 1 )) == 1)
+            return STATUS_SUCCESS;
+        if (ret == -1 && errno == EINTR) continue;
+        if (ret == -1 && errno == EPIPE) abort_thread(0);
+        server_protocol_perror( "write" );
+    }
+}
+
+
+/***********************************************************************
+ *           wait_reply_shm
+ *
+ * Wait for a reply from the server in the request shared memory.
+ */
+static unsigned int wait_reply_shm( request_shm_t *shm, struct __server_request_info *req )
+{
+    struct pollfd pfd;
+    struct timespec timeout;
+    int spins = NtCurrentTeb()->Peb->NumberOfProcessors > 1 ? MAX_REQUEST_SHM_SPIN_COUNT : 0;
+    int state;
+
+    for (;;)
+    {
+        state = __atomic_load_n( &shm->state, __ATOMIC_ACQUIRE );
+        if (state == REQUEST_SHM_REPLY || state == REQUEST_SHM_CLOSED) break;
+        if (spins)
+        {
+            spins--;
+            small_pause();
+            continue;
+        }
+
+        /* the server only wakes the futex when client_waiting is set */
+        __atomic_store_n( &shm->client_waiting, 1, __ATOMIC_SEQ_CST );
+        state = __atomic_load_n( &shm->state, __ATOMIC_SEQ_CST );
+        if (state == REQUEST_SHM_REPLY || state == REQUEST_SHM_CLOSED) break;
+
+        timeout.tv_sec  = 1;
+        timeout.tv_nsec = 0;
+        if (!fsync_futex_wait( &shm->state, state, &timeout ) || errno != ETIMEDOUT)
+            continue;
+        /* nothing is ever written to the reply pipe, so it only polls when the server is gone */
+        pfd.fd = ntdll_get_thread_data()->reply_fd;
+        pfd.events = POLLIN;
+        if (poll( &pfd, 1, 0 ) == 1) abort_thread(0);
+    }
+    shm->client_waiting = 0;
+    /* the server terminated the thread */
+    if (state != REQUEST_SHM_REPLY) abort_thread(0);
+
+    memcpy( &req->u.reply, shm->data, sizeof(req->u.reply) );
+    if (req->u.reply.reply_header.reply_size)
+        memcpy( req->reply_data, shm->data + sizeof(req->u.reply), req->u.reply.reply_header.reply_size );
+    shm->state = REQUEST_SHM_IDLE;
+    return req->u.reply.reply_header.error;
+}
+
+
 /***********************************************************************
  *           server_call_unlocked
  */
 unsigned int server_call_unlocked( void *req_ptr )
 {
     struct __server_request_info * const req = req_ptr;
+    request_shm_t *shm = ntdll_get_thread_data()->request_shm;
     unsigned int ret;
 
+    if (shm && req->u.req.request_header.request_size <= sizeof(shm->data) - sizeof(req->u.req) &&
+        req->u.req.request_header.reply_size <= sizeof(shm->data) - sizeof(req->u.reply))
+    {
+        if ((ret = send_request_shm( shm, req ))) return ret;
+        return wait_reply_shm( shm, req );
+    }
     if ((ret = send_request( req ))) return ret;
     return wait_reply( req );
 }
@@ -340,7 +446,7 @@ unsigned int CDECL wine_server_call( void *req_ptr )
 {
     struct __server_request_info * const req = req_ptr;
     sigset_t old_set;
-    unsigned int ret;
+    unsigned int i, ret;
 
     /* trigger write watches, otherwise read() might return EFAULT */
     if (req->u.req.request_header.reply_size &&
@@ -350,6 +456,14 @@ unsigned int CDECL wine_server_call( void *req_ptr )
         return ret;
     }
 
+    /* request data is copied directly to the shared memory, where write() would return EFAULT */
+    if (ntdll_get_thread_data()->request_shm)
+    {
+        for (i = 0; i < req->data_count; i++)
+            if (!virtual_check_buffer_for_read( req->data[i].ptr, req->data[i].size ))
+                return STATUS_ACCESS_VIOLATION;
+    }
+
     pthread_sigmask( SIG_BLOCK, &server_block_set, &old_set );
     ret = server_call_unlocked( req_ptr );
     pthread_sigmask( SIG_SETMASK, &old_set, NULL );
@@ -357,6 +471,83 @@ unsigned int CDECL wine_server_call( void *req_ptr )
 }
 
 
+/***********************************************************************
+ *           wine_server_call_batch (NTDLL.@)
+ *
+ * Perform several independent server calls in a single round-trip.
+ *
+ * PARAMS
+ *     reqs  [I/O] Array of requests, initialized with SERVER_INIT_REQ
+ *     count [I]   Number of requests
+ *
+ * RETURNS
+ *     The status of the batch itself. The status of each call is returned
+ *     in its reply header, calls that were not performed get the batch status.
+ *
+ * NOTES
+ *     The requests are performed in order, but they must not depend on
+ *     each other's results. The server fails the requests that can block
+ *     or that return a file descriptor with STATUS_NOT_SUPPORTED.
+ */
+unsigned int CDECL wine_server_call_batch( struct __server_request_info *reqs, unsigned int count )
+{
+    char stack_buffer[1024], *buffer = stack_buffer, *ptr, *end;
+    data_size_t req_size = 0, reply_size = 0;
+    unsigned int i, j, ret;
+
+    for (i = 0; i < count; i++)
+    {
+        req_size += sizeof(reqs[i].u.req) + BATCH_DATA_ALIGN( reqs[i].u.req.request_header.request_size );
+        reply_size += sizeof(reqs[i].u.reply) + BATCH_DATA_ALIGN( reqs[i].u.req.request_header.reply_size );
+    }
+    if (req_size + reply_size > sizeof(stack_buffer) &&
+        !(buffer = RtlAllocateHeap( GetProcessHeap(), 0, req_size + reply_size )))
+        return STATUS_NO_MEMORY;
+
+    for (i = 0, ptr = buffer; i < count; i++)
+    {
+        memcpy( ptr, &reqs[i].u.req, sizeof(reqs[i].u.req) );
+        ptr += sizeof(reqs[i].u.req);
+        for (j = 0; j < reqs[i].data_count; j++)
+        {
+            memcpy( ptr, reqs[i].data[j].ptr, reqs[i].data[j].size );
+            ptr += reqs[i].data[j].size;
+        }
+        end = buffer + BATCH_DATA_ALIGN( ptr - buffer );
+        memset( ptr, 0, end - ptr );
+        ptr = end;
+    }
+
+    SERVER_START_REQ( batch )
+    {
+        wine_server_add_data( req, buffer, req_size );
+        wine_server_set_reply( req, buffer + req_size, reply_size );
+        ret = wine_server_call( req );
+        reply_size = wine_server_reply_size( reply );
+    }
+    SERVER_END_REQ;
+
+    ptr = buffer + req_size;
+    end = ptr + reply_size;
+    for (i = 0; i < count && ptr + sizeof(reqs[i].u.reply) <= end; i++)
+    {
+        memcpy( &reqs[i].u.reply, ptr, sizeof(reqs[i].u.reply) );
+        ptr += sizeof(reqs[i].u.reply);
+        if (reqs[i].u.reply.reply_header.reply_size)
+            memcpy( reqs[i].reply_data, ptr, reqs[i].u.reply.reply_header.reply_size );
+        ptr += BATCH_DATA_ALIGN( reqs[i].u.reply.reply_header.reply_size );
+    }
+    for ( ; i < count; i++)
+    {
+        memset( &reqs[i].u.reply, 0, sizeof(reqs[i].u.reply) );
+        reqs[i].u.reply.reply_header.error = ret ? ret : STATUS_INTERNAL_ERROR;
+    }
+
+    if (buffer != stack_buffer) RtlFreeHeap( GetProcessHeap(), 0, buffer );
+    return ret;
+}
+
+
 /***********************************************************************
  *           server_enter_uninterrupted_section
  */
@@ -1126,7 +1317,8 @@ void *server_get_shared_memory( HANDLE thread )
     if (!server_get_shared_memory_fd( thread, &fd ))
     {
         SIZE_T size = thread ? sizeof(shmlocal_t) : sizeof(shmglobal_t);
-        virtual_map_shared_memory( fd, &mem, 0, &size, PAGE_READONLY );
+        /* the thread block is also written by the client to record its message checks */
+        virtual_map_shared_memory( fd, &mem, 0, &size, thread ? PAGE_READWRITE : PAGE_READONLY );
         close( fd );
     }
 
@@ -1140,6 +1332,142 @@ void *server_get_shared_memory( HANDLE thread )
 }
 
 
+/* Passing requests through shared memory saves copying them through
+ * the pipes, it is disabled by default until it is tested a bit more. */
+static inline BOOL use_request_shm( void )
+{
+    static int enabled = -1;
+    if (enabled == -1)
+    {
+        const char *str = getenv( "WINESERVERSHM" );
+        enabled = str && (atoi(str) != 0);
+    }
+    return enabled;
+}
+
+
+/***********************************************************************
+ *           server_init_request_shm
+ *
+ * Map the request shared memory of the current thread.
+ */
+static void server_init_request_shm(void)
+{
+    SIZE_T size = sizeof(request_shm_t);
+    obj_handle_t dummy;
+    sigset_t sigset;
+    void *mem = NULL;
+    int fd = -1;
+
+    if (!use_request_shm()) return;
+
+    server_enter_uninterrupted_section( &fd_cache_section, &sigset );
+
+    SERVER_START_REQ( get_request_shm )
+    {
+        if (!wine_server_call( req )) fd = receive_fd( &dummy );
+    }
+    SERVER_END_REQ;
+
+    server_leave_uninterrupted_section( &fd_cache_section, &sigset );
+
+    if (fd == -1) return;
+    if (!virtual_map_shared_memory( fd, &mem, 0, &size, PAGE_READWRITE ))
+        ntdll_get_thread_data()->request_shm = mem;
+    close( fd );
+}
+
+
+static RTL_CRITICAL_SECTION handle_shm_section;
+static RTL_CRITICAL_SECTION_DEBUG handle_shm_critsect_debug =
+{
+    0, 0, &handle_shm_section,
+    { &handle_shm_critsect_debug.ProcessLocksList, &handle_shm_critsect_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": handle_shm_section") }
+};
+static RTL_CRITICAL_SECTION handle_shm_section = { &handle_shm_critsect_debug, -1, 0, 0, 0, 0 };
+
+static const handle_shm_t *handle_shm;
+static int handle_shm_init;
+
+/***********************************************************************
+ *           get_handle_shm
+ *
+ * Map the shared memory mirror of the process handle table on first use.
+ */
+static const handle_shm_t *get_handle_shm(void)
+{
+    SIZE_T size = sizeof(handle_shm_t);
+    obj_handle_t dummy;
+    sigset_t sigset;
+    void *mem = NULL;
+    int fd = -1;
+
+    if (__atomic_load_n( &handle_shm_init, __ATOMIC_ACQUIRE )) return handle_shm;
+
+    /* the mapping can't be done with fd_cache_section held, the virtual lock is taken first elsewhere */
+    RtlEnterCriticalSection( &handle_shm_section );
+    if (!handle_shm_init)
+    {
+        server_enter_uninterrupted_section( &fd_cache_section, &sigset );
+        SERVER_START_REQ( get_handle_shm )
+        {
+            if (!wine_server_call( req )) fd = receive_fd( &dummy );
+        }
+        SERVER_END_REQ;
+        server_leave_uninterrupted_section( &fd_cache_section, &sigset );
+
+        if (fd != -1)
+        {
+            if (!virtual_map_shared_memory( fd, &mem, 0, &size, PAGE_READONLY )) handle_shm = mem;
+            close( fd );
+        }
+        __atomic_store_n( &handle_shm_init, 1, __ATOMIC_RELEASE );
+    }
+    RtlLeaveCriticalSection( &handle_shm_section );
+    return handle_shm;
+}
+
+
+/***********************************************************************
+ *           server_get_handle_entry
+ *
+ * Retrieve the server information about a handle of the current process
+ * from the shared memory mirror of the handle table, without a server call.
+ * Returns FALSE if the handle is not mirrored or not valid, in which case
+ * the caller has to ask the server.
+ */
+BOOL server_get_handle_entry( HANDLE handle, handle_shm_entry_t *info )
+{
+    const handle_shm_entry_t *entry;
+    unsigned int index, seq;
+    const handle_shm_t *shm;
+
+    if ((INT_PTR)handle <= 0 || ((ULONG_PTR)handle & 3)) return FALSE;
+    index = ((ULONG_PTR)handle >> 2) - 1;
+    if (index >= HANDLE_SHM_ENTRIES || !(shm = get_handle_shm())) return FALSE;
+    entry = &shm->entries[index];
+
+    for (;;)
+    {
+        /* an odd sequence number means that the server is updating the entry */
+        if (!((seq = __atomic_load_n( &entry->seq, __ATOMIC_ACQUIRE )) & 1))
+        {
+            info->access     = entry->access;
+            info->fsync_idx  = entry->fsync_idx;
+            info->valid      = entry->valid;
+            info->fsync_type = entry->fsync_type;
+            __atomic_thread_fence( __ATOMIC_ACQUIRE );
+            if (__atomic_load_n( &entry->seq, __ATOMIC_RELAXED ) == seq) break;
+        }
+        small_pause();
+    }
+
+    info->seq = seq;
+    return info->valid;
+}
+
+
 /***********************************************************************
  *           wine_server_fd_to_handle   (NTDLL.@)
  *
@@ -1696,6 +2024,7 @@ size_t server_init_thread( void *entry_point, BOOL *suspend )
         info_size         = reply->info_size;
         server_start_time = reply->server_start;
         server_cpus       = reply->all_cpus;
+        server_async_file_io = reply->async_file_io;
         *suspend          = reply->suspend;
     }
     SERVER_END_REQ;
@@ -1703,6 +2032,7 @@ size_t server_init_thread( void *entry_point, BOOL *suspend )
     /* initialize thread shared memory pointers */
     NtCurrentTeb()->Reserved5[1] = server_get_shared_memory( 0 );
     NtCurrentTeb()->Reserved5[2] = server_get_shared_memory( NtCurrentTeb()->ClientId.UniqueThread );
+    server_init_request_shm();
 
     is_wow64 = !is_win64 && (server_cpus & ((1 << CPU_x86_64) | (1 << CPU_ARM64))) != 0;
     ntdll_get_thread_data()->wow64_redir = is_wow64;
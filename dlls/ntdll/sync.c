@@ -51,6 +51,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
@@ -68,8 +69,6 @@ WINE_DEFAULT_DEBUG_CHANNEL(sync);
 
 HANDLE keyed_event = NULL;
 
-static const LARGE_INTEGER zero_timeout;
-
 #define TICKSPERSEC 10000000
 
 #ifdef __linux__
@@ -81,41 +80,157 @@ static const LARGE_INTEGER zero_timeout;
 
 static int futex_private = 128;
 
-static inline int futex_wait( const int *addr, int val, struct timespec *timeout )
+static inline int use_futexes(void)
 {
-    return syscall( __NR_futex, addr, FUTEX_WAIT | futex_private, val, timeout, 0, 0 );
-}
+    static int supported = -1;
 
-static inline int futex_wake( const int *addr, int val )
-{
-    return syscall( __NR_futex, addr, FUTEX_WAKE | futex_private, val, NULL, 0, 0 );
+    if (supported == -1)
+    {
+        syscall( __NR_futex, &supported, FUTEX_WAIT | futex_private, 10, NULL, 0, 0 );
+        if (errno == ENOSYS)
+        {
+            futex_private = 0;
+            syscall( __NR_futex, &supported, FUTEX_WAIT | futex_private, 10, NULL, 0, 0 );
+        }
+        supported = (errno != ENOSYS);
+    }
+    return supported;
 }
 
-static inline int futex_wait_bitset( const int *addr, int val, struct timespec *timeout, int mask )
+#endif
+
+/* Process-local futex emulation, used when the host has no futexes.
+ *
+ * Waiters are hashed by address into a small table of buckets, each with a
+ * mutex and a condition variable. A waiter compares the value under the
+ * bucket mutex, so a wake that follows an update of the value can't be lost.
+ * Waking simply bumps the bucket sequence and broadcasts; waiters are expected
+ * to handle spurious wakes, exactly like with real futexes. Since no state of
+ * the waiter is ever linked into the table, a thread killed while waiting
+ * can't leave a dangling entry behind. */
+
+#define FUTEX_BUCKETS 64
+
+struct futex_bucket
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    unsigned int    seq;
+    unsigned int    waiters;
+};
+
+static struct futex_bucket futex_buckets[FUTEX_BUCKETS];
+static pthread_once_t futex_buckets_once = PTHREAD_ONCE_INIT;
+
+static void init_futex_buckets(void)
 {
-    return syscall( __NR_futex, addr, FUTEX_WAIT_BITSET | futex_private, val, timeout, 0, mask );
+    unsigned int i;
+
+    for (i = 0; i < FUTEX_BUCKETS; i++)
+    {
+        pthread_mutex_init( &futex_buckets[i].mutex, NULL );
+        pthread_cond_init( &futex_buckets[i].cond, NULL );
+    }
 }
 
-static inline int futex_wake_bitset( const int *addr, int val, int mask )
+static struct futex_bucket *get_futex_bucket( const int *addr )
 {
-    return syscall( __NR_futex, addr, FUTEX_WAKE_BITSET | futex_private, val, NULL, 0, mask );
+    ULONG_PTR val = (ULONG_PTR)addr;
+
+    pthread_once( &futex_buckets_once, init_futex_buckets );
+    return &futex_buckets[((val >> 2) ^ (val >> 8)) % FUTEX_BUCKETS];
 }
 
-static inline int use_futexes(void)
+static int emulated_futex_wait( const int *addr, int val, const struct timespec *timeout )
 {
-    static int supported = -1;
+    struct futex_bucket *bucket = get_futex_bucket( addr );
+    struct timespec end;
+    struct timeval now;
+    unsigned int seq;
+    int ret = 0;
 
-    if (supported == -1)
+    if (timeout)
     {
-        futex_wait( &supported, 10, NULL );
-        if (errno == ENOSYS)
+        gettimeofday( &now, NULL );
+        end.tv_sec  = now.tv_sec + timeout->tv_sec;
+        end.tv_nsec = now.tv_usec * 1000 + timeout->tv_nsec;
+        if (end.tv_nsec >= 1000000000)
         {
-            futex_private = 0;
-            futex_wait( &supported, 10, NULL );
+            end.tv_sec++;
+            end.tv_nsec -= 1000000000;
         }
-        supported = (errno != ENOSYS);
     }
-    return supported;
+
+    pthread_mutex_lock( &bucket->mutex );
+    if (*(volatile const int *)addr != val)
+    {
+        pthread_mutex_unlock( &bucket->mutex );
+        errno = EAGAIN;
+        return -1;
+    }
+    seq = bucket->seq;
+    bucket->waiters++;
+    while (bucket->seq == seq && !ret)
+    {
+        if (timeout) ret = pthread_cond_timedwait( &bucket->cond, &bucket->mutex, &end );
+        else ret = pthread_cond_wait( &bucket->cond, &bucket->mutex );
+    }
+    bucket->waiters--;
+    pthread_mutex_unlock( &bucket->mutex );
+
+    if (!ret) return 0;
+    errno = ret;
+    return -1;
+}
+
+static int emulated_futex_wake( const int *addr )
+{
+    struct futex_bucket *bucket = get_futex_bucket( addr );
+
+    pthread_mutex_lock( &bucket->mutex );
+    if (bucket->waiters)
+    {
+        bucket->seq++;
+        pthread_cond_broadcast( &bucket->cond );
+    }
+    pthread_mutex_unlock( &bucket->mutex );
+    return 0;
+}
+
+static inline int futex_wait( const int *addr, int val, struct timespec *timeout )
+{
+#ifdef __linux__
+    if (use_futexes())
+        return syscall( __NR_futex, addr, FUTEX_WAIT | futex_private, val, timeout, 0, 0 );
+#endif
+    return emulated_futex_wait( addr, val, timeout );
+}
+
+static inline int futex_wake( const int *addr, int val )
+{
+#ifdef __linux__
+    if (use_futexes())
+        return syscall( __NR_futex, addr, FUTEX_WAKE | futex_private, val, NULL, 0, 0 );
+#endif
+    return emulated_futex_wake( addr );
+}
+
+static inline int futex_wait_bitset( const int *addr, int val, struct timespec *timeout, int mask )
+{
+#ifdef __linux__
+    if (use_futexes())
+        return syscall( __NR_futex, addr, FUTEX_WAIT_BITSET | futex_private, val, timeout, 0, mask );
+#endif
+    return emulated_futex_wait( addr, val, timeout );
+}
+
+static inline int futex_wake_bitset( const int *addr, int val, int mask )
+{
+#ifdef __linux__
+    if (use_futexes())
+        return syscall( __NR_futex, addr, FUTEX_WAKE_BITSET | futex_private, val, NULL, 0, mask );
+#endif
+    return emulated_futex_wake( addr );
 }
 
 static void timespec_from_timeout( struct timespec *timespec, const LARGE_INTEGER *timeout )
@@ -131,10 +246,10 @@ static void timespec_from_timeout( struct timespec *timespec, const LARGE_INTEGE
     else
         diff = -timeout->QuadPart;
 
+    if (diff < 0) diff = 0;
     timespec->tv_sec  = diff / TICKSPERSEC;
     timespec->tv_nsec = (diff % TICKSPERSEC) * 100;
 }
-#endif
 
 /* creates a struct security_descriptor and contained information in one contiguous piece of memory */
 NTSTATUS alloc_object_attributes( const OBJECT_ATTRIBUTES *attr, struct object_attributes **ret,
@@ -1765,24 +1880,21 @@ DWORD WINAPI RtlRunOnceExecuteOnce( RTL_RUN_ONCE *once, PRTL_RUN_ONCE_INIT_FN fu
     return RtlRunOnceComplete( once, 0, context ? *context : NULL );
 }
 
-#ifdef __linux__
-
-/* Futex-based SRW lock implementation:
+/* SRW locks implementation
  *
- * Since we can rely on the kernel to release all threads and don't need to
- * worry about NtReleaseKeyedEvent(), we can simplify the layout a bit. The
- * layout looks like this:
+ * The lock is a futex (or an emulated one, see futex_wait() above), so all
+ * waiting and waking is done without any server call. The layout looks like
+ * this:
  *
  *    31 - Exclusive lock bit, set if the resource is owned exclusively.
- * 30-16 - Number of exclusive waiters. Unlike the fallback implementation,
- *         this does not include the thread owning the lock, or shared threads
- *         waiting on the lock.
+ * 30-16 - Number of exclusive waiters. This does not include the thread
+ *         owning the lock, or shared threads waiting on the lock.
  *    15 - Does this lock have any shared waiters? We use this as an
  *         optimization to avoid unnecessary FUTEX_WAKE_BITSET calls when
  *         releasing an exclusive lock.
- *  14-0 - Number of shared owners. Unlike the fallback implementation, this
- *         does not include the number of shared threads waiting on the lock.
- *         Thus the state [1, x, >=1] will never occur.
+ *  14-0 - Number of shared owners. This does not include the number of
+ *         shared threads waiting on the lock. Thus the state [1, x, >=1] will
+ *         never occur.
  */
 
 #define SRWLOCK_FUTEX_EXCLUSIVE_LOCK_BIT        0x80000000
@@ -1796,13 +1908,11 @@ DWORD WINAPI RtlRunOnceExecuteOnce( RTL_RUN_ONCE *once, PRTL_RUN_ONCE_INIT_FN fu
 #define SRWLOCK_FUTEX_BITSET_EXCLUSIVE  1
 #define SRWLOCK_FUTEX_BITSET_SHARED     2
 
-static NTSTATUS fast_try_acquire_srw_exclusive( RTL_SRWLOCK *lock )
+static NTSTATUS srwlock_try_acquire_exclusive( RTL_SRWLOCK *lock )
 {
     int old, new;
     NTSTATUS ret;
 
-    if (!use_futexes()) return STATUS_NOT_IMPLEMENTED;
-
     do
     {
         old = *(int *)lock;
@@ -1824,13 +1934,11 @@ static NTSTATUS fast_try_acquire_srw_exclusive( RTL_SRWLOCK *lock )
     return ret;
 }
 
-static NTSTATUS fast_acquire_srw_exclusive( RTL_SRWLOCK *lock )
+static NTSTATUS srwlock_acquire_exclusive( RTL_SRWLOCK *lock )
 {
     int old, new;
     BOOLEAN wait;
 
-    if (!use_futexes()) return STATUS_NOT_IMPLEMENTED;
-
     /* Atomically increment the exclusive waiter count. */
     do
     {
@@ -1870,13 +1978,11 @@ static NTSTATUS fast_acquire_srw_exclusive( RTL_SRWLOCK *lock )
     return STATUS_SUCCESS;
 }
 
-static NTSTATUS fast_try_acquire_srw_shared( RTL_SRWLOCK *lock )
+static NTSTATUS srwlock_try_acquire_shared( RTL_SRWLOCK *lock )
 {
     int new, old;
     NTSTATUS ret;
 
-    if (!use_futexes()) return STATUS_NOT_IMPLEMENTED;
-
     do
     {
         old = *(int *)lock;
@@ -1900,13 +2006,11 @@ static NTSTATUS fast_try_acquire_srw_shared( RTL_SRWLOCK *lock )
     return ret;
 }
 
-static NTSTATUS fast_acquire_srw_shared( RTL_SRWLOCK *lock )
+static NTSTATUS srwlock_acquire_shared( RTL_SRWLOCK *lock )
 {
     int old, new;
     BOOLEAN wait;
 
-    if (!use_futexes()) return STATUS_NOT_IMPLEMENTED;
-
     for (;;)
     {
         do
@@ -1938,12 +2042,10 @@ static NTSTATUS fast_acquire_srw_shared( RTL_SRWLOCK *lock )
     return STATUS_SUCCESS;
 }
 
-static NTSTATUS fast_release_srw_exclusive( RTL_SRWLOCK *lock )
+static NTSTATUS srwlock_release_exclusive( RTL_SRWLOCK *lock )
 {
     int old, new;
 
-    if (!use_futexes()) return STATUS_NOT_IMPLEMENTED;
-
     do
     {
         old = *(int *)lock;
@@ -1968,12 +2070,10 @@ static NTSTATUS fast_release_srw_exclusive( RTL_SRWLOCK *lock )
     return STATUS_SUCCESS;
 }
 
-static NTSTATUS fast_release_srw_shared( RTL_SRWLOCK *lock )
+static NTSTATUS srwlock_release_shared( RTL_SRWLOCK *lock )
 {
     int old, new;
 
-    if (!use_futexes()) return STATUS_NOT_IMPLEMENTED;
-
     do
     {
         old = *(int *)lock;
@@ -1999,160 +2099,6 @@ static NTSTATUS fast_release_srw_shared( RTL_SRWLOCK *lock )
     return STATUS_SUCCESS;
 }
 
-#else
-
-static NTSTATUS fast_try_acquire_srw_exclusive( RTL_SRWLOCK *lock )
-{
-    return STATUS_NOT_IMPLEMENTED;
-}
-
-static NTSTATUS fast_acquire_srw_exclusive( RTL_SRWLOCK *lock )
-{
-    return STATUS_NOT_IMPLEMENTED;
-}
-
-static NTSTATUS fast_try_acquire_srw_shared( RTL_SRWLOCK *lock )
-{
-    return STATUS_NOT_IMPLEMENTED;
-}
-
-static NTSTATUS fast_acquire_srw_shared( RTL_SRWLOCK *lock )
-{
-    return STATUS_NOT_IMPLEMENTED;
-}
-
-static NTSTATUS fast_release_srw_exclusive( RTL_SRWLOCK *lock )
-{
-    return STATUS_NOT_IMPLEMENTED;
-}
-
-static NTSTATUS fast_release_srw_shared( RTL_SRWLOCK *lock )
-{
-    return STATUS_NOT_IMPLEMENTED;
-}
-
-#endif
-
-/* SRW locks implementation
- *
- * The memory layout used by the lock is:
- *
- * 32 31            16               0
- *  ________________ ________________
- * | X| #exclusive  |    #shared     |
- *  ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
- * Since there is no space left for a separate counter of shared access
- * threads inside the locked section the #shared field is used for multiple
- * purposes. The following table lists all possible states the lock can be
- * in, notation: [X, #exclusive, #shared]:
- *
- * [0,   0,   N] -> locked by N shared access threads, if N=0 it's unlocked
- * [0, >=1, >=1] -> threads are requesting exclusive locks, but there are
- * still shared access threads inside. #shared should not be incremented
- * anymore!
- * [1, >=1, >=0] -> lock is owned by an exclusive thread and the #shared
- * counter can be used again to count the number of threads waiting in the
- * queue for shared access.
- *
- * the following states are invalid and will never occur:
- * [0, >=1,   0], [1,   0, >=0]
- *
- * The main problem arising from the fact that we have no separate counter
- * of shared access threads inside the locked section is that in the state
- * [0, >=1, >=1] above we cannot add additional waiting threads to the
- * shared access queue - it wouldn't be possible to distinguish waiting
- * threads and those that are still inside. To solve this problem the lock
- * uses the following approach: a thread that isn't able to allocate a
- * shared lock just uses the exclusive queue instead. As soon as the thread
- * is woken up it is in the state [1, >=1, >=0]. In this state it's again
- * possible to use the shared access queue. The thread atomically moves
- * itself to the shared access queue and releases the exclusive lock, so
- * that the "real" exclusive access threads have a chance. As soon as they
- * are all ready the shared access threads are processed.
- */
-
-#define SRWLOCK_MASK_IN_EXCLUSIVE     0x80000000
-#define SRWLOCK_MASK_EXCLUSIVE_QUEUE  0x7fff0000
-#define SRWLOCK_MASK_SHARED_QUEUE     0x0000ffff
-#define SRWLOCK_RES_EXCLUSIVE         0x00010000
-#define SRWLOCK_RES_SHARED            0x00000001
-
-#ifdef WORDS_BIGENDIAN
-#define srwlock_key_exclusive(lock)   (&lock->Ptr)
-#define srwlock_key_shared(lock)      ((void *)((char *)&lock->Ptr + 2))
-#else
-#define srwlock_key_exclusive(lock)   ((void *)((char *)&lock->Ptr + 2))
-#define srwlock_key_shared(lock)      (&lock->Ptr)
-#endif
-
-static inline void srwlock_check_invalid( unsigned int val )
-{
-    /* Throw exception if it's impossible to acquire/release this lock. */
-    if ((val & SRWLOCK_MASK_EXCLUSIVE_QUEUE) == SRWLOCK_MASK_EXCLUSIVE_QUEUE ||
-            (val & SRWLOCK_MASK_SHARED_QUEUE) == SRWLOCK_MASK_SHARED_QUEUE)
-        RtlRaiseStatus(STATUS_RESOURCE_NOT_OWNED);
-}
-
-static inline unsigned int srwlock_lock_exclusive( unsigned int *dest, int incr )
-{
-    unsigned int val, tmp;
-    /* Atomically modifies the value of *dest by adding incr. If the shared
-     * queue is empty and there are threads waiting for exclusive access, then
-     * sets the mark SRWLOCK_MASK_IN_EXCLUSIVE to signal other threads that
-     * they are allowed again to use the shared queue counter. */
-    for (val = *dest;; val = tmp)
-    {
-        tmp = val + incr;
-        srwlock_check_invalid( tmp );
-        if ((tmp & SRWLOCK_MASK_EXCLUSIVE_QUEUE) && !(tmp & SRWLOCK_MASK_SHARED_QUEUE))
-            tmp |= SRWLOCK_MASK_IN_EXCLUSIVE;
-        if ((tmp = interlocked_cmpxchg( (int *)dest, tmp, val )) == val)
-            break;
-    }
-    return val;
-}
-
-static inline unsigned int srwlock_unlock_exclusive( unsigned int *dest, int incr )
-{
-    unsigned int val, tmp;
-    /* Atomically modifies the value of *dest by adding incr. If the queue of
-     * threads waiting for exclusive access is empty, then remove the
-     * SRWLOCK_MASK_IN_EXCLUSIVE flag (only the shared queue counter will
-     * remain). */
-    for (val = *dest;; val = tmp)
-    {
-        tmp = val + incr;
-        srwlock_check_invalid( tmp );
-        if (!(tmp & SRWLOCK_MASK_EXCLUSIVE_QUEUE))
-            tmp &= SRWLOCK_MASK_SHARED_QUEUE;
-        if ((tmp = interlocked_cmpxchg( (int *)dest, tmp, val )) == val)
-            break;
-    }
-    return val;
-}
-
-static inline void srwlock_leave_exclusive( RTL_SRWLOCK *lock, unsigned int val )
-{
-    /* Used when a thread leaves an exclusive section. If there are other
-     * exclusive access threads they are processed first, followed by
-     * the shared waiters. */
-    if (val & SRWLOCK_MASK_EXCLUSIVE_QUEUE)
-        NtReleaseKeyedEvent( 0, srwlock_key_exclusive(lock), FALSE, NULL );
-    else
-    {
-        val &= SRWLOCK_MASK_SHARED_QUEUE; /* remove SRWLOCK_MASK_IN_EXCLUSIVE */
-        while (val--)
-            NtReleaseKeyedEvent( 0, srwlock_key_shared(lock), FALSE, NULL );
-    }
-}
-
-static inline void srwlock_leave_shared( RTL_SRWLOCK *lock, unsigned int val )
-{
-    /* Wake up one exclusive thread as soon as the last shared access thread
-     * has left. */
-    if ((val & SRWLOCK_MASK_EXCLUSIVE_QUEUE) && !(val & SRWLOCK_MASK_SHARED_QUEUE))
-        NtReleaseKeyedEvent( 0, srwlock_key_exclusive(lock), FALSE, NULL );
-}
 
 /***********************************************************************
  *              RtlInitializeSRWLock (NTDLL.@)
@@ -2160,9 +2106,8 @@ static inline void srwlock_leave_shared( RTL_SRWLOCK *lock, unsigned int val )
  * NOTES
  *  Please note that SRWLocks do not keep track of the owner of a lock.
  *  It doesn't make any difference which thread for example unlocks an
- *  SRWLock (see corresponding tests). This implementation uses two
- *  keyed events (one for the exclusive waiters and one for the shared
- *  waiters) and is limited to 2^15-1 waiting threads.
+ *  SRWLock (see corresponding tests). This implementation is limited to
+ *  2^15-1 waiting threads.
  */
 void WINAPI RtlInitializeSRWLock( RTL_SRWLOCK *lock )
 {
@@ -2179,11 +2124,7 @@ void WINAPI RtlInitializeSRWLock( RTL_SRWLOCK *lock )
  */
 void WINAPI RtlAcquireSRWLockExclusive( RTL_SRWLOCK *lock )
 {
-    if (fast_acquire_srw_exclusive( lock ) != STATUS_NOT_IMPLEMENTED)
-        return;
-
-    if (srwlock_lock_exclusive( (unsigned int *)&lock->Ptr, SRWLOCK_RES_EXCLUSIVE ))
-        NtWaitForKeyedEvent( 0, srwlock_key_exclusive(lock), FALSE, NULL );
+    srwlock_acquire_exclusive( lock );
 }
 
 /***********************************************************************
@@ -2195,34 +2136,7 @@ void WINAPI RtlAcquireSRWLockExclusive( RTL_SRWLOCK *lock )
  */
 void WINAPI RtlAcquireSRWLockShared( RTL_SRWLOCK *lock )
 {
-    unsigned int val, tmp;
-
-    if (fast_acquire_srw_shared( lock ) != STATUS_NOT_IMPLEMENTED)
-        return;
-
-    /* Acquires a shared lock. If it's currently not possible to add elements to
-     * the shared queue, then request exclusive access instead. */
-    for (val = *(unsigned int *)&lock->Ptr;; val = tmp)
-    {
-        if ((val & SRWLOCK_MASK_EXCLUSIVE_QUEUE) && !(val & SRWLOCK_MASK_IN_EXCLUSIVE))
-            tmp = val + SRWLOCK_RES_EXCLUSIVE;
-        else
-            tmp = val + SRWLOCK_RES_SHARED;
-        if ((tmp = interlocked_cmpxchg( (int *)&lock->Ptr, tmp, val )) == val)
-            break;
-    }
-
-    /* Drop exclusive access again and instead requeue for shared access. */
-    if ((val & SRWLOCK_MASK_EXCLUSIVE_QUEUE) && !(val & SRWLOCK_MASK_IN_EXCLUSIVE))
-    {
-        NtWaitForKeyedEvent( 0, srwlock_key_exclusive(lock), FALSE, NULL );
-        val = srwlock_unlock_exclusive( (unsigned int *)&lock->Ptr, (SRWLOCK_RES_SHARED
-                                        - SRWLOCK_RES_EXCLUSIVE) ) - SRWLOCK_RES_EXCLUSIVE;
-        srwlock_leave_exclusive( lock, val );
-    }
-
-    if (val & SRWLOCK_MASK_EXCLUSIVE_QUEUE)
-        NtWaitForKeyedEvent( 0, srwlock_key_shared(lock), FALSE, NULL );
+    srwlock_acquire_shared( lock );
 }
 
 /***********************************************************************
@@ -2230,11 +2144,7 @@ void WINAPI RtlAcquireSRWLockShared( RTL_SRWLOCK *lock )
  */
 void WINAPI RtlReleaseSRWLockExclusive( RTL_SRWLOCK *lock )
 {
-    if (fast_release_srw_exclusive( lock ) != STATUS_NOT_IMPLEMENTED)
-        return;
-
-    srwlock_leave_exclusive( lock, srwlock_unlock_exclusive( (unsigned int *)&lock->Ptr,
-                             - SRWLOCK_RES_EXCLUSIVE ) - SRWLOCK_RES_EXCLUSIVE );
+    srwlock_release_exclusive( lock );
 }
 
 /***********************************************************************
@@ -2242,11 +2152,7 @@ void WINAPI RtlReleaseSRWLockExclusive( RTL_SRWLOCK *lock )
  */
 void WINAPI RtlReleaseSRWLockShared( RTL_SRWLOCK *lock )
 {
-    if (fast_release_srw_shared( lock ) != STATUS_NOT_IMPLEMENTED)
-        return;
-
-    srwlock_leave_shared( lock, srwlock_lock_exclusive( (unsigned int *)&lock->Ptr,
-                          - SRWLOCK_RES_SHARED ) - SRWLOCK_RES_SHARED );
+    srwlock_release_shared( lock );
 }
 
 /***********************************************************************
@@ -2258,13 +2164,7 @@ void WINAPI RtlReleaseSRWLockShared( RTL_SRWLOCK *lock )
  */
 BOOLEAN WINAPI RtlTryAcquireSRWLockExclusive( RTL_SRWLOCK *lock )
 {
-    NTSTATUS ret;
-
-    if ((ret = fast_try_acquire_srw_exclusive( lock )) != STATUS_NOT_IMPLEMENTED)
-        return (ret == STATUS_SUCCESS);
-
-    return interlocked_cmpxchg( (int *)&lock->Ptr, SRWLOCK_MASK_IN_EXCLUSIVE |
-                                SRWLOCK_RES_EXCLUSIVE, 0 ) == 0;
+    return srwlock_try_acquire_exclusive( lock ) == STATUS_SUCCESS;
 }
 
 /***********************************************************************
@@ -2272,31 +2172,14 @@ BOOLEAN WINAPI RtlTryAcquireSRWLockExclusive( RTL_SRWLOCK *lock )
  */
 BOOLEAN WINAPI RtlTryAcquireSRWLockShared( RTL_SRWLOCK *lock )
 {
-    unsigned int val, tmp;
-    NTSTATUS ret;
-
-    if ((ret = fast_try_acquire_srw_shared( lock )) != STATUS_NOT_IMPLEMENTED)
-        return (ret == STATUS_SUCCESS);
-
-    for (val = *(unsigned int *)&lock->Ptr;; val = tmp)
-    {
-        if (val & SRWLOCK_MASK_EXCLUSIVE_QUEUE)
-            return FALSE;
-        if ((tmp = interlocked_cmpxchg( (int *)&lock->Ptr, val + SRWLOCK_RES_SHARED, val )) == val)
-            break;
-    }
-    return TRUE;
+    return srwlock_try_acquire_shared( lock ) == STATUS_SUCCESS;
 }
 
-#ifdef __linux__
-static NTSTATUS fast_wait_cv( RTL_CONDITION_VARIABLE *variable, int val, const LARGE_INTEGER *timeout )
+static NTSTATUS wait_cv( RTL_CONDITION_VARIABLE *variable, int val, const LARGE_INTEGER *timeout )
 {
     struct timespec timespec;
     int ret;
 
-    if (!use_futexes())
-        return STATUS_NOT_IMPLEMENTED;
-
     if (timeout && timeout->QuadPart != TIMEOUT_INFINITE)
     {
         timespec_from_timeout( &timespec, timeout );
@@ -2310,25 +2193,6 @@ static NTSTATUS fast_wait_cv( RTL_CONDITION_VARIABLE *variable, int val, const L
     return STATUS_WAIT_0;
 }
 
-static NTSTATUS fast_wake_cv( RTL_CONDITION_VARIABLE *variable, int count )
-{
-    if (!use_futexes()) return STATUS_NOT_IMPLEMENTED;
-
-    futex_wake( (int *)&variable->Ptr, count );
-    return STATUS_SUCCESS;
-}
-#else
-static NTSTATUS fast_wait_cv( RTL_CONDITION_VARIABLE *variable, int val, const LARGE_INTEGER *timeout )
-{
-    return STATUS_NOT_IMPLEMENTED;
-}
-
-static NTSTATUS fast_wake_cv( RTL_CONDITION_VARIABLE *variable, int count )
-{
-    return STATUS_NOT_IMPLEMENTED;
-}
-#endif
-
 /***********************************************************************
  *           RtlInitializeConditionVariable   (NTDLL.@)
  *
@@ -2363,8 +2227,7 @@ void WINAPI RtlInitializeConditionVariable( RTL_CONDITION_VARIABLE *variable )
 void WINAPI RtlWakeConditionVariable( RTL_CONDITION_VARIABLE *variable )
 {
     interlocked_xchg_add( (int *)&variable->Ptr, 1 );
-    if (fast_wake_cv( variable, 1 ) == STATUS_NOT_IMPLEMENTED)
-        RtlWakeAddressSingle( variable );
+    futex_wake( (int *)&variable->Ptr, 1 );
 }
 
 /***********************************************************************
@@ -2375,8 +2238,7 @@ void WINAPI RtlWakeConditionVariable( RTL_CONDITION_VARIABLE *variable )
 void WINAPI RtlWakeAllConditionVariable( RTL_CONDITION_VARIABLE *variable )
 {
     interlocked_xchg_add( (int *)&variable->Ptr, 1 );
-    if (fast_wake_cv( variable, INT_MAX ) == STATUS_NOT_IMPLEMENTED)
-        RtlWakeAddressAll( variable );
+    futex_wake( (int *)&variable->Ptr, INT_MAX );
 }
 
 /***********************************************************************
@@ -2392,7 +2254,7 @@ void WINAPI RtlWakeAllConditionVariable( RTL_CONDITION_VARIABLE *variable )
  *  timeout   [I]   timeout
  *
  * RETURNS
- *  see NtWaitForKeyedEvent for all possible return values.
+ *  STATUS_SUCCESS or STATUS_TIMEOUT.
  */
 NTSTATUS WINAPI RtlSleepConditionVariableCS( RTL_CONDITION_VARIABLE *variable, RTL_CRITICAL_SECTION *crit,
                                              const LARGE_INTEGER *timeout )
@@ -2402,8 +2264,7 @@ NTSTATUS WINAPI RtlSleepConditionVariableCS( RTL_CONDITION_VARIABLE *variable, R
 
     RtlLeaveCriticalSection( crit );
 
-    if ((status = fast_wait_cv( variable, val, timeout )) == STATUS_NOT_IMPLEMENTED)
-        status = RtlWaitOnAddress( &variable->Ptr, &val, sizeof(int), timeout );
+    status = wait_cv( variable, val, timeout );
 
     RtlEnterCriticalSection( crit );
 
@@ -2424,7 +2285,7 @@ NTSTATUS WINAPI RtlSleepConditionVariableCS( RTL_CONDITION_VARIABLE *variable, R
  *  flags     [I]   type of the current lock (exclusive / shared)
  *
  * RETURNS
- *  see NtWaitForKeyedEvent for all possible return values.
+ *  STATUS_SUCCESS or STATUS_TIMEOUT.
  *
  * NOTES
  *  the behaviour is undefined if the thread doesn't own the lock.
@@ -2440,8 +2301,7 @@ NTSTATUS WINAPI RtlSleepConditionVariableSRW( RTL_CONDITION_VARIABLE *variable,
     else
         RtlReleaseSRWLockExclusive( lock );
 
-    if ((status = fast_wait_cv( variable, val, timeout )) == STATUS_NOT_IMPLEMENTED)
-        status = RtlWaitOnAddress( &variable->Ptr, &val, sizeof(int), timeout );
+    status = wait_cv( variable, val, timeout );
 
     if (flags & RTL_CONDITION_VARIABLE_LOCKMODE_SHARED)
         RtlAcquireSRWLockShared( lock );
@@ -2450,15 +2310,6 @@ NTSTATUS WINAPI RtlSleepConditionVariableSRW( RTL_CONDITION_VARIABLE *variable,
     return status;
 }
 
-static RTL_CRITICAL_SECTION addr_section;
-static RTL_CRITICAL_SECTION_DEBUG addr_section_debug =
-{
-    0, 0, &addr_section,
-    { &addr_section_debug.ProcessLocksList, &addr_section_debug.ProcessLocksList },
-      0, 0, { (DWORD_PTR)(__FILE__ ": addr_section") }
-};
-static RTL_CRITICAL_SECTION addr_section = { &addr_section_debug, -1, 0, 0, 0, 0 };
-
 static BOOL compare_addr( const void *addr, const void *cmp, SIZE_T size )
 {
     switch (size)
@@ -2476,7 +2327,6 @@ static BOOL compare_addr( const void *addr, const void *cmp, SIZE_T size )
     return FALSE;
 }
 
-#ifdef __linux__
 /* We can't map addresses to futex directly, because an application can wait on
  * 8 bytes, and we can't pass all 8 as the compare value to futex(). Instead we
  * map all addresses to a small fixed table of futexes. This may result in
@@ -2491,17 +2341,14 @@ static inline int *hash_addr( const void *addr )
     return &addr_futex_table[(val >> 2) & 255];
 }
 
-static inline NTSTATUS fast_wait_addr( const void *addr, const void *cmp, SIZE_T size,
-                                       const LARGE_INTEGER *timeout )
+static inline NTSTATUS wait_addr( const void *addr, const void *cmp, SIZE_T size,
+                                  const LARGE_INTEGER *timeout )
 {
     int *futex;
     int val;
     struct timespec timespec;
     int ret;
 
-    if (!use_futexes())
-        return STATUS_NOT_IMPLEMENTED;
-
     futex = hash_addr( addr );
 
     /* We must read the previous value of the futex before checking the value
@@ -2526,32 +2373,16 @@ static inline NTSTATUS fast_wait_addr( const void *addr, const void *cmp, SIZE_T
     return STATUS_SUCCESS;
 }
 
-static inline NTSTATUS fast_wake_addr( const void *addr )
+static inline void wake_addr( const void *addr )
 {
     int *futex;
 
-    if (!use_futexes())
-        return STATUS_NOT_IMPLEMENTED;
-
     futex = hash_addr( addr );
 
     interlocked_xchg_add( futex, 1 );
 
     futex_wake( futex, INT_MAX );
-    return STATUS_SUCCESS;
-}
-#else
-static inline NTSTATUS fast_wait_addr( const void *addr, const void *cmp, SIZE_T size,
-                                       const LARGE_INTEGER *timeout )
-{
-    return STATUS_NOT_IMPLEMENTED;
-}
-
-static inline NTSTATUS fast_wake_addr( const void *addr )
-{
-    return STATUS_NOT_IMPLEMENTED;
 }
-#endif
 
 /***********************************************************************
  *           RtlWaitOnAddress   (NTDLL.@)
@@ -2559,68 +2390,10 @@ static inline NTSTATUS fast_wake_addr( const void *addr )
 NTSTATUS WINAPI RtlWaitOnAddress( const void *addr, const void *cmp, SIZE_T size,
                                   const LARGE_INTEGER *timeout )
 {
-    select_op_t select_op;
-    NTSTATUS ret;
-    int cookie;
-    BOOL user_apc = FALSE;
-    obj_handle_t apc_handle = 0;
-    apc_call_t call;
-    apc_result_t result;
-    timeout_t abs_timeout = timeout ? timeout->QuadPart : TIMEOUT_INFINITE;
-
     if (size != 1 && size != 2 && size != 4 && size != 8)
         return STATUS_INVALID_PARAMETER;
 
-    if ((ret = fast_wait_addr( addr, cmp, size, timeout )) != STATUS_NOT_IMPLEMENTED)
-        return ret;
-
-    select_op.keyed_event.op     = SELECT_KEYED_EVENT_WAIT;
-    select_op.keyed_event.handle = wine_server_obj_handle( keyed_event );
-    select_op.keyed_event.key    = wine_server_client_ptr( addr );
-
-    memset( &result, 0, sizeof(result) );
-
-    for (;;)
-    {
-        RtlEnterCriticalSection( &addr_section );
-        if (!compare_addr( addr, cmp, size ))
-        {
-            RtlLeaveCriticalSection( &addr_section );
-            return STATUS_SUCCESS;
-        }
-
-        SERVER_START_REQ( select )
-        {
-            req->flags    = SELECT_INTERRUPTIBLE;
-            req->cookie   = wine_server_client_ptr( &cookie );
-            req->prev_apc = apc_handle;
-            req->timeout  = abs_timeout;
-            wine_server_add_data( req, &result, sizeof(result) );
-            wine_server_add_data( req, &select_op, sizeof(select_op.keyed_event) );
-            ret = wine_server_call( req );
-            abs_timeout = reply->timeout;
-            apc_handle  = reply->apc_handle;
-            call        = reply->call;
-        }
-        SERVER_END_REQ;
-
-        RtlLeaveCriticalSection( &addr_section );
-
-        if (ret == STATUS_PENDING) ret = wait_select_reply( &cookie );
-        if (ret != STATUS_USER_APC) break;
-        if (invoke_apc( &call, &result, NULL ))
-        {
-            /* if we ran a user apc we have to check once more if additional apcs are queued,
-             * but we don't want to wait */
-            abs_timeout = 0;
-            user_apc = TRUE;
-            size = 0;
-        }
-    }
-
-    if (ret == STATUS_TIMEOUT && user_apc) ret = STATUS_USER_APC;
-
-    return ret;
+    return wait_addr( addr, cmp, size, timeout );
 }
 
 /***********************************************************************
@@ -2628,12 +2401,7 @@ NTSTATUS WINAPI RtlWaitOnAddress( const void *addr, const void *cmp, SIZE_T size
  */
 void WINAPI RtlWakeAddressAll( const void *addr )
 {
-    if (fast_wake_addr( addr ) != STATUS_NOT_IMPLEMENTED)
-        return;
-
-    RtlEnterCriticalSection( &addr_section );
-    while (NtReleaseKeyedEvent( 0, addr, 0, &zero_timeout ) == STATUS_SUCCESS) {}
-    RtlLeaveCriticalSection( &addr_section );
+    wake_addr( addr );
 }
 
 /***********************************************************************
@@ -2641,10 +2409,5 @@ void WINAPI RtlWakeAddressAll( const void *addr )
  */
 void WINAPI RtlWakeAddressSingle( const void *addr )
 {
-    if (fast_wake_addr( addr ) != STATUS_NOT_IMPLEMENTED)
-        return;
-
-    RtlEnterCriticalSection( &addr_section );
-    NtReleaseKeyedEvent( 0, addr, 0, &zero_timeout );
-    RtlLeaveCriticalSection( &addr_section );
+    wake_addr( addr );
 }
@@ -827,6 +827,85 @@ done:
     pRtlFreeUnicodeString(&ntdirname);
 }
 
+static void test_case_insensitive_lookup(void)
+{
+    static const unsigned int count = 1000;
+    char testdir[MAX_PATH], path[MAX_PATH];
+    ULARGE_INTEGER time;
+    FILETIME ft;
+    HANDLE handle;
+    DWORD start, attrs;
+    unsigned int i;
+    BOOL ret;
+
+    GetTempPathA( MAX_PATH, path );
+    sprintf( testdir, "%slookup.tmp", path );
+    ret = CreateDirectoryA( testdir, NULL );
+    ok( ret, "failed to create %s, error %u\n", testdir, GetLastError() );
+    if (!ret) return;
+
+    for (i = 0; i < count; i++)
+    {
+        sprintf( path, "%s\\file%04u.dat", testdir, i );
+        handle = CreateFileA( path, GENERIC_WRITE, 0, NULL, CREATE_NEW, 0, NULL );
+        ok( handle != INVALID_HANDLE_VALUE, "failed to create %s, error %u\n", path, GetLastError() );
+        CloseHandle( handle );
+    }
+
+    /* make the directory look like it hasn't been modified recently */
+    handle = CreateFileA( testdir, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                          NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL );
+    ok( handle != INVALID_HANDLE_VALUE, "failed to open %s, error %u\n", testdir, GetLastError() );
+    GetSystemTimeAsFileTime( &ft );
+    time.u.LowPart = ft.dwLowDateTime;
+    time.u.HighPart = ft.dwHighDateTime;
+    time.QuadPart -= (ULONGLONG)3600 * 10000000;
+    ft.dwLowDateTime = time.u.LowPart;
+    ft.dwHighDateTime = time.u.HighPart;
+    ret = SetFileTime( handle, NULL, NULL, &ft );
+    ok( ret, "SetFileTime failed, error %u\n", GetLastError() );
+    CloseHandle( handle );
+
+    start = GetTickCount();
+    for (i = 0; i < count; i++)
+    {
+        sprintf( path, "%s\\FILE%04u.DAT", testdir, i );
+        attrs = GetFileAttributesA( path );
+        ok( attrs != INVALID_FILE_ATTRIBUTES, "failed to find %s, error %u\n", path, GetLastError() );
+    }
+    trace( "%u case-insensitive lookups in %u ms\n", count, GetTickCount() - start );
+
+    start = GetTickCount();
+    for (i = 0; i < count; i++)
+    {
+        sprintf( path, "%s\\MISSING%04u.DAT", testdir, i );
+        attrs = GetFileAttributesA( path );
+        ok( attrs == INVALID_FILE_ATTRIBUTES, "found %s\n", path );
+    }
+    trace( "%u failed lookups in %u ms\n", count, GetTickCount() - start );
+
+    /* the directory contents change after the lookups */
+    sprintf( path, "%s\\NewFile.dat", testdir );
+    handle = CreateFileA( path, GENERIC_WRITE, 0, NULL, CREATE_NEW, 0, NULL );
+    ok( handle != INVALID_HANDLE_VALUE, "failed to create %s, error %u\n", path, GetLastError() );
+    CloseHandle( handle );
+    sprintf( path, "%s\\NEWFILE.DAT", testdir );
+    attrs = GetFileAttributesA( path );
+    ok( attrs != INVALID_FILE_ATTRIBUTES, "failed to find %s, error %u\n", path, GetLastError() );
+    ret = DeleteFileA( path );
+    ok( ret, "failed to delete %s, error %u\n", path, GetLastError() );
+    attrs = GetFileAttributesA( path );
+    ok( attrs == INVALID_FILE_ATTRIBUTES, "found deleted %s\n", path );
+
+    for (i = 0; i < count; i++)
+    {
+        sprintf( path, "%s\\file%04u.dat", testdir, i );
+        DeleteFileA( path );
+    }
+    ret = RemoveDirectoryA( testdir );
+    ok( ret, "failed to remove %s, error %u\n", testdir, GetLastError() );
+}
+
 static void test_redirection(void)
 {
     ULONG old, cur;
@@ -905,5 +984,6 @@ START_TEST(directory)
     test_directory_sort( sysdir );
     test_NtQueryDirectoryFile();
     test_NtQueryDirectoryFile_case();
+    test_case_insensitive_lookup();
     test_redirection();
 }
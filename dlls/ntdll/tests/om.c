@@ -24,6 +24,7 @@
 #include "stdio.h"
 #include "winnt.h"
 #include "stdlib.h"
+#include "wine/server.h"
 
 static HANDLE   (WINAPI *pCreateWaitableTimerA)(SECURITY_ATTRIBUTES*, BOOL, LPCSTR);
 static BOOLEAN  (WINAPI *pRtlCreateUnicodeStringFromAsciiz)(PUNICODE_STRING, LPCSTR);
@@ -35,6 +36,7 @@ static NTSTATUS (WINAPI *pNtPulseEvent)  ( HANDLE, PLONG );
 static NTSTATUS (WINAPI *pNtQueryEvent)  ( HANDLE, EVENT_INFORMATION_CLASS, PVOID, ULONG, PULONG );
 static NTSTATUS (WINAPI *pNtResetEvent)  ( HANDLE, LONG* );
 static NTSTATUS (WINAPI *pNtSetEvent)    ( HANDLE, LONG* );
+static unsigned int (CDECL *pwine_server_call_batch)( struct __server_request_info *, unsigned int );
 static NTSTATUS (WINAPI *pNtCreateJobObject)( PHANDLE, ACCESS_MASK, POBJECT_ATTRIBUTES );
 static NTSTATUS (WINAPI *pNtOpenJobObject)( PHANDLE, ACCESS_MASK, POBJECT_ATTRIBUTES );
 static NTSTATUS (WINAPI *pNtCreateKey)( PHANDLE, ACCESS_MASK, POBJECT_ATTRIBUTES, ULONG,
@@ -2266,6 +2268,66 @@ static void test_wait_on_address(void)
     ok(address == 0, "got %s\n", wine_dbgstr_longlong(address));
 }
 
+static void test_server_batch(void)
+{
+    struct __server_request_info reqs[6];
+    HANDLE events[3], dup;
+    unsigned int i, ret;
+    NTSTATUS status;
+
+    if (!pwine_server_call_batch)
+    {
+        win_skip( "wine_server_call_batch is not available\n" );
+        return;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(events); i++)
+    {
+        status = pNtCreateEvent( &events[i], EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE );
+        ok( !status, "NtCreateEvent failed %08x\n", status );
+    }
+
+    SERVER_INIT_REQ( &reqs[0], close_handle );
+    reqs[0].u.req.close_handle_request.handle = wine_server_obj_handle( events[0] );
+    SERVER_INIT_REQ( &reqs[1], close_handle );
+    reqs[1].u.req.close_handle_request.handle = wine_server_obj_handle( events[1] );
+    SERVER_INIT_REQ( &reqs[2], close_handle );
+    reqs[2].u.req.close_handle_request.handle = 0xdeadbee0;
+    /* requests returning an fd are rejected */
+    SERVER_INIT_REQ( &reqs[3], get_handle_fd );
+    reqs[3].u.req.get_handle_fd_request.handle = wine_server_obj_handle( events[2] );
+    SERVER_INIT_REQ( &reqs[4], dup_handle );
+    reqs[4].u.req.dup_handle_request.src_process = wine_server_obj_handle( GetCurrentProcess() );
+    reqs[4].u.req.dup_handle_request.src_handle  = wine_server_obj_handle( events[2] );
+    reqs[4].u.req.dup_handle_request.dst_process = wine_server_obj_handle( GetCurrentProcess() );
+    reqs[4].u.req.dup_handle_request.options     = DUP_HANDLE_SAME_ACCESS;
+    SERVER_INIT_REQ( &reqs[5], close_handle );
+    reqs[5].u.req.close_handle_request.handle = wine_server_obj_handle( events[2] );
+
+    ret = pwine_server_call_batch( reqs, ARRAY_SIZE(reqs) );
+    ok( !ret, "wine_server_call_batch failed %08x\n", ret );
+    ok( !reqs[0].u.reply.reply_header.error, "close 0 failed %08x\n", reqs[0].u.reply.reply_header.error );
+    ok( !reqs[1].u.reply.reply_header.error, "close 1 failed %08x\n", reqs[1].u.reply.reply_header.error );
+    ok( reqs[2].u.reply.reply_header.error == STATUS_INVALID_HANDLE,
+        "close of invalid handle returned %08x\n", reqs[2].u.reply.reply_header.error );
+    ok( reqs[3].u.reply.reply_header.error == STATUS_NOT_SUPPORTED,
+        "get_handle_fd returned %08x\n", reqs[3].u.reply.reply_header.error );
+    ok( !reqs[4].u.reply.reply_header.error, "dup failed %08x\n", reqs[4].u.reply.reply_header.error );
+    ok( !reqs[5].u.reply.reply_header.error, "close 2 failed %08x\n", reqs[5].u.reply.reply_header.error );
+
+    for (i = 0; i < ARRAY_SIZE(events); i++)
+    {
+        status = pNtClose( events[i] );
+        ok( status == STATUS_INVALID_HANDLE, "handle %u not closed, status %08x\n", i, status );
+    }
+    /* the duplicated handle outlives the closed source */
+    dup = wine_server_ptr_handle( reqs[4].u.reply.dup_handle_reply.handle );
+    status = pNtSetEvent( dup, NULL );
+    ok( !status, "NtSetEvent on duplicated handle failed %08x\n", status );
+    status = pNtClose( dup );
+    ok( !status, "NtClose failed %08x\n", status );
+}
+
 START_TEST(om)
 {
     HMODULE hntdll = GetModuleHandleA("ntdll.dll");
@@ -2326,6 +2388,7 @@ START_TEST(om)
     pRtlWakeAddressAll      =  (void *)GetProcAddress(hntdll, "RtlWakeAddressAll");
     pRtlWakeAddressSingle   =  (void *)GetProcAddress(hntdll, "RtlWakeAddressSingle");
     pNtQuerySystemInformation = (void *)GetProcAddress(hntdll, "NtQuerySystemInformation");
+    pwine_server_call_batch = (void *)GetProcAddress(hntdll, "wine_server_call_batch");
 
     test_case_sensitive();
     test_namespace_pipe();
@@ -2341,4 +2404,5 @@ START_TEST(om)
     test_keyed_events();
     test_null_device();
     test_wait_on_address();
+    test_server_batch();
 }
@@ -0,0 +1,170 @@
+/*
+ * Unit tests for SRW locks and condition variables
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "ntdll_test.h"
+
+static void     (WINAPI *pRtlAcquireSRWLockExclusive)(RTL_SRWLOCK *);
+static void     (WINAPI *pRtlAcquireSRWLockShared)(RTL_SRWLOCK *);
+static void     (WINAPI *pRtlInitializeConditionVariable)(RTL_CONDITION_VARIABLE *);
+static void     (WINAPI *pRtlInitializeSRWLock)(RTL_SRWLOCK *);
+static void     (WINAPI *pRtlReleaseSRWLockExclusive)(RTL_SRWLOCK *);
+static void     (WINAPI *pRtlReleaseSRWLockShared)(RTL_SRWLOCK *);
+static NTSTATUS (WINAPI *pRtlSleepConditionVariableSRW)(RTL_CONDITION_VARIABLE *,RTL_SRWLOCK *,
+                                                        const LARGE_INTEGER *,ULONG);
+static void     (WINAPI *pRtlWakeAllConditionVariable)(RTL_CONDITION_VARIABLE *);
+static void     (WINAPI *pRtlWakeConditionVariable)(RTL_CONDITION_VARIABLE *);
+
+#define CONTENTION_THREADS    16
+#define CONTENTION_ITERATIONS 20000
+
+static RTL_SRWLOCK contention_lock;
+static RTL_CONDITION_VARIABLE contention_cv;
+static LONG contention_value, contention_shared, contention_errors;
+static LONG contention_queue, contention_produced, contention_consumed;
+
+static DWORD WINAPI srwlock_contention_thread( void *arg )
+{
+    DWORD i;
+
+    for (i = 0; i < CONTENTION_ITERATIONS; i++)
+    {
+        if (i % 4)
+        {
+            pRtlAcquireSRWLockShared( &contention_lock );
+            InterlockedIncrement( &contention_shared );
+            if (contention_value < 0) InterlockedIncrement( &contention_errors );
+            InterlockedDecrement( &contention_shared );
+            pRtlReleaseSRWLockShared( &contention_lock );
+        }
+        else
+        {
+            pRtlAcquireSRWLockExclusive( &contention_lock );
+            if (contention_shared) InterlockedIncrement( &contention_errors );
+            contention_value = -1;
+            contention_value = i;
+            pRtlReleaseSRWLockExclusive( &contention_lock );
+        }
+    }
+    return 0;
+}
+
+static DWORD WINAPI condvar_contention_thread( void *arg )
+{
+    BOOL producer = (ULONG_PTR)arg & 1;
+    LARGE_INTEGER timeout;
+    DWORD i;
+
+    timeout.QuadPart = -10000 * 5000;
+
+    for (i = 0; i < CONTENTION_ITERATIONS / 4; i++)
+    {
+        pRtlAcquireSRWLockExclusive( &contention_lock );
+        if (producer)
+        {
+            while (contention_queue >= 8)
+            {
+                if (pRtlSleepConditionVariableSRW( &contention_cv, &contention_lock, &timeout, 0 ))
+                    InterlockedIncrement( &contention_errors );
+            }
+            contention_queue++;
+            contention_produced++;
+        }
+        else
+        {
+            while (!contention_queue)
+            {
+                if (pRtlSleepConditionVariableSRW( &contention_cv, &contention_lock, &timeout, 0 ))
+                    InterlockedIncrement( &contention_errors );
+            }
+            contention_queue--;
+            contention_consumed++;
+        }
+        pRtlReleaseSRWLockExclusive( &contention_lock );
+        if (i % 2) pRtlWakeConditionVariable( &contention_cv );
+        else pRtlWakeAllConditionVariable( &contention_cv );
+    }
+    return 0;
+}
+
+static DWORD run_contention_threads( LPTHREAD_START_ROUTINE func )
+{
+    HANDLE threads[CONTENTION_THREADS];
+    DWORD i, start;
+
+    start = GetTickCount();
+    for (i = 0; i < CONTENTION_THREADS; i++)
+    {
+        threads[i] = CreateThread( NULL, 0, func, (void *)(ULONG_PTR)i, 0, NULL );
+        ok( threads[i] != NULL, "CreateThread failed with %u\n", GetLastError() );
+    }
+    for (i = 0; i < CONTENTION_THREADS; i++)
+    {
+        ok( !WaitForSingleObject( threads[i], 60000 ), "thread %u didn't finish\n", i );
+        CloseHandle( threads[i] );
+    }
+    return GetTickCount() - start;
+}
+
+static void test_srwlock_contention(void)
+{
+    DWORD elapsed;
+
+    pRtlInitializeSRWLock( &contention_lock );
+    pRtlInitializeConditionVariable( &contention_cv );
+
+    contention_errors = 0;
+    elapsed = run_contention_threads( srwlock_contention_thread );
+    ok( !contention_errors, "got %d lock violations\n", contention_errors );
+    ok( !contention_lock.Ptr, "lock not released: %p\n", contention_lock.Ptr );
+    trace( "SRW lock: %u threads x %u iterations in %u ms\n",
+           CONTENTION_THREADS, CONTENTION_ITERATIONS, elapsed );
+
+    contention_errors = 0;
+    elapsed = run_contention_threads( condvar_contention_thread );
+    ok( !contention_errors, "got %d condition variable timeouts\n", contention_errors );
+    ok( contention_produced == contention_consumed, "produced %d, consumed %d\n",
+        contention_produced, contention_consumed );
+    ok( !contention_queue, "queue not empty: %d\n", contention_queue );
+    trace( "condition variable: %u threads x %u iterations in %u ms\n",
+           CONTENTION_THREADS, CONTENTION_ITERATIONS / 4, elapsed );
+}
+
+START_TEST(sync)
+{
+    HMODULE module = GetModuleHandleA( "ntdll.dll" );
+
+#define X(f) p##f = (void*)GetProcAddress( module, #f )
+    X(RtlAcquireSRWLockExclusive);
+    X(RtlAcquireSRWLockShared);
+    X(RtlInitializeConditionVariable);
+    X(RtlInitializeSRWLock);
+    X(RtlReleaseSRWLockExclusive);
+    X(RtlReleaseSRWLockShared);
+    X(RtlSleepConditionVariableSRW);
+    X(RtlWakeAllConditionVariable);
+    X(RtlWakeConditionVariable);
+#undef X
+
+    if (!pRtlInitializeSRWLock || !pRtlSleepConditionVariableSRW)
+    {
+        win_skip( "SRW locks are not supported\n" );
+        return;
+    }
+
+    test_srwlock_contention();
+}
@@ -44,6 +44,7 @@ static NTSTATUS (WINAPI *pTpSimpleTryPost)(PTP_SIMPLE_CALLBACK,PVOID,TP_CALLBACK
 static VOID     (WINAPI *pTpWaitForTimer)(TP_TIMER *,BOOL);
 static VOID     (WINAPI *pTpWaitForWait)(TP_WAIT *,BOOL);
 static VOID     (WINAPI *pTpWaitForWork)(TP_WORK *,BOOL);
+static NTSTATUS (CDECL  *pwine_threadpool_get_statistics)(TP_POOL *,TP_POOL_WINE_STATISTICS *,BOOL);
 
 #define NTDLL_GET_PROC(func) \
     do \
@@ -86,6 +87,8 @@ static BOOL init_threadpool(void)
     NTDLL_GET_PROC(TpWaitForWait);
     NTDLL_GET_PROC(TpWaitForWork);
 
+    pwine_threadpool_get_statistics = (void *)GetProcAddress(hntdll, "wine_threadpool_get_statistics");
+
     if (!pTpAllocPool)
     {
         win_skip("Threadpool functions not supported, skipping tests\n");
@@ -643,6 +646,177 @@ static void test_tp_work(void)
     pTpReleasePool(pool);
 }
 
+static void CALLBACK work_count_cb(TP_CALLBACK_INSTANCE *instance, void *userdata, TP_WORK *work)
+{
+    InterlockedIncrement((LONG *)userdata);
+}
+
+static DWORD CALLBACK post_work_thread(void *arg)
+{
+    TP_WORK *work = arg;
+    int i;
+
+    for (i = 0; i < 10000; i++)
+        pTpPostWork(work);
+    return 0;
+}
+
+static void test_tp_work_many(void)
+{
+    TP_CALLBACK_ENVIRON environment;
+    TP_POOL_WINE_STATISTICS stats;
+    HANDLE threads[4];
+    TP_WORK *work;
+    TP_POOL *pool;
+    NTSTATUS status;
+    LONG userdata;
+    int i;
+
+    pool = NULL;
+    status = pTpAllocPool(&pool, NULL);
+    ok(!status, "TpAllocPool failed with status %x\n", status);
+    ok(pool != NULL, "expected pool != NULL\n");
+    pTpSetPoolMaxThreads(pool, 4);
+
+    work = NULL;
+    memset(&environment, 0, sizeof(environment));
+    environment.Version = 1;
+    environment.Pool = pool;
+    status = pTpAllocWork(&work, work_count_cb, &userdata, &environment);
+    ok(!status, "TpAllocWork failed with status %x\n", status);
+    ok(work != NULL, "expected work != NULL\n");
+
+    if (pwine_threadpool_get_statistics)
+    {
+        status = pwine_threadpool_get_statistics(pool, &stats, TRUE);
+        ok(!status, "wine_threadpool_get_statistics failed with status %x\n", status);
+        ok(stats.MaxWorkers == 4, "expected MaxWorkers = 4, got %u\n", stats.MaxWorkers);
+    }
+
+    /* post the same work item from several threads, no callback may get lost */
+    userdata = 0;
+    for (i = 0; i < ARRAY_SIZE(threads); i++)
+        threads[i] = CreateThread(NULL, 0, post_work_thread, work, 0, NULL);
+    for (i = 0; i < ARRAY_SIZE(threads); i++)
+    {
+        ok(WaitForSingleObject(threads[i], 10000) == WAIT_OBJECT_0, "thread %d did not finish\n", i);
+        CloseHandle(threads[i]);
+    }
+    pTpWaitForWork(work, FALSE);
+    ok(userdata == 40000, "expected userdata = 40000, got %u\n", userdata);
+
+    if (pwine_threadpool_get_statistics)
+    {
+        ULONG count = 0;
+
+        status = pwine_threadpool_get_statistics(pool, &stats, FALSE);
+        ok(!status, "wine_threadpool_get_statistics failed with status %x\n", status);
+        ok(stats.Submitted == 40000, "expected Submitted = 40000, got %u\n", stats.Submitted);
+        ok(stats.Completed == 40000, "expected Completed = 40000, got %u\n", stats.Completed);
+        ok(stats.Workers <= 4, "expected Workers <= 4, got %u\n", stats.Workers);
+        for (i = 0; i < TP_WINE_STATS_CLASSES; i++) count += stats.RunTime[i];
+        ok(count == 40000, "expected 40000 run times, got %u\n", count);
+        trace("%u worker threads created, %u pending\n", stats.ThreadsCreated, stats.PendingCallbacks[1]);
+    }
+
+    pTpReleaseWork(work);
+    pTpReleasePool(pool);
+}
+
+struct simple_many
+{
+    TP_CALLBACK_ENVIRON *environment;
+    LONG                 count;
+    LONG                 total;
+    HANDLE               done;
+};
+
+static void CALLBACK simple_count_cb(TP_CALLBACK_INSTANCE *instance, void *userdata)
+{
+    struct simple_many *data = userdata;
+    if (InterlockedIncrement(&data->count) == data->total)
+        SetEvent(data->done);
+}
+
+static DWORD CALLBACK post_simple_thread(void *arg)
+{
+    struct simple_many *data = arg;
+    NTSTATUS status = STATUS_SUCCESS;
+    int i;
+
+    for (i = 0; i < 10000; i++)
+    {
+        status = pTpSimpleTryPost(simple_count_cb, data, data->environment);
+        if (status) break;
+    }
+    return status;
+}
+
+static void test_tp_simple_many(void)
+{
+    TP_CALLBACK_ENVIRON environment;
+    TP_POOL_WINE_STATISTICS stats;
+    HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+    struct simple_many data;
+    unsigned int num_threads;
+    DWORD ticks, code;
+    SYSTEM_INFO info;
+    TP_POOL *pool;
+    NTSTATUS status;
+    int i;
+
+    /* post from more threads than there are cores, all of them contending on the pool */
+    GetSystemInfo(&info);
+    num_threads = min(max(2 * info.dwNumberOfProcessors, 4), ARRAY_SIZE(threads));
+
+    pool = NULL;
+    status = pTpAllocPool(&pool, NULL);
+    ok(!status, "TpAllocPool failed with status %x\n", status);
+    ok(pool != NULL, "expected pool != NULL\n");
+    pTpSetPoolMaxThreads(pool, info.dwNumberOfProcessors);
+
+    memset(&environment, 0, sizeof(environment));
+    environment.Version = 1;
+    environment.Pool = pool;
+
+    data.environment = &environment;
+    data.count = 0;
+    data.total = num_threads * 10000;
+    data.done = CreateEventW(NULL, TRUE, FALSE, NULL);
+    ok(data.done != NULL, "CreateEvent failed with %u\n", GetLastError());
+
+    if (pwine_threadpool_get_statistics)
+        pwine_threadpool_get_statistics(pool, &stats, TRUE);
+
+    ticks = GetTickCount();
+    for (i = 0; i < num_threads; i++)
+        threads[i] = CreateThread(NULL, 0, post_simple_thread, &data, 0, NULL);
+    for (i = 0; i < num_threads; i++)
+    {
+        ok(WaitForSingleObject(threads[i], 30000) == WAIT_OBJECT_0, "thread %d did not finish\n", i);
+        ok(GetExitCodeThread(threads[i], &code) && !code, "TpSimpleTryPost failed with status %x\n", code);
+        CloseHandle(threads[i]);
+    }
+    ok(WaitForSingleObject(data.done, 30000) == WAIT_OBJECT_0, "callbacks did not finish\n");
+    ticks = GetTickCount() - ticks;
+    ok(data.count == data.total, "expected count = %u, got %u\n", data.total, data.count);
+    trace("%u simple callbacks from %u threads on %u cores in %u ms\n",
+          data.total, num_threads, info.dwNumberOfProcessors, ticks);
+
+    if (pwine_threadpool_get_statistics)
+    {
+        status = pwine_threadpool_get_statistics(pool, &stats, FALSE);
+        ok(!status, "wine_threadpool_get_statistics failed with status %x\n", status);
+        ok(stats.Submitted == data.total, "expected Submitted = %u, got %u\n", data.total, stats.Submitted);
+        ok(stats.Workers <= info.dwNumberOfProcessors, "expected Workers <= %u, got %u\n",
+           info.dwNumberOfProcessors, stats.Workers);
+        trace("%u worker threads created, %u pending\n", stats.ThreadsCreated, stats.PendingCallbacks[1]);
+    }
+
+    pTpReleasePool(pool);
+    CloseHandle(data.done);
+}
+
 static void test_tp_work_scheduler(void)
 {
     TP_CALLBACK_ENVIRON environment;
@@ -1916,6 +2090,8 @@ START_TEST(threadpool)
 
     test_tp_simple();
     test_tp_work();
+    test_tp_work_many();
+    test_tp_simple_many();
     test_tp_work_scheduler();
     test_tp_group_wait();
     test_tp_group_cancel();
@@ -31,6 +31,7 @@ static unsigned int page_size;
 static NTSTATUS (WINAPI *pRtlCreateUserStack)(SIZE_T, SIZE_T, ULONG, SIZE_T, SIZE_T, INITIAL_TEB *);
 static NTSTATUS (WINAPI *pRtlFreeUserStack)(void *);
 static BOOL (WINAPI *pIsWow64Process)(HANDLE, PBOOL);
+static SIZE_T (WINAPI *pGetLargePageMinimum)(void);
 static const BOOL is_win64 = sizeof(void*) != sizeof(int);
 
 static HANDLE create_target_process(const char *arg)
@@ -513,6 +514,162 @@ static void test_NtMapViewOfSection(void)
     CloseHandle(process);
 }
 
+static void *query_thread_addr;
+static LONG query_thread_done;
+
+static DWORD WINAPI query_thread( void *arg )
+{
+    MEMORY_BASIC_INFORMATION info;
+    NTSTATUS status;
+    SIZE_T len;
+    DWORD i;
+
+    for (i = 0; !query_thread_done; i++)
+    {
+        status = NtQueryVirtualMemory( NtCurrentProcess(), (char *)query_thread_addr + (i % 4) * page_size,
+                                       MemoryBasicInformation, &info, sizeof(info), &len );
+        ok( !status, "NtQueryVirtualMemory returned %08x\n", status );
+        ok( info.AllocationBase == query_thread_addr, "wrong allocation base %p / %p\n",
+            info.AllocationBase, query_thread_addr );
+        ok( info.State == MEM_COMMIT, "wrong state %#x\n", info.State );
+        ok( info.Protect == PAGE_READWRITE, "wrong protection %#x\n", info.Protect );
+        if (status || info.AllocationBase != query_thread_addr) break;
+    }
+    return i;
+}
+
+static void test_NtQueryVirtualMemory_threads(void)
+{
+    HANDLE threads[8];
+    DWORD i, j, queries;
+    NTSTATUS status;
+    SIZE_T size;
+    void *addr;
+
+    size = 4 * page_size;
+    query_thread_addr = NULL;
+    status = NtAllocateVirtualMemory( NtCurrentProcess(), &query_thread_addr, 0, &size,
+                                      MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+    ok( !status, "NtAllocateVirtualMemory returned %08x\n", status );
+
+    query_thread_done = FALSE;
+    for (i = 0; i < ARRAY_SIZE(threads); i++)
+        threads[i] = CreateThread( NULL, 0, query_thread, NULL, 0, NULL );
+
+    /* keep changing the view tree while the other threads query it */
+    for (i = 0; i < 2000; i++)
+    {
+        size = (1 + i % 16) * page_size;
+        addr = NULL;
+        status = NtAllocateVirtualMemory( NtCurrentProcess(), &addr, 0, &size,
+                                          MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+        ok( !status, "NtAllocateVirtualMemory returned %08x\n", status );
+        size = 0;
+        status = NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
+        ok( !status, "NtFreeVirtualMemory returned %08x\n", status );
+    }
+
+    query_thread_done = TRUE;
+    for (i = queries = 0; i < ARRAY_SIZE(threads); i++)
+    {
+        ok( !WaitForSingleObject( threads[i], 10000 ), "thread %u didn't finish\n", i );
+        GetExitCodeThread( threads[i], &j );
+        queries += j;
+        CloseHandle( threads[i] );
+    }
+    trace( "%u queries from %u threads\n", queries, (DWORD)ARRAY_SIZE(threads) );
+
+    size = 0;
+    status = NtFreeVirtualMemory( NtCurrentProcess(), &query_thread_addr, &size, MEM_RELEASE );
+    ok( !status, "NtFreeVirtualMemory returned %08x\n", status );
+}
+
+/* chase pointers through one cache line per page, in random order, so that
+ * nearly every access misses the TLB unless the memory uses large pages */
+static DWORD page_walk( char *base, SIZE_T size )
+{
+    SIZE_T i, j, tmp, count = size / page_size, *next;
+    DWORD start, rand = 1;
+    char *ptr = base;
+
+    next = HeapAlloc( GetProcessHeap(), 0, count * sizeof(*next) );
+    for (i = 0; i < count; i++) next[i] = i;
+    for (i = count - 1; i > 0; i--)
+    {
+        rand = rand * 1103515245 + 12345;
+        j = (rand >> 8) % i;
+        tmp = next[i];
+        next[i] = next[j];
+        next[j] = tmp;
+    }
+    for (i = 0; i < count; i++) *(char **)(base + i * page_size) = base + next[i] * page_size;
+    HeapFree( GetProcessHeap(), 0, next );
+
+    start = GetTickCount();
+    for (i = 0; i < 16 * count; i++) ptr = *(char **)ptr;
+    ok( ptr != NULL, "lost the pointer chain\n" );
+    return GetTickCount() - start;
+}
+
+static void test_large_pages(void)
+{
+    SIZE_T large_page_size, size;
+    DWORD small_time, large_time;
+    NTSTATUS status;
+    void *addr, *small_addr;
+
+    if (!pGetLargePageMinimum || !(large_page_size = pGetLargePageMinimum()))
+    {
+        skip( "large pages not supported\n" );
+        return;
+    }
+
+    addr = NULL;
+    size = large_page_size;
+    status = NtAllocateVirtualMemory( NtCurrentProcess(), &addr, 0, &size,
+                                      MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE );
+    ok( status == STATUS_INVALID_PARAMETER || broken(status == STATUS_PRIVILEGE_NOT_HELD),
+        "NtAllocateVirtualMemory returned %08x\n", status );
+
+    addr = NULL;
+    size = large_page_size + page_size;
+    status = NtAllocateVirtualMemory( NtCurrentProcess(), &addr, 0, &size,
+                                      MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE );
+    ok( status == STATUS_INVALID_PARAMETER || broken(status == STATUS_PRIVILEGE_NOT_HELD),
+        "NtAllocateVirtualMemory returned %08x\n", status );
+
+    addr = NULL;
+    size = 32 * large_page_size;
+    status = NtAllocateVirtualMemory( NtCurrentProcess(), &addr, 0, &size,
+                                      MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE );
+    if (status == STATUS_PRIVILEGE_NOT_HELD || status == STATUS_NO_MEMORY)
+    {
+        skip( "can't allocate large pages (%08x)\n", status );
+        return;
+    }
+    ok( !status, "NtAllocateVirtualMemory returned %08x\n", status );
+    if (status) return;
+    ok( !((ULONG_PTR)addr & (large_page_size - 1)), "address %p is not aligned\n", addr );
+    ok( size == 32 * large_page_size, "wrong size %#lx\n", size );
+
+    small_addr = NULL;
+    status = NtAllocateVirtualMemory( NtCurrentProcess(), &small_addr, 0, &size,
+                                      MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+    ok( !status, "NtAllocateVirtualMemory returned %08x\n", status );
+
+    small_time = page_walk( small_addr, size );
+    large_time = page_walk( addr, size );
+    trace( "random page walk over %lu Mb: %u ms with small pages, %u ms with large pages\n",
+           size >> 20, small_time, large_time );
+
+    size = 0;
+    status = NtFreeVirtualMemory( NtCurrentProcess(), &small_addr, &size, MEM_RELEASE );
+    ok( !status, "NtFreeVirtualMemory returned %08x\n", status );
+    size = 0;
+    status = NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
+    ok( !status, "NtFreeVirtualMemory returned %08x\n", status );
+}
+
 START_TEST(virtual)
 {
     SYSTEM_BASIC_INFORMATION sbi;
@@ -534,6 +691,7 @@ START_TEST(virtual)
 
     mod = GetModuleHandleA("kernel32.dll");
     pIsWow64Process = (void *)GetProcAddress(mod, "IsWow64Process");
+    pGetLargePageMinimum = (void *)GetProcAddress(mod, "GetLargePageMinimum");
 
     mod = GetModuleHandleA("ntdll.dll");
     pRtlCreateUserStack = (void *)GetProcAddress(mod, "RtlCreateUserStack");
@@ -546,4 +704,6 @@ START_TEST(virtual)
     test_NtAllocateVirtualMemory();
     test_RtlCreateUserStack();
     test_NtMapViewOfSection();
+    test_NtQueryVirtualMemory_threads();
+    test_large_pages();
 }
@@ -339,6 +339,9 @@ TEB *thread_init(void)
     user_shared_data->SystemCallPad[0] = 1;
     user_shared_data_external->SystemCallPad[0] = 1;
 
+    user_shared_data->LargePageMinimum = virtual_get_large_page_size();
+    user_shared_data_external->LargePageMinimum = user_shared_data->LargePageMinimum;
+
     /*
      * Starting with Vista, the first user to log on has session id 1.
      * Session id 0 is for processes that don't interact with the user (like services).
@@ -365,6 +368,7 @@ TEB *thread_init(void)
     signal_init_thread( teb );
     virtual_init_threading();
     debug_init();
+    init_critical_section_stats();
     set_process_name( __wine_main_argc, __wine_main_argv );
 
 	/* initialize user_shared_data */
@@ -562,6 +566,8 @@ void WINAPI RtlExitUserThread( ULONG status )
 
     shmlocal = interlocked_xchg_ptr( &NtCurrentTeb()->Reserved5[2], NULL );
     if (shmlocal) NtUnmapViewOfSection( NtCurrentProcess(), shmlocal );
+    shmlocal = interlocked_xchg_ptr( (void **)&ntdll_get_thread_data()->request_shm, NULL );
+    if (shmlocal) NtUnmapViewOfSection( NtCurrentProcess(), shmlocal );
 
     pthread_sigmask( SIG_BLOCK, &server_block_set, NULL );
 
@@ -608,12 +614,15 @@ static void start_thread( struct startup_info *info )
 
 
 /***********************************************************************
- *              NtCreateThreadEx   (NTDLL.@)
+ *              create_thread
+ *
+ * Implementation of NtCreateThreadEx, internal threads are never attached
+ * to the loader.
  */
-NTSTATUS WINAPI NtCreateThreadEx( HANDLE *handle_ptr, ACCESS_MASK access, OBJECT_ATTRIBUTES *thread_attr,
-                                  HANDLE process, LPTHREAD_START_ROUTINE start, void *param,
-                                  ULONG flags, ULONG zero_bits, ULONG stack_commit,
-                                  ULONG stack_reserve, PPS_ATTRIBUTE_LIST ps_attr_list )
+static NTSTATUS create_thread( HANDLE *handle_ptr, ACCESS_MASK access, OBJECT_ATTRIBUTES *thread_attr,
+                               HANDLE process, LPTHREAD_START_ROUTINE start, void *param,
+                               ULONG flags, ULONG zero_bits, ULONG stack_commit,
+                               ULONG stack_reserve, PPS_ATTRIBUTE_LIST ps_attr_list, BOOL internal )
 {
     sigset_t sigset;
     pthread_t pthread_id;
@@ -760,6 +769,8 @@ NTSTATUS WINAPI NtCreateThreadEx( HANDLE *handle_ptr, ACCESS_MASK access, OBJECT
     thread_data->esync_queue_fd = -1;
     thread_data->esync_apc_fd = -1;
     thread_data->fsync_apc_futex = NULL;
+    thread_data->skip_attach = !!(flags & THREAD_CREATE_FLAGS_SKIP_THREAD_ATTACH);
+    thread_data->internal    = internal;
 
     pthread_attr_init( &pthread_attr );
     pthread_attr_setstack( &pthread_attr, teb->DeallocationStack,
@@ -791,6 +802,31 @@ error:
     return status;
 }
 
+/***********************************************************************
+ *              create_internal_thread
+ *
+ * Create a thread for ntdll internal use. It doesn't take the loader lock,
+ * so it gets no TLS and no dll thread notifications, and it must only run
+ * ntdll code.
+ */
+NTSTATUS create_internal_thread( LPTHREAD_START_ROUTINE start, void *param )
+{
+    return create_thread( NULL, THREAD_ALL_ACCESS, NULL, NtCurrentProcess(), start, param,
+                          0, 0, 0, 0, NULL, TRUE );
+}
+
+/***********************************************************************
+ *              NtCreateThreadEx   (NTDLL.@)
+ */
+NTSTATUS WINAPI NtCreateThreadEx( HANDLE *handle_ptr, ACCESS_MASK access, OBJECT_ATTRIBUTES *thread_attr,
+                                  HANDLE process, LPTHREAD_START_ROUTINE start, void *param,
+                                  ULONG flags, ULONG zero_bits, ULONG stack_commit,
+                                  ULONG stack_reserve, PPS_ATTRIBUTE_LIST ps_attr_list )
+{
+    return create_thread( handle_ptr, access, thread_attr, process, start, param, flags,
+                          zero_bits, stack_commit, stack_reserve, ps_attr_list, FALSE );
+}
+
 NTSTATUS WINAPI NtCreateThread( HANDLE *handle_ptr, ACCESS_MASK access, OBJECT_ATTRIBUTES *attr, HANDLE process,
                                 CLIENT_ID *id, CONTEXT *context, INITIAL_TEB *teb, BOOLEAN suspended )
 {
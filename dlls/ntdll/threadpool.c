@@ -24,6 +24,7 @@
 
 #include <assert.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include <limits.h>
 
 #define NONAMELESSUNION
@@ -37,6 +38,7 @@
 #include "ntdll_misc.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(threadpool);
+WINE_DECLARE_DEBUG_CHANNEL(tpstat);
 
 /*
  * Old thread pooling API
@@ -126,12 +128,22 @@ struct threadpool
     CRITICAL_SECTION        cs;
     /* Pools of work items, locked via .cs, order matches TP_CALLBACK_PRIORITY - high, normal, low. */
     struct list             pools[3];
+    /* simple callbacks posted without the lock, moved to .pools by the workers */
+    SLIST_HEADER            simple_items;
     RTL_CONDITION_VARIABLE  update_event;
     /* information about worker threads, locked via .cs */
     int                     max_workers;
     int                     min_workers;
     int                     num_workers;
     int                     num_busy_workers;
+    int                     num_starting_workers;
+    /* statistics, the counters are interlocked, the histograms locked via .cs */
+    LONG                    stats_submitted;
+    LONG                    stats_completed;
+    LONG                    stats_may_run_long;
+    LONG                    stats_threads_created;
+    ULONG                   stats_queue_latency[TP_WINE_STATS_CLASSES];
+    ULONG                   stats_run_time[TP_WINE_STATS_CLASSES];
 };
 
 enum threadpool_objtype
@@ -162,6 +174,7 @@ struct threadpool_object
     BOOL                    is_group_member;
     /* information about the pool, locked via .pool->cs */
     struct list             pool_entry;
+    ULONGLONG               queue_time;
     RTL_CONDITION_VARIABLE  finished_event;
     RTL_CONDITION_VARIABLE  group_finished_event;
     LONG                    num_pending_callbacks;
@@ -173,6 +186,7 @@ struct threadpool_object
         struct
         {
             PTP_SIMPLE_CALLBACK callback;
+            SLIST_ENTRY     entry;
         } simple;
         struct
         {
@@ -1300,6 +1314,60 @@ static void CALLBACK timerqueue_thread_proc( void *param )
     RtlExitUserThread( 0 );
 }
 
+/* the queue latency and run time histograms are only filled once they have
+ * been requested, or when the tpstat channel is enabled */
+static BOOL threadpool_timing;
+
+static inline BOOL tp_stats_timing(void)
+{
+    return threadpool_timing || TRACE_ON(tpstat);
+}
+
+static inline ULONGLONG tp_stats_time(void)
+{
+    LARGE_INTEGER now;
+    NtQueryPerformanceCounter( &now, NULL );
+    return now.QuadPart;
+}
+
+/* get the histogram class of a time in 100ns units */
+static inline unsigned int tp_stats_class( ULONGLONG time )
+{
+    ULONGLONG usec = time / 10;
+    unsigned int class = 0;
+
+    while (usec && class < TP_WINE_STATS_CLASSES - 1)
+    {
+        usec >>= 1;
+        class++;
+    }
+    return class;
+}
+
+/***********************************************************************
+ *           tp_threadpool_dump_stats    (internal)
+ *
+ * Dump the statistics of a pool to the tpstat channel. Must be called
+ * with the pool lock held.
+ */
+static void tp_threadpool_dump_stats( const struct threadpool *pool )
+{
+    char latency[TP_WINE_STATS_CLASSES * 11 + 1], run_time[TP_WINE_STATS_CLASSES * 11 + 1];
+    unsigned int i, pos_latency = 0, pos_run_time = 0;
+
+    for (i = 0; i < TP_WINE_STATS_CLASSES; i++)
+    {
+        pos_latency += sprintf( latency + pos_latency, " %u", pool->stats_queue_latency[i] );
+        pos_run_time += sprintf( run_time + pos_run_time, " %u", pool->stats_run_time[i] );
+    }
+
+    TRACE_(tpstat)( "pool %p: %d workers (%d busy), %u submitted, %u completed, %u may run long, %u threads created\n",
+                    pool, pool->num_workers, pool->num_busy_workers, pool->stats_submitted,
+                    pool->stats_completed, pool->stats_may_run_long, pool->stats_threads_created );
+    TRACE_(tpstat)( "pool %p: queue latency (<1us, <2us, <4us, ...):%s\n", pool, latency );
+    TRACE_(tpstat)( "pool %p: callback run time (<1us, <2us, <4us, ...):%s\n", pool, run_time );
+}
+
 /***********************************************************************
  *           tp_new_worker_thread    (internal)
  *
@@ -1317,6 +1385,8 @@ static NTSTATUS tp_new_worker_thread( struct threadpool *pool )
         interlocked_inc( &pool->refcount );
         pool->num_workers++;
         pool->num_busy_workers++;
+        pool->num_starting_workers++;
+        interlocked_inc( &pool->stats_threads_created );
         NtClose( thread );
     }
     return status;
@@ -1668,12 +1738,21 @@ static NTSTATUS tp_threadpool_alloc( struct threadpool **out )
 
     for (i = 0; i < ARRAY_SIZE(pool->pools); ++i)
         list_init( &pool->pools[i] );
+    RtlInitializeSListHead( &pool->simple_items );
     RtlInitializeConditionVariable( &pool->update_event );
 
     pool->max_workers           = 500;
     pool->min_workers           = 0;
     pool->num_workers           = 0;
     pool->num_busy_workers      = 0;
+    pool->num_starting_workers  = 0;
+
+    pool->stats_submitted       = 0;
+    pool->stats_completed       = 0;
+    pool->stats_may_run_long    = 0;
+    pool->stats_threads_created = 0;
+    memset( pool->stats_queue_latency, 0, sizeof(pool->stats_queue_latency) );
+    memset( pool->stats_run_time, 0, sizeof(pool->stats_run_time) );
 
     TRACE( "allocated threadpool %p\n", pool );
 
@@ -1709,11 +1788,13 @@ static BOOL tp_threadpool_release( struct threadpool *pool )
         return FALSE;
 
     TRACE( "destroying threadpool %p\n", pool );
+    if (TRACE_ON(tpstat)) tp_threadpool_dump_stats( pool );
 
     assert( pool->shutdown );
     assert( !pool->objcount );
     for (i = 0; i < ARRAY_SIZE(pool->pools); ++i)
         assert( list_empty( &pool->pools[i] ) );
+    assert( !RtlQueryDepthSList( &pool->simple_items ) );
 
     pool->cs.DebugInfo->Spare[0] = 0;
     RtlDeleteCriticalSection( &pool->cs );
@@ -1869,15 +1950,13 @@ static BOOL tp_group_release( struct threadpool_group *group )
 }
 
 /***********************************************************************
- *           tp_object_initialize    (internal)
+ *           tp_object_setup    (internal)
  *
  * Initializes members of a threadpool object.
  */
-static void tp_object_initialize( struct threadpool_object *object, struct threadpool *pool,
-                                  PVOID userdata, TP_CALLBACK_ENVIRON *environment )
+static void tp_object_setup( struct threadpool_object *object, struct threadpool *pool,
+                             PVOID userdata, TP_CALLBACK_ENVIRON *environment )
 {
-    BOOL is_simple_callback = (object->type == TP_OBJECT_TYPE_SIMPLE);
-
     object->refcount                = 1;
     object->shutdown                = FALSE;
 
@@ -1894,6 +1973,7 @@ static void tp_object_initialize( struct threadpool_object *object, struct threa
     object->is_group_member         = FALSE;
 
     memset( &object->pool_entry, 0, sizeof(object->pool_entry) );
+    object->queue_time              = 0;
     RtlInitializeConditionVariable( &object->finished_event );
     RtlInitializeConditionVariable( &object->group_finished_event );
     object->num_pending_callbacks   = 0;
@@ -1929,6 +2009,20 @@ static void tp_object_initialize( struct threadpool_object *object, struct threa
         LdrAddRefDll( 0, object->race_dll );
 
     TRACE( "allocated object %p of type %u\n", object, object->type );
+}
+
+/***********************************************************************
+ *           tp_object_initialize    (internal)
+ *
+ * Initializes a threadpool object and adds it to its cleanup group,
+ * simple callbacks are submitted immediately.
+ */
+static void tp_object_initialize( struct threadpool_object *object, struct threadpool *pool,
+                                  PVOID userdata, TP_CALLBACK_ENVIRON *environment )
+{
+    BOOL is_simple_callback = (object->type == TP_OBJECT_TYPE_SIMPLE);
+
+    tp_object_setup( object, pool, userdata, environment );
 
     /* For simple callbacks we have to run tp_object_submit before adding this object
      * to the cleanup group. As soon as the cleanup group members are released ->shutdown
@@ -1954,6 +2048,7 @@ static void tp_object_initialize( struct threadpool_object *object, struct threa
 
 static void tp_object_prio_queue( struct threadpool_object *object )
 {
+    if (tp_stats_timing()) object->queue_time = tp_stats_time();
     list_add_tail( &object->pool->pools[object->priority], &object->pool_entry );
 }
 
@@ -1967,20 +2062,38 @@ static void tp_object_submit( struct threadpool_object *object, BOOL signaled )
 {
     struct threadpool *pool = object->pool;
     NTSTATUS status = STATUS_UNSUCCESSFUL;
+    LONG pending;
 
     assert( !object->shutdown );
     assert( !pool->shutdown );
 
+    interlocked_inc( &object->refcount );
+    interlocked_inc( &pool->stats_submitted );
+
+    /* If the object is already queued, the callbacks that are pending will get it
+     * processed again, so it is enough to increment their count without the lock. */
+    if (object->type != TP_OBJECT_TYPE_WAIT)
+    {
+        while ((pending = object->num_pending_callbacks) > 0)
+        {
+            if (interlocked_cmpxchg( &object->num_pending_callbacks, pending + 1, pending ) != pending)
+                continue;
+            if (pool->num_busy_workers < pool->num_workers)
+                RtlWakeConditionVariable( &pool->update_event );
+            return;
+        }
+    }
+
     enter_critical_section( &pool->cs );
 
-    /* Start new worker threads if required. */
-    if (pool->num_busy_workers >= pool->num_workers &&
+    /* Start a new worker thread if all of them are busy. If one is still starting,
+     * it will pick up the work and start another one if there is more. */
+    if (pool->num_busy_workers >= pool->num_workers && !pool->num_starting_workers &&
         pool->num_workers < pool->max_workers)
         status = tp_new_worker_thread( pool );
 
-    /* Queue work item and increment refcount. */
-    interlocked_inc( &object->refcount );
-    if (!object->num_pending_callbacks++)
+    /* Queue work item. */
+    if (interlocked_inc( &object->num_pending_callbacks ) == 1)
         tp_object_prio_queue( object );
 
     /* Count how often the object was signaled. */
@@ -1997,6 +2110,62 @@ static void tp_object_submit( struct threadpool_object *object, BOOL signaled )
     leave_critical_section( &pool->cs );
 }
 
+/***********************************************************************
+ *           tp_object_post_simple    (internal)
+ *
+ * Posts a simple callback without taking the pool lock. This is only done
+ * for callbacks without cleanup group and with normal priority, nobody else
+ * can cancel or wait for them. Returns FALSE if the callback has to be
+ * submitted the regular way.
+ */
+static BOOL tp_object_post_simple( struct threadpool_object *object, PVOID userdata,
+                                   TP_CALLBACK_ENVIRON *environment )
+{
+    struct threadpool *pool = default_threadpool;
+    NTSTATUS status = STATUS_UNSUCCESSFUL;
+
+    if (environment)
+    {
+        if (environment->CleanupGroup)
+            return FALSE;
+        if (environment->Version == 3 &&
+            ((TP_CALLBACK_ENVIRON_V3 *)environment)->CallbackPriority != TP_CALLBACK_PRIORITY_NORMAL)
+            return FALSE;
+        if (environment->Pool)
+            pool = (struct threadpool *)environment->Pool;
+    }
+
+    /* The first worker thread is started by tp_threadpool_lock. */
+    if (!pool || !pool->num_workers)
+        return FALSE;
+
+    interlocked_inc( &pool->refcount );
+    tp_object_setup( object, pool, userdata, environment );
+    object->num_pending_callbacks = 1;
+    if (tp_stats_timing()) object->queue_time = tp_stats_time();
+    interlocked_inc( &pool->stats_submitted );
+
+    /* If there were items already, a worker has been notified about them
+     * and wakes up the others when it moves them to the pool. */
+    if (RtlInterlockedPushEntrySList( &pool->simple_items, &object->u.simple.entry ))
+        return TRUE;
+
+    enter_critical_section( &pool->cs );
+
+    if (pool->num_busy_workers >= pool->num_workers && !pool->num_starting_workers &&
+        pool->num_workers < pool->max_workers)
+        status = tp_new_worker_thread( pool );
+
+    if (status != STATUS_SUCCESS)
+    {
+        if (!pool->num_workers) ERR( "no worker thread left in pool %p\n", pool );
+        RtlWakeConditionVariable( &pool->update_event );
+    }
+
+    leave_critical_section( &pool->cs );
+    return TRUE;
+}
+
 /***********************************************************************
  *           tp_object_cancel    (internal)
  *
@@ -2008,10 +2177,8 @@ static void tp_object_cancel( struct threadpool_object *object )
     LONG pending_callbacks = 0;
 
     enter_critical_section( &pool->cs );
-    if (object->num_pending_callbacks)
+    if ((pending_callbacks = interlocked_xchg( &object->num_pending_callbacks, 0 )))
     {
-        pending_callbacks = object->num_pending_callbacks;
-        object->num_pending_callbacks = 0;
         list_remove( &object->pool_entry );
 
         if (object->type == TP_OBJECT_TYPE_WAIT)
@@ -2102,11 +2269,40 @@ static BOOL tp_object_release( struct threadpool_object *object )
     return TRUE;
 }
 
-static struct list *threadpool_get_next_item( const struct threadpool *pool )
+/* moves the simple callbacks posted without lock to the pool, called with .cs held */
+static void threadpool_flush_simple_items( struct threadpool *pool )
+{
+    struct threadpool_object *object;
+    struct list items = LIST_INIT( items );
+    SLIST_ENTRY *entry;
+    int i, count = 0;
+
+    if (!(entry = RtlInterlockedFlushSList( &pool->simple_items )))
+        return;
+
+    /* The list is in reverse order of submission. The objects keep the
+     * pool alive from now on like all other queued objects. */
+    for (; entry; entry = entry->Next)
+    {
+        object = CONTAINING_RECORD( entry, struct threadpool_object, u.simple.entry );
+        list_add_head( &items, &object->pool_entry );
+        pool->objcount++;
+        count++;
+    }
+    list_move_tail( &pool->pools[TP_CALLBACK_PRIORITY_NORMAL], &items );
+
+    /* Only the first item woke up a worker. */
+    for (i = 1; i < count && i < pool->num_workers - pool->num_busy_workers; i++)
+        RtlWakeConditionVariable( &pool->update_event );
+}
+
+static struct list *threadpool_get_next_item( struct threadpool *pool )
 {
     struct list *ptr;
     unsigned int i;
 
+    threadpool_flush_simple_items( pool );
+
     for (i = 0; i < ARRAY_SIZE(pool->pools); ++i)
     {
         if ((ptr = list_head( &pool->pools[i] )))
@@ -2125,6 +2321,7 @@ static void CALLBACK threadpool_worker_proc( void *param )
     struct threadpool_instance instance;
     struct threadpool *pool = param;
     TP_WAIT_RESULT wait_result = 0;
+    ULONGLONG start_time = 0;
     LARGE_INTEGER timeout;
     struct list *ptr;
     NTSTATUS status;
@@ -2133,6 +2330,7 @@ static void CALLBACK threadpool_worker_proc( void *param )
 
     enter_critical_section( &pool->cs );
     pool->num_busy_workers--;
+    pool->num_starting_workers--;
     for (;;)
     {
         while ((ptr = threadpool_get_next_item( pool )))
@@ -2140,10 +2338,18 @@ static void CALLBACK threadpool_worker_proc( void *param )
             struct threadpool_object *object = LIST_ENTRY( ptr, struct threadpool_object, pool_entry );
             assert( object->num_pending_callbacks > 0 );
 
+            if (tp_stats_timing())
+            {
+                start_time = tp_stats_time();
+                if (object->queue_time)
+                    pool->stats_queue_latency[tp_stats_class( start_time - object->queue_time )]++;
+            }
+            else start_time = 0;
+
             /* If further pending callbacks are queued, move the work item to
              * the end of the pool list. Otherwise remove it from the pool. */
             list_remove( &object->pool_entry );
-            if (--object->num_pending_callbacks)
+            if (interlocked_dec( &object->num_pending_callbacks ))
                 tp_object_prio_queue( object );
 
             /* For wait objects check if they were signaled or have timed out. */
@@ -2157,6 +2363,13 @@ static void CALLBACK threadpool_worker_proc( void *param )
             object->num_associated_callbacks++;
             object->num_running_callbacks++;
             pool->num_busy_workers++;
+
+            /* Start another worker if there is still work left that no other
+             * thread can pick up, the callback might block. */
+            if (pool->num_busy_workers >= pool->num_workers && !pool->num_starting_workers &&
+                pool->num_workers < pool->max_workers && threadpool_get_next_item( pool ))
+                tp_new_worker_thread( pool );
+
             leave_critical_section( &pool->cs );
 
             /* Initialize threadpool instance struct. */
@@ -2253,6 +2466,11 @@ static void CALLBACK threadpool_worker_proc( void *param )
             enter_critical_section( &pool->cs );
             pool->num_busy_workers--;
 
+            if (start_time)
+                pool->stats_run_time[tp_stats_class( tp_stats_time() - start_time )]++;
+            if (stats_dump_due( interlocked_inc( &pool->stats_completed )) && TRACE_ON(tpstat))
+                tp_threadpool_dump_stats( pool );
+
             /* Simple callbacks are automatically shutdown after execution. */
             if (object->type == TP_OBJECT_TYPE_SIMPLE)
             {
@@ -2468,6 +2686,7 @@ NTSTATUS WINAPI TpCallbackMayRunLong( TP_CALLBACK_INSTANCE *instance )
         return STATUS_SUCCESS;
 
     pool = object->pool;
+    interlocked_inc( &pool->stats_may_run_long );
     enter_critical_section( &pool->cs );
 
     /* Start new worker threads if required. */
@@ -2938,6 +3157,11 @@ NTSTATUS WINAPI TpSimpleTryPost( PTP_SIMPLE_CALLBACK callback, PVOID userdata,
     if (!object)
         return STATUS_NO_MEMORY;
 
+    object->type = TP_OBJECT_TYPE_SIMPLE;
+    object->u.simple.callback = callback;
+    if (tp_object_post_simple( object, userdata, environment ))
+        return STATUS_SUCCESS;
+
     status = tp_threadpool_lock( &pool, environment );
     if (status)
     {
@@ -2945,8 +3169,6 @@ NTSTATUS WINAPI TpSimpleTryPost( PTP_SIMPLE_CALLBACK callback, PVOID userdata,
         return status;
     }
 
-    object->type = TP_OBJECT_TYPE_SIMPLE;
-    object->u.simple.callback = callback;
     tp_object_initialize( object, pool, userdata, environment );
 
     return STATUS_SUCCESS;
@@ -2993,3 +3215,60 @@ VOID WINAPI TpWaitForWork( TP_WORK *work, BOOL cancel_pending )
         tp_object_cancel( this );
     tp_object_wait( this, FALSE );
 }
+
+/***********************************************************************
+ *           wine_threadpool_get_statistics    (NTDLL.@)
+ *
+ * Retrieve the statistics of a thread pool, or of the default pool if
+ * pool is NULL, and optionally reset them. The latency and run time
+ * histograms are only filled after the first call.
+ */
+NTSTATUS CDECL wine_threadpool_get_statistics( TP_POOL *pool, TP_POOL_WINE_STATISTICS *stats, BOOL reset )
+{
+    struct threadpool *this = pool ? impl_from_TP_POOL( pool ) : default_threadpool;
+    struct list *ptr;
+    unsigned int i;
+
+    TRACE( "%p %p %u\n", pool, stats, reset );
+
+    if (!stats) return STATUS_INVALID_PARAMETER;
+
+    threadpool_timing = TRUE;
+    memset( stats, 0, sizeof(*stats) );
+    if (!this) return STATUS_SUCCESS;
+
+    enter_critical_section( &this->cs );
+
+    stats->Workers        = this->num_workers;
+    stats->BusyWorkers    = this->num_busy_workers;
+    stats->MinWorkers     = this->min_workers;
+    stats->MaxWorkers     = this->max_workers;
+    stats->Submitted      = this->stats_submitted;
+    stats->Completed      = this->stats_completed;
+    stats->MayRunLong     = this->stats_may_run_long;
+    stats->ThreadsCreated = this->stats_threads_created;
+    for (i = 0; i < ARRAY_SIZE(this->pools); i++)
+    {
+        LIST_FOR_EACH( ptr, &this->pools[i] )
+        {
+            struct threadpool_object *object = LIST_ENTRY( ptr, struct threadpool_object, pool_entry );
+            stats->PendingCallbacks[i] += object->num_pending_callbacks;
+        }
+    }
+    stats->PendingCallbacks[TP_CALLBACK_PRIORITY_NORMAL] += RtlQueryDepthSList( &this->simple_items );
+    memcpy( stats->QueueLatency, this->stats_queue_latency, sizeof(stats->QueueLatency) );
+    memcpy( stats->RunTime, this->stats_run_time, sizeof(stats->RunTime) );
+
+    if (reset)
+    {
+        interlocked_xchg( &this->stats_submitted, 0 );
+        interlocked_xchg( &this->stats_completed, 0 );
+        interlocked_xchg( &this->stats_may_run_long, 0 );
+        interlocked_xchg( &this->stats_threads_created, 0 );
+        memset( this->stats_queue_latency, 0, sizeof(this->stats_queue_latency) );
+        memset( this->stats_run_time, 0, sizeof(this->stats_run_time) );
+    }
+
+    leave_critical_section( &this->cs );
+    return STATUS_SUCCESS;
+}
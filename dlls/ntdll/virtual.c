@@ -35,6 +35,12 @@
 #ifdef HAVE_SYS_SOCKET_H
 # include <sys/socket.h>
 #endif
+#ifdef HAVE_SYS_IOCTL_H
+# include <sys/ioctl.h>
+#endif
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
 #ifdef HAVE_SYS_STAT_H
 # include <sys/stat.h>
 #endif
@@ -87,6 +93,7 @@ struct file_view
 #define VPROT_WRITEWATCH 0x40
 /* per-mapping protection flags */
 #define VPROT_SYSTEM     0x0200  /* system view (underlying mmap not under our control) */
+#define VPROT_KERNEL_WRITEWATCH 0x0400  /* write watches are tracked by the kernel */
 
 /* Conversion from VPROT_* to Win32 flags */
 static const BYTE VIRTUAL_Win32Flags[16] =
@@ -120,6 +127,45 @@ static RTL_CRITICAL_SECTION_DEBUG critsect_debug =
 };
 static RTL_CRITICAL_SECTION csVirtual = { &critsect_debug, -1, 0, 0, 0, 0 };
 
+/* csVirtual serializes all changes to the view tree and the page protection
+ * bytes. While it is held, views_seq is odd, so that lookups can also run
+ * without the lock: they sample the sequence number, read what they need and
+ * start over if it has changed in the meantime. View structures and page
+ * protection tables are never unmapped, so a racing lookup can read stale
+ * data, but it can't fault. */
+static unsigned int views_seq;
+
+/* number of lock-free attempts before a lookup falls back to csVirtual */
+#define VIEWS_READ_RETRIES 4
+
+static inline void lock_virtual( sigset_t *sigset )
+{
+    if (sigset) server_enter_uninterrupted_section( &csVirtual, sigset );
+    else RtlEnterCriticalSection( &csVirtual );
+    if (csVirtual.RecursionCount == 1) interlocked_xchg_add( (int *)&views_seq, 1 );
+}
+
+static inline void unlock_virtual( sigset_t *sigset )
+{
+    if (csVirtual.RecursionCount == 1) interlocked_xchg_add( (int *)&views_seq, 1 );
+    if (sigset) server_leave_uninterrupted_section( &csVirtual, sigset );
+    else RtlLeaveCriticalSection( &csVirtual );
+}
+
+/* start a lock-free lookup, fails if csVirtual is held */
+static inline BOOL views_read_begin( unsigned int *seq )
+{
+    *seq = __atomic_load_n( &views_seq, __ATOMIC_ACQUIRE );
+    return !(*seq & 1);
+}
+
+/* check that nothing changed during a lock-free lookup */
+static inline BOOL views_read_end( unsigned int seq )
+{
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    return __atomic_load_n( &views_seq, __ATOMIC_RELAXED ) == seq;
+}
+
 #ifdef __i386__
 static const UINT page_shift = 12;
 static const UINT_PTR page_mask = 0xfff;
@@ -186,6 +232,12 @@ static void *preload_reserve_start;
 static void *preload_reserve_end;
 static BOOL use_locks;
 static BOOL force_exec_prot;  /* whether to force PROT_EXEC on all PROT_READ mmaps */
+static size_t huge_page_size;  /* size of the host huge pages, 0 if not supported */
+static UINT huge_page_shift;
+static BOOL use_huge_pages;    /* whether large views should use transparent huge pages */
+
+/* minimum size, in huge pages, of the views that use transparent huge pages */
+#define HUGE_PAGES_MIN_VIEW_SIZE 8
 
 #if defined(__i386__)
 NTSTATUS WINAPI NtProtectVirtualMemory( HANDLE process, PVOID *addr_ptr, SIZE_T *size_ptr,
@@ -416,20 +468,25 @@ static void VIRTUAL_Dump(void)
     struct file_view *view;
 
     TRACE( "Dump of all virtual memory views:\n" );
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
     WINE_RB_FOR_EACH_ENTRY( view, &views_tree, struct file_view, entry )
     {
         VIRTUAL_DumpView( view );
     }
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
 }
 #endif
 
 
+/* an rb tree can't be deeper than this, a longer walk means that a
+ * lock-free lookup raced with a rebalancing of the tree */
+#define MAX_VIEWS_TREE_DEPTH 128
+
 /***********************************************************************
  *           VIRTUAL_FindView
  *
- * Find the view containing a given address. The csVirtual section must be held by caller.
+ * Find the view containing a given address. The csVirtual section must be held by caller,
+ * or the result validated with views_read_end().
  *
  * PARAMS
  *      addr  [I] Address
@@ -441,10 +498,11 @@ static void VIRTUAL_Dump(void)
 static struct file_view *VIRTUAL_FindView( const void *addr, size_t size )
 {
     struct wine_rb_entry *ptr = views_tree.root;
+    unsigned int depth = 0;
 
     if ((const char *)addr + size < (const char *)addr) return NULL; /* overflow */
 
-    while (ptr)
+    while (ptr && depth++ < MAX_VIEWS_TREE_DEPTH)
     {
         struct file_view *view = WINE_RB_ENTRY_VALUE( ptr, struct file_view, entry );
 
@@ -502,12 +560,12 @@ static inline UINT_PTR get_zero_bits_64_mask( USHORT zero_bits_64 )
 
 
 /***********************************************************************
- *           is_write_watch_range
+ *           find_write_watch_view
  */
-static inline BOOL is_write_watch_range( const void *addr, size_t size )
+static inline struct file_view *find_write_watch_view( const void *addr, size_t size )
 {
     struct file_view *view = VIRTUAL_FindView( addr, size );
-    return view && (view->protect & VPROT_WRITEWATCH);
+    return view && (view->protect & VPROT_WRITEWATCH) ? view : NULL;
 }
 
 
@@ -1070,13 +1128,263 @@ static void update_write_watches( void *base, size_t size, size_t accessed_size
 }
 
 
+#if defined(__linux__) && defined(__NR_userfaultfd)
+
+/* userfaultfd and pagemap ioctl definitions, so that we don't depend on recent kernel headers */
+
+#define WW_UFFD_API                     0xaa
+#define WW_UFFD_USER_MODE_ONLY          1
+#define WW_UFFD_FEATURE_WP_UNPOPULATED  (1 << 13)
+#define WW_UFFD_FEATURE_WP_ASYNC        (1 << 15)
+#define WW_UFFDIO_REGISTER_MODE_WP      (1 << 1)
+#define WW_UFFDIO_WRITEPROTECT_MODE_WP  (1 << 0)
+#define WW_PM_SCAN_WP_MATCHING          (1 << 0)
+#define WW_PM_SCAN_CHECK_WPASYNC        (1 << 1)
+#define WW_PAGE_IS_WRITTEN              (1 << 1)
+
+struct uffd_range_args
+{
+    ULONG64 start;
+    ULONG64 len;
+};
+
+struct uffd_api_args
+{
+    ULONG64 api;
+    ULONG64 features;
+    ULONG64 ioctls;
+};
+
+struct uffd_register_args
+{
+    struct uffd_range_args range;
+    ULONG64 mode;
+    ULONG64 ioctls;
+};
+
+struct uffd_writeprotect_args
+{
+    struct uffd_range_args range;
+    ULONG64 mode;
+};
+
+struct pagemap_region
+{
+    ULONG64 start;
+    ULONG64 end;
+    ULONG64 categories;
+};
+
+struct pagemap_scan_args
+{
+    ULONG64 size;
+    ULONG64 flags;
+    ULONG64 start;
+    ULONG64 end;
+    ULONG64 walk_end;
+    ULONG64 vec;
+    ULONG64 vec_len;
+    ULONG64 max_pages;
+    ULONG64 category_inverted;
+    ULONG64 category_mask;
+    ULONG64 category_anyof_mask;
+    ULONG64 return_mask;
+};
+
+#define WW_UFFDIO_API          _IOWR( WW_UFFD_API, 0x3f, struct uffd_api_args )
+#define WW_UFFDIO_REGISTER     _IOWR( WW_UFFD_API, 0x00, struct uffd_register_args )
+#define WW_UFFDIO_WRITEPROTECT _IOWR( WW_UFFD_API, 0x06, struct uffd_writeprotect_args )
+#define WW_PAGEMAP_SCAN        _IOWR( 'f', 16, struct pagemap_scan_args )
+
+static int uffd_fd = -1;
+static int pagemap_fd = -1;
+
+/***********************************************************************
+ *           use_kernel_writewatch
+ *
+ * Check whether the kernel can track write watches for us, using
+ * asynchronous userfaultfd write protection and the PAGEMAP_SCAN ioctl.
+ * The csVirtual section must be held by caller.
+ */
+static BOOL use_kernel_writewatch(void)
+{
+    static const ULONG64 features = WW_UFFD_FEATURE_WP_ASYNC | WW_UFFD_FEATURE_WP_UNPOPULATED;
+    static BOOL checked;
+    struct uffd_api_args api;
+    struct pagemap_scan_args scan;
+    const char *env;
+    int fd;
+
+    if (checked) return pagemap_fd != -1;
+    checked = TRUE;
+
+    if ((env = getenv( "WINE_DISABLE_KERNEL_WRITEWATCH" )) && atoi( env )) return FALSE;
+
+    fd = syscall( __NR_userfaultfd, WW_UFFD_USER_MODE_ONLY | O_CLOEXEC | O_NONBLOCK );
+    if (fd == -1)
+    {
+        TRACE( "userfaultfd not available (%s)\n", strerror( errno ));
+        return FALSE;
+    }
+    memset( &api, 0, sizeof(api) );
+    api.api = WW_UFFD_API;
+    api.features = features;
+    if (ioctl( fd, WW_UFFDIO_API, &api ) || (api.features & features) != features)
+    {
+        TRACE( "asynchronous write protection not supported\n" );
+        close( fd );
+        return FALSE;
+    }
+    if ((pagemap_fd = open( "/proc/self/pagemap", O_RDONLY | O_CLOEXEC )) != -1)
+    {
+        /* an empty scan tells us whether the ioctl is supported at all */
+        memset( &scan, 0, sizeof(scan) );
+        scan.size = sizeof(scan);
+        if (ioctl( pagemap_fd, WW_PAGEMAP_SCAN, &scan ) == -1)
+        {
+            close( pagemap_fd );
+            pagemap_fd = -1;
+        }
+    }
+    if (pagemap_fd == -1)
+    {
+        TRACE( "PAGEMAP_SCAN not supported\n" );
+        close( fd );
+        return FALSE;
+    }
+    uffd_fd = fd;
+    TRACE( "using kernel write watches\n" );
+    return TRUE;
+}
+
+/***********************************************************************
+ *           kernel_writewatch_reset
+ *
+ * Write-protect a range so that the next write to each page gets recorded.
+ */
+static BOOL kernel_writewatch_reset( void *base, SIZE_T size )
+{
+    struct uffd_writeprotect_args wp;
+
+    wp.range.start = (ULONG_PTR)base;
+    wp.range.len = size;
+    wp.mode = WW_UFFDIO_WRITEPROTECT_MODE_WP;
+    if (!ioctl( uffd_fd, WW_UFFDIO_WRITEPROTECT, &wp )) return TRUE;
+    ERR( "failed to write-protect %p-%p: %s\n", base, (char *)base + size, strerror( errno ));
+    return FALSE;
+}
+
+/***********************************************************************
+ *           kernel_writewatch_register
+ *
+ * Register a freshly mapped range for kernel write tracking.
+ */
+static BOOL kernel_writewatch_register( void *base, SIZE_T size )
+{
+    struct uffd_register_args reg;
+
+    reg.range.start = (ULONG_PTR)base;
+    reg.range.len = size;
+    reg.mode = WW_UFFDIO_REGISTER_MODE_WP;
+    if (ioctl( uffd_fd, WW_UFFDIO_REGISTER, &reg ))
+    {
+        WARN( "failed to register %p-%p: %s\n", base, (char *)base + size, strerror( errno ));
+        return FALSE;
+    }
+#ifdef MADV_NOHUGEPAGE
+    /* a write to a huge page would mark all of its small pages as written */
+    madvise( base, size, MADV_NOHUGEPAGE );
+#endif
+    return kernel_writewatch_reset( base, size );
+}
+
+/***********************************************************************
+ *           kernel_writewatch_get
+ *
+ * Retrieve the written pages of a range with PAGEMAP_SCAN, optionally
+ * write-protecting them again in the same pass.
+ */
+static void kernel_writewatch_get( void *base, SIZE_T size, BOOL reset, void **addresses, ULONG_PTR *count )
+{
+    struct pagemap_region regions[64];
+    struct pagemap_scan_args scan;
+    ULONG_PTR pos = 0;
+    char *addr = base, *end = addr + size;
+    int i, ret;
+
+    while (pos < *count && addr < end)
+    {
+        memset( &scan, 0, sizeof(scan) );
+        scan.size = sizeof(scan);
+        scan.flags = reset ? WW_PM_SCAN_WP_MATCHING | WW_PM_SCAN_CHECK_WPASYNC : 0;
+        scan.start = (ULONG_PTR)addr;
+        scan.end = (ULONG_PTR)end;
+        scan.vec = (ULONG_PTR)regions;
+        scan.vec_len = ARRAY_SIZE( regions );
+        scan.max_pages = *count - pos;
+        scan.category_mask = WW_PAGE_IS_WRITTEN;
+        scan.return_mask = WW_PAGE_IS_WRITTEN;
+
+        if ((ret = ioctl( pagemap_fd, WW_PAGEMAP_SCAN, &scan )) == -1)
+        {
+            ERR( "PAGEMAP_SCAN failed for %p-%p: %s\n", addr, end, strerror( errno ));
+            break;
+        }
+        for (i = 0; i < ret; i++)
+        {
+            char *page = (char *)(ULONG_PTR)regions[i].start;
+            char *region_end = (char *)(ULONG_PTR)regions[i].end;
+
+            for ( ; page < region_end && pos < *count; page += page_size) addresses[pos++] = page;
+        }
+        if ((char *)(ULONG_PTR)scan.walk_end <= addr) break;
+        addr = (char *)(ULONG_PTR)scan.walk_end;
+    }
+    *count = pos;
+}
+
+#else  /* __linux__ && __NR_userfaultfd */
+
+static BOOL use_kernel_writewatch(void) { return FALSE; }
+static BOOL kernel_writewatch_register( void *base, SIZE_T size ) { return FALSE; }
+static BOOL kernel_writewatch_reset( void *base, SIZE_T size ) { return FALSE; }
+static void kernel_writewatch_get( void *base, SIZE_T size, BOOL reset, void **addresses, ULONG_PTR *count )
+{
+    *count = 0;
+}
+
+#endif  /* __linux__ && __NR_userfaultfd */
+
+
+/***********************************************************************
+ *           enable_kernel_writewatch
+ *
+ * Hand the write watches of a new view over to the kernel if possible;
+ * otherwise they keep being tracked through page faults.
+ * The csVirtual section must be held by caller.
+ */
+static void enable_kernel_writewatch( struct file_view *view )
+{
+    if (!use_kernel_writewatch()) return;
+    if (!kernel_writewatch_register( view->base, view->size )) return;
+    view->protect |= VPROT_KERNEL_WRITEWATCH;
+    set_page_vprot_bits( view->base, view->size, 0, VPROT_WRITEWATCH );
+    mprotect_range( view->base, view->size, 0, 0 );
+}
+
+
 /***********************************************************************
  *           reset_write_watches
  *
  * Reset write watches in a memory range.
  */
-static void reset_write_watches( void *base, SIZE_T size )
+static void reset_write_watches( struct file_view *view, void *base, SIZE_T size )
 {
+    if (view->protect & VPROT_KERNEL_WRITEWATCH)
+    {
+        kernel_writewatch_reset( base, size );
+        return;
+    }
     set_page_vprot_bits( base, size, VPROT_WRITEWATCH, 0 );
     mprotect_range( base, size, 0, 0 );
 }
@@ -1207,6 +1515,75 @@ static NTSTATUS map_fixed_area( void *base, size_t size, unsigned int vprot )
     return STATUS_SUCCESS;
 }
 
+/***********************************************************************
+ *           init_huge_pages
+ *
+ * Find out the huge page size of the host.
+ */
+static void init_huge_pages(void)
+{
+#ifdef __linux__
+    unsigned long size = 0;
+    const char *env;
+    char line[64];
+    FILE *f;
+
+    if ((f = fopen( "/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r" )))
+    {
+        if (fscanf( f, "%lu", &size ) != 1) size = 0;
+        fclose( f );
+    }
+    if (!size && (f = fopen( "/proc/meminfo", "r" )))
+    {
+        while (fgets( line, sizeof(line), f ))
+        {
+            if (sscanf( line, "Hugepagesize: %lu kB", &size ) != 1) continue;
+            size *= 1024;
+            break;
+        }
+        fclose( f );
+    }
+    /* views can't be aligned beyond 2Mb, cf. get_mask() */
+    if (size <= page_size || (size & (size - 1)) || size > (1 << 21)) return;
+
+    huge_page_size = size;
+    while (((size_t)1 << huge_page_shift) != huge_page_size) huge_page_shift++;
+    if ((env = getenv( "WINE_HUGEPAGES" )) && atoi( env )) use_huge_pages = TRUE;
+    TRACE( "huge page size %lx%s\n", size, use_huge_pages ? ", using transparent huge pages" : "" );
+#endif
+}
+
+
+/***********************************************************************
+ *           map_huge_pages
+ *
+ * Back a newly mapped range with huge pages, from the hugetlb pool if
+ * requested and possible, or else through transparent huge pages.
+ * The csVirtual section must be held by caller.
+ */
+static void map_huge_pages( void *base, size_t size, unsigned int vprot, BOOL hugetlb )
+{
+#ifdef MAP_HUGETLB
+    if (hugetlb)
+    {
+        int unix_prot = VIRTUAL_GetUnixProt( vprot );
+
+        if (mmap( base, size, unix_prot, MAP_PRIVATE | MAP_ANON | MAP_FIXED | MAP_HUGETLB, -1, 0 ) == base)
+        {
+            TRACE( "using hugetlb pages for %p-%p\n", base, (char *)base + size );
+            return;
+        }
+        /* the failed mmap may already have unmapped the range */
+        wine_anon_mmap( base, size, unix_prot, MAP_FIXED );
+    }
+#endif
+#ifdef MADV_HUGEPAGE
+    if (!madvise( base, size, MADV_HUGEPAGE ))
+        TRACE( "using transparent huge pages for %p-%p\n", base, (char *)base + size );
+#endif
+}
+
+
 /***********************************************************************
  *           map_view
  *
@@ -1395,6 +1772,9 @@ static NTSTATUS decommit_pages( struct file_view *view, size_t start, size_t siz
     if (wine_anon_mmap( (char *)view->base + start, size, PROT_NONE, MAP_FIXED ) != (void *)-1)
     {
         set_page_vprot_bits( (char *)view->base + start, size, 0, VPROT_COMMITTED );
+        /* the new mapping is no longer registered with the kernel */
+        if (view->protect & VPROT_KERNEL_WRITEWATCH)
+            kernel_writewatch_register( (char *)view->base + start, size );
         return STATUS_SUCCESS;
     }
     return FILE_GetNtStatus();
@@ -1494,6 +1874,27 @@ static NTSTATUS map_pe_header( void *ptr, size_t size, int fd, BOOL *removable )
 }
 
 
+/***********************************************************************
+ *           get_image_cache_file
+ *
+ * Get the file holding the shared, already laid out and relocated pages
+ * of an image mapped at the given address.
+ */
+static HANDLE get_image_cache_file( HANDLE mapping, void *base )
+{
+    HANDLE file = 0;
+
+    SERVER_START_REQ( get_image_cache )
+    {
+        req->mapping = wine_server_obj_handle( mapping );
+        req->base    = wine_server_client_ptr( base );
+        if (!wine_server_call( req )) file = wine_server_ptr_handle( reply->cache_file );
+    }
+    SERVER_END_REQ;
+    return file;
+}
+
+
 /***********************************************************************
  *           map_image
  *
@@ -1509,7 +1910,9 @@ static NTSTATUS map_image( HANDLE hmapping, ACCESS_MASK access, int fd, int top_
     IMAGE_DATA_DIRECTORY *imports;
     NTSTATUS status = STATUS_CONFLICTING_ADDRESSES;
     SIZE_T header_size, total_size = image_info->map_size;
-    int i;
+    HANDLE cache_file = 0;
+    BOOL use_cache, cache_needs_close = FALSE;
+    int i, cache_fd = -1;
     off_t pos;
     sigset_t sigset;
     struct stat st;
@@ -1526,7 +1929,7 @@ static NTSTATUS map_image( HANDLE hmapping, ACCESS_MASK access, int fd, int top_
 
     /* zero-map the whole range */
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
 
     if (base >= (char *)address_space_start)  /* make sure the DOS area remains free */
         status = map_view( &view, base, total_size, 0, top_down, SEC_IMAGE | SEC_FILE |
@@ -1599,6 +2002,32 @@ static NTSTATUS map_image( HANDLE hmapping, ACCESS_MASK access, int fd, int top_
     }
 
 
+    /* sections that can't be mmapped from the file and relocations would
+     * otherwise leave each process with private copies of the image pages */
+
+    use_cache = removable || (ptr != base && (nt->FileHeader.Characteristics & IMAGE_FILE_DLL));
+    for (i = 0; i < nt->FileHeader.NumberOfSections && !use_cache; i++)
+        if (sec[i].PointerToRawData && (sec[i].PointerToRawData & ~0x1ff & page_mask)) use_cache = TRUE;
+
+    if (use_cache && (cache_file = get_image_cache_file( hmapping, ptr )))
+    {
+        if (!server_get_unix_fd( cache_file, FILE_READ_DATA, &cache_fd, &cache_needs_close, NULL, NULL ) &&
+            map_file_into_view( view, cache_fd, 0, total_size, 0,
+                                VPROT_COMMITTED | VPROT_READ | VPROT_WRITECOPY, FALSE ) == STATUS_SUCCESS)
+        {
+            TRACE_(module)( "mapped image pages from the shared cache\n" );
+        }
+        else
+        {
+            if (cache_needs_close) close( cache_fd );
+            cache_fd = -1;
+            cache_needs_close = FALSE;
+            /* the header was replaced by the failed mapping attempt */
+            if (map_pe_header( view->base, header_size, fd, &removable )) goto error;
+            memset( ptr + header_size, 0, header_end - (ptr + header_size) );
+        }
+    }
+
     /* map all the sections */
 
     for (i = pos = 0; i < nt->FileHeader.NumberOfSections; i++, sec++)
@@ -1655,6 +2084,8 @@ static NTSTATUS map_image( HANDLE hmapping, ACCESS_MASK access, int fd, int top_
             continue;
         }
 
+        if (cache_fd != -1) continue;  /* already mapped from the cache */
+
         TRACE_(module)( "mapping section %.8s at %p off %x size %x virt %x flags %x\n",
                         sec->Name, ptr + sec->VirtualAddress,
                         sec->PointerToRawData, sec->SizeOfRawData,
@@ -1731,8 +2162,14 @@ static NTSTATUS map_image( HANDLE hmapping, ACCESS_MASK access, int fd, int top_
     SERVER_END_REQ;
     if (status) goto error;
 
+    if (use_huge_pages && total_size >= HUGE_PAGES_MIN_VIEW_SIZE * huge_page_size)
+        map_huge_pages( view->base, view->size, 0, FALSE );
+
     VIRTUAL_DEBUG_DUMP_VIEW( view );
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
+
+    if (cache_needs_close) close( cache_fd );
+    if (cache_file) close_handle( cache_file );
 
     *addr_ptr = ptr;
 #ifdef VALGRIND_LOAD_PDB_DEBUGINFO
@@ -1743,7 +2180,9 @@ static NTSTATUS map_image( HANDLE hmapping, ACCESS_MASK access, int fd, int top_
 
  error:
     if (view) delete_view( view );
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
+    if (cache_needs_close) close( cache_fd );
+    if (cache_file) close_handle( cache_file );
     return status;
 }
 
@@ -1855,7 +2294,7 @@ NTSTATUS virtual_map_section( HANDLE handle, PVOID *addr_ptr, unsigned short zer
 
     /* Reserve a properly aligned area */
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
 
     get_vprot_flags( protect, &vprot, sec_flags & SEC_IMAGE );
     vprot |= sec_flags;
@@ -1863,7 +2302,7 @@ NTSTATUS virtual_map_section( HANDLE handle, PVOID *addr_ptr, unsigned short zer
     res = map_view( &view, *addr_ptr, size, 0, alloc_type & MEM_TOP_DOWN, vprot, zero_bits_64 );
     if (res)
     {
-        server_leave_uninterrupted_section( &csVirtual, &sigset );
+        unlock_virtual( &sigset );
         goto done;
     }
 
@@ -1898,7 +2337,7 @@ NTSTATUS virtual_map_section( HANDLE handle, PVOID *addr_ptr, unsigned short zer
         delete_view( view );
     }
 
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
 
 done:
     if (needs_close) close( unix_handle );
@@ -1988,6 +2427,17 @@ void virtual_init(void)
     size = (char *)address_space_start - (char *)0x10000;
     if (size && wine_mmap_is_in_reserved_area( (void*)0x10000, size ) == 1)
         wine_anon_mmap( (void *)0x10000, size, PROT_READ | PROT_WRITE, MAP_FIXED );
+
+    init_huge_pages();
+}
+
+
+/***********************************************************************
+ *           virtual_get_large_page_size
+ */
+SIZE_T virtual_get_large_page_size(void)
+{
+    return huge_page_size;
 }
 
 
@@ -2046,7 +2496,7 @@ NTSTATUS virtual_create_builtin_view( void *module )
 
     size = ROUND_SIZE( module, size );
     base = ROUND_ADDR( module, page_mask );
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
     status = create_view( &view, base, size, SEC_IMAGE | SEC_FILE | VPROT_SYSTEM |
                           VPROT_COMMITTED | VPROT_READ | VPROT_WRITECOPY | VPROT_EXEC );
     if (!status)
@@ -2068,7 +2518,7 @@ NTSTATUS virtual_create_builtin_view( void *module )
         }
         VIRTUAL_DEBUG_DUMP_VIEW( view );
     }
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
     return status;
 }
 
@@ -2095,7 +2545,7 @@ NTSTATUS virtual_alloc_thread_stack( INITIAL_TEB *stack, SIZE_T reserve_size, SI
     size = (size + 0xffff) & ~0xffff;  /* round to 64K boundary */
     if (pthread_size) *pthread_size = extra_size = max( page_size, ROUND_SIZE( 0, *pthread_size ));
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
 
     if ((status = map_view( &view, NULL, size + extra_size, 0, FALSE,
                             VPROT_READ | VPROT_WRITE | VPROT_COMMITTED, 0 )) != STATUS_SUCCESS)
@@ -2138,7 +2588,7 @@ NTSTATUS virtual_alloc_thread_stack( INITIAL_TEB *stack, SIZE_T reserve_size, SI
     ((struct ntdll_thread_data *)&NtCurrentTeb()->GdiTebBatch)->pthread_stack = view->base;
 
 done:
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
     return status;
 }
 
@@ -2202,10 +2652,30 @@ NTSTATUS virtual_handle_fault( LPCVOID addr, DWORD err, BOOL on_signal_stack )
     NTSTATUS ret = STATUS_ACCESS_VIOLATION;
     void *page = ROUND_ADDR( addr, page_mask );
     BOOL update_shared_data = FALSE;
+    unsigned int i, seq;
     sigset_t sigset;
     BYTE vprot;
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    /* most faults don't change the page protections, so they can be
+     * handled without taking csVirtual */
+    for (i = 0; i < VIEWS_READ_RETRIES; i++)
+    {
+        if (!views_read_begin( &seq )) break;
+        vprot = get_page_vprot( page );
+        if (!on_signal_stack && (vprot & VPROT_GUARD)) break;
+        if (err & EXCEPTION_WRITE_FAULT)
+        {
+            if (vprot & (VPROT_WRITEWATCH | VPROT_WRITECOPY)) break;
+            /* ignore fault if page is writable now */
+            if (VIRTUAL_GetUnixProt( vprot ) & PROT_WRITE) ret = STATUS_SUCCESS;
+        }
+        else if (!err && (page == user_shared_data_external || (VIRTUAL_GetUnixProt( vprot ) & PROT_READ)))
+            break;
+        if (views_read_end( seq )) return ret;
+        ret = STATUS_ACCESS_VIOLATION;
+    }
+
+    lock_virtual( &sigset );
     vprot = get_page_vprot( page );
     if (!on_signal_stack && (vprot & VPROT_GUARD))
     {
@@ -2253,7 +2723,7 @@ NTSTATUS virtual_handle_fault( LPCVOID addr, DWORD err, BOOL on_signal_stack )
         else
             set_page_vprot_bits( page, page_size, 0, VPROT_READ | VPROT_EXEC );
     }
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
 
     if (update_shared_data)
         create_user_shared_data_thread();
@@ -2305,13 +2775,13 @@ unsigned int virtual_locked_server_call( void *req_ptr )
 
     if (!size) return wine_server_call( req_ptr );
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
     if (!(ret = check_write_access( addr, size, &has_write_watch )))
     {
         ret = server_call_unlocked( req );
         if (has_write_watch) update_write_watches( addr, size, wine_server_reply_size( req ));
     }
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
     return ret;
 }
 
@@ -2328,14 +2798,14 @@ ssize_t virtual_locked_read( int fd, void *addr, size_t size )
     ssize_t ret = read( fd, addr, size );
     if (ret != -1 || errno != EFAULT) return ret;
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
     if (!check_write_access( addr, size, &has_write_watch ))
     {
         ret = read( fd, addr, size );
         err = errno;
         if (has_write_watch) update_write_watches( addr, size, max( 0, ret ));
     }
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
     errno = err;
     return ret;
 }
@@ -2353,14 +2823,14 @@ ssize_t virtual_locked_pread( int fd, void *addr, size_t size, off_t offset )
     ssize_t ret = pread( fd, addr, size, offset );
     if (ret != -1 || errno != EFAULT) return ret;
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
     if (!check_write_access( addr, size, &has_write_watch ))
     {
         ret = pread( fd, addr, size, offset );
         err = errno;
         if (has_write_watch) update_write_watches( addr, size, max( 0, ret ));
     }
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
     errno = err;
     return ret;
 }
@@ -2379,7 +2849,7 @@ ssize_t CDECL __wine_locked_recvmsg( int fd, struct msghdr *hdr, int flags )
     ssize_t ret = recvmsg( fd, hdr, flags );
     if (ret != -1 || errno != EFAULT) return ret;
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
     for (i = 0; i < hdr->msg_iovlen; i++)
         if (check_write_access( hdr->msg_iov[i].iov_base, hdr->msg_iov[i].iov_len, &has_write_watch ))
             break;
@@ -2391,7 +2861,7 @@ ssize_t CDECL __wine_locked_recvmsg( int fd, struct msghdr *hdr, int flags )
     if (has_write_watch)
         while (i--) update_write_watches( hdr->msg_iov[i].iov_base, hdr->msg_iov[i].iov_len, 0 );
 
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
     errno = err;
     return ret;
 }
@@ -2403,13 +2873,23 @@ ssize_t CDECL __wine_locked_recvmsg( int fd, struct msghdr *hdr, int flags )
 BOOL virtual_is_valid_code_address( const void *addr, SIZE_T size )
 {
     struct file_view *view;
+    unsigned int i, seq;
     BOOL ret = FALSE;
     sigset_t sigset;
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    for (i = 0; i < VIEWS_READ_RETRIES; i++)
+    {
+        if (!views_read_begin( &seq )) break;
+        /* system views are not visible to the app */
+        ret = (view = VIRTUAL_FindView( addr, size )) && !(view->protect & VPROT_SYSTEM);
+        if (views_read_end( seq )) return ret;
+    }
+
+    ret = FALSE;
+    lock_virtual( &sigset );
     if ((view = VIRTUAL_FindView( addr, size )))
         ret = !(view->protect & VPROT_SYSTEM);  /* system views are not visible to the app */
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
     return ret;
 }
 
@@ -2428,7 +2908,7 @@ int virtual_handle_stack_fault( void *addr )
     if ((char *)addr < (char *)NtCurrentTeb()->DeallocationStack) return 0;
     if ((char *)addr >= (char *)NtCurrentTeb()->Tib.StackBase) return 0;
 
-    RtlEnterCriticalSection( &csVirtual );  /* no need for signal masking inside signal handler */
+    lock_virtual( NULL );  /* no need for signal masking inside signal handler */
     if (get_page_vprot( addr ) & VPROT_GUARD)
     {
         size_t guaranteed = max( NtCurrentTeb()->GuaranteedStackBytes, page_size * (is_win64 ? 2 : 1) );
@@ -2450,7 +2930,7 @@ int virtual_handle_stack_fault( void *addr )
         }
         NtCurrentTeb()->Tib.StackLimit = page;
     }
-    RtlLeaveCriticalSection( &csVirtual );
+    unlock_virtual( NULL );
     return ret;
 }
 
@@ -2537,7 +3017,7 @@ SIZE_T virtual_uninterrupted_read_memory( const void *addr, void *buffer, SIZE_T
 
     if (!size) return 0;
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
     if ((view = VIRTUAL_FindView( addr, size )))
     {
         if (!(view->protect & VPROT_SYSTEM))
@@ -2556,7 +3036,7 @@ SIZE_T virtual_uninterrupted_read_memory( const void *addr, void *buffer, SIZE_T
             }
         }
     }
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
     return bytes_read;
 }
 
@@ -2576,13 +3056,13 @@ NTSTATUS virtual_uninterrupted_write_memory( void *addr, const void *buffer, SIZ
 
     if (!size) return STATUS_SUCCESS;
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
     if (!(ret = check_write_access( addr, size, &has_write_watch )))
     {
         memcpy( addr, buffer, size );
         if (has_write_watch) update_write_watches( addr, size, size );
     }
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
     return ret;
 }
 
@@ -2597,7 +3077,7 @@ void VIRTUAL_SetForceExec( BOOL enable )
     struct file_view *view;
     sigset_t sigset;
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
     if (!force_exec_prot != !enable)  /* change all existing views */
     {
         force_exec_prot = enable;
@@ -2610,7 +3090,7 @@ void VIRTUAL_SetForceExec( BOOL enable )
             mprotect_range( view->base, view->size, commit, 0 );
         }
     }
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
 }
 
 struct free_range
@@ -2648,7 +3128,7 @@ void virtual_release_address_space(void)
 
     if (is_win64) return;
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
 
     range.base  = (char *)0x82000000;
     range.limit = user_space_limit;
@@ -2672,7 +3152,7 @@ void virtual_release_address_space(void)
         while (wine_mmap_enum_reserved_areas( free_reserved_memory, &range, 0 )) /* nothing */;
     }
 
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
 }
 
 
@@ -2787,15 +3267,30 @@ NTSTATUS virtual_alloc_aligned( PVOID *ret, unsigned short zero_bits_64, SIZE_T
     /* Compute the alloc type flags */
 
     if (!(type & (MEM_COMMIT | MEM_RESERVE | MEM_RESET)) ||
-        (type & ~(MEM_COMMIT | MEM_RESERVE | MEM_TOP_DOWN | MEM_WRITE_WATCH | MEM_RESET)))
+        (type & ~(MEM_COMMIT | MEM_RESERVE | MEM_TOP_DOWN | MEM_WRITE_WATCH | MEM_RESET | MEM_LARGE_PAGES)))
     {
         WARN("called with wrong alloc type flags (%08x) !\n", type);
         return STATUS_INVALID_PARAMETER;
     }
 
+    if (type & MEM_LARGE_PAGES)
+    {
+        /* large pages must be reserved and committed at once, in whole pages */
+        if (!huge_page_size || (type & (MEM_RESERVE | MEM_COMMIT)) != (MEM_RESERVE | MEM_COMMIT) ||
+            (type & MEM_WRITE_WATCH) || (((UINT_PTR)base | size) & (huge_page_size - 1)))
+        {
+            WARN("invalid large page allocation %p-%p type %08x\n", base, (char *)base + size, type);
+            return STATUS_INVALID_PARAMETER;
+        }
+        alignment = max( alignment, huge_page_shift );
+    }
+    else if (use_huge_pages && (type & MEM_RESERVE) && !(type & MEM_WRITE_WATCH) &&
+             size >= HUGE_PAGES_MIN_VIEW_SIZE * huge_page_size)
+        alignment = max( alignment, huge_page_shift );
+
     /* Reserve the memory */
 
-    if (use_locks) server_enter_uninterrupted_section( &csVirtual, &sigset );
+    if (use_locks) lock_virtual( &sigset );
 
     if ((type & MEM_RESERVE) || !base)
     {
@@ -2809,7 +3304,14 @@ NTSTATUS virtual_alloc_aligned( PVOID *ret, unsigned short zero_bits_64, SIZE_T
             else if (is_dos_memory) status = allocate_dos_memory( &view, vprot );
             else status = map_view( &view, base, size, alignment, type & MEM_TOP_DOWN, vprot, zero_bits_64 );
 
-            if (status == STATUS_SUCCESS) base = view->base;
+            if (status == STATUS_SUCCESS)
+            {
+                if (vprot & VPROT_WRITEWATCH) enable_kernel_writewatch( view );
+                else if (type & MEM_LARGE_PAGES) map_huge_pages( view->base, view->size, vprot, TRUE );
+                else if (use_huge_pages && size >= HUGE_PAGES_MIN_VIEW_SIZE * huge_page_size)
+                    map_huge_pages( view->base, view->size, vprot, FALSE );
+                base = view->base;
+            }
         }
     }
     else if (type & MEM_RESET)
@@ -2836,7 +3338,7 @@ NTSTATUS virtual_alloc_aligned( PVOID *ret, unsigned short zero_bits_64, SIZE_T
 
     if (!status) VIRTUAL_DEBUG_DUMP_VIEW( view );
 
-    if (use_locks) server_leave_uninterrupted_section( &csVirtual, &sigset );
+    if (use_locks) unlock_virtual( &sigset );
 
     if (status == STATUS_SUCCESS)
     {
@@ -2892,7 +3394,7 @@ NTSTATUS WINAPI NtFreeVirtualMemory( HANDLE process, PVOID *addr_ptr, SIZE_T *si
     /* avoid freeing the DOS area when a broken app passes a NULL pointer */
     if (!base) return STATUS_INVALID_PARAMETER;
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
 
     if (!(view = VIRTUAL_FindView( base, size )) || !is_view_valloc( view ))
     {
@@ -2935,7 +3437,7 @@ NTSTATUS WINAPI NtFreeVirtualMemory( HANDLE process, PVOID *addr_ptr, SIZE_T *si
         status = STATUS_INVALID_PARAMETER;
     }
 
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
     return status;
 }
 
@@ -2989,7 +3491,7 @@ NTSTATUS WINAPI NtProtectVirtualMemory( HANDLE process, PVOID *addr_ptr, SIZE_T
     size = ROUND_SIZE( addr, size );
     base = ROUND_ADDR( addr, page_mask );
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
 
     if ((view = VIRTUAL_FindView( base, size )))
     {
@@ -3005,7 +3507,7 @@ NTSTATUS WINAPI NtProtectVirtualMemory( HANDLE process, PVOID *addr_ptr, SIZE_T
 
     if (!status) VIRTUAL_DEBUG_DUMP_VIEW( view );
 
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
 
     if (status == STATUS_SUCCESS)
     {
@@ -3054,58 +3556,23 @@ static int get_free_mem_state_callback( void *start, size_t size, void *arg )
 }
 
 
-/* get basic information about a memory block */
-static NTSTATUS get_basic_memory_info( HANDLE process, LPCVOID addr,
-                                       MEMORY_BASIC_INFORMATION *info,
-                                       SIZE_T len, SIZE_T *res_len )
+/* fill the basic information about a memory block, see get_basic_memory_info.
+ * Without csVirtual, this fails for free areas, for views that need a server
+ * call and for lookups that raced with a rebalancing of the tree; otherwise
+ * the result must be validated with views_read_end(). */
+static BOOL fill_basic_memory_info( char *base, MEMORY_BASIC_INFORMATION *info, BOOL locked )
 {
     struct file_view *view;
-    char *base, *alloc_base = 0, *alloc_end = working_set_limit;
+    char *alloc_base = 0, *alloc_end = working_set_limit;
     struct wine_rb_entry *ptr;
-    sigset_t sigset;
-
-    if (len < sizeof(MEMORY_BASIC_INFORMATION))
-        return STATUS_INFO_LENGTH_MISMATCH;
-
-    if (process != NtCurrentProcess())
-    {
-        NTSTATUS status;
-        apc_call_t call;
-        apc_result_t result;
-
-        memset( &call, 0, sizeof(call) );
-
-        call.virtual_query.type = APC_VIRTUAL_QUERY;
-        call.virtual_query.addr = wine_server_client_ptr( addr );
-        status = server_queue_process_apc( process, &call, &result );
-        if (status != STATUS_SUCCESS) return status;
-
-        if (result.virtual_query.status == STATUS_SUCCESS)
-        {
-            info->BaseAddress       = wine_server_get_ptr( result.virtual_query.base );
-            info->AllocationBase    = wine_server_get_ptr( result.virtual_query.alloc_base );
-            info->RegionSize        = result.virtual_query.size;
-            info->Protect           = result.virtual_query.prot;
-            info->AllocationProtect = result.virtual_query.alloc_prot;
-            info->State             = (DWORD)result.virtual_query.state << 12;
-            info->Type              = (DWORD)result.virtual_query.alloc_type << 16;
-            if (info->RegionSize != result.virtual_query.size)  /* truncated */
-                return STATUS_INVALID_PARAMETER;  /* FIXME */
-            if (res_len) *res_len = sizeof(*info);
-        }
-        return result.virtual_query.status;
-    }
-
-    base = ROUND_ADDR( addr, page_mask );
-
-    if (is_beyond_limit( base, 1, working_set_limit )) return STATUS_INVALID_PARAMETER;
+    unsigned int depth = 0;
 
     /* Find the view containing the address */
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
     ptr = views_tree.root;
     while (ptr)
     {
+        if (depth++ >= MAX_VIEWS_TREE_DEPTH) return FALSE;
         view = WINE_RB_ENTRY_VALUE( ptr, struct file_view, entry );
         if ((char *)view->base > base)
         {
@@ -3125,6 +3592,14 @@ static NTSTATUS get_basic_memory_info( HANDLE process, LPCVOID addr,
         }
     }
 
+    if (!locked)
+    {
+        /* the reserved areas list is only protected by csVirtual */
+        if (!ptr) return FALSE;
+        /* get_committed_size() needs a server call for those */
+        if (view->protect & SEC_RESERVE) return FALSE;
+    }
+
     /* Fill the info structure */
 
     info->AllocationBase = alloc_base;
@@ -3171,8 +3646,66 @@ static NTSTATUS get_basic_memory_info( HANDLE process, LPCVOID addr,
             if ((get_page_vprot( ptr ) ^ vprot) & ~VPROT_WRITEWATCH) break;
         info->RegionSize = ptr - base;
     }
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    return TRUE;
+}
+
+/* get basic information about a memory block */
+static NTSTATUS get_basic_memory_info( HANDLE process, LPCVOID addr,
+                                       MEMORY_BASIC_INFORMATION *info,
+                                       SIZE_T len, SIZE_T *res_len )
+{
+    unsigned int i, seq;
+    sigset_t sigset;
+    char *base;
+
+    if (len < sizeof(MEMORY_BASIC_INFORMATION))
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    if (process != NtCurrentProcess())
+    {
+        NTSTATUS status;
+        apc_call_t call;
+        apc_result_t result;
+
+        memset( &call, 0, sizeof(call) );
+
+        call.virtual_query.type = APC_VIRTUAL_QUERY;
+        call.virtual_query.addr = wine_server_client_ptr( addr );
+        status = server_queue_process_apc( process, &call, &result );
+        if (status != STATUS_SUCCESS) return status;
+
+        if (result.virtual_query.status == STATUS_SUCCESS)
+        {
+            info->BaseAddress       = wine_server_get_ptr( result.virtual_query.base );
+            info->AllocationBase    = wine_server_get_ptr( result.virtual_query.alloc_base );
+            info->RegionSize        = result.virtual_query.size;
+            info->Protect           = result.virtual_query.prot;
+            info->AllocationProtect = result.virtual_query.alloc_prot;
+            info->State             = (DWORD)result.virtual_query.state << 12;
+            info->Type              = (DWORD)result.virtual_query.alloc_type << 16;
+            if (info->RegionSize != result.virtual_query.size)  /* truncated */
+                return STATUS_INVALID_PARAMETER;  /* FIXME */
+            if (res_len) *res_len = sizeof(*info);
+        }
+        return result.virtual_query.status;
+    }
+
+    base = ROUND_ADDR( addr, page_mask );
+
+    if (is_beyond_limit( base, 1, working_set_limit )) return STATUS_INVALID_PARAMETER;
+
+    for (i = 0; i < VIEWS_READ_RETRIES; i++)
+    {
+        if (!views_read_begin( &seq )) break;
+        if (!fill_basic_memory_info( base, info, FALSE )) break;
+        if (views_read_end( seq )) goto done;
+    }
 
+    lock_virtual( &sigset );
+    fill_basic_memory_info( base, info, TRUE );
+    unlock_virtual( &sigset );
+
+done:
     if (res_len) *res_len = sizeof(*info);
     return STATUS_SUCCESS;
 }
@@ -3574,7 +4107,7 @@ NTSTATUS virtual_map_shared_memory( int fd, PVOID *addr_ptr, ULONG zero_bits,
     if (size < *size_ptr)
         return STATUS_INVALID_PARAMETER;
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
 
     get_vprot_flags( protect, &vprot, FALSE );
     vprot |= VPROT_COMMITTED;
@@ -3603,7 +4136,7 @@ NTSTATUS virtual_map_shared_memory( int fd, PVOID *addr_ptr, ULONG zero_bits,
         }
     }
 
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
     return res;
 }
 
@@ -3632,7 +4165,7 @@ NTSTATUS WINAPI NtUnmapViewOfSection( HANDLE process, PVOID addr )
         return status;
     }
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
     if ((view = VIRTUAL_FindView( addr, 0 )) && !is_view_valloc( view ))
     {
         if (!(view->protect & VPROT_SYSTEM))
@@ -3652,7 +4185,7 @@ NTSTATUS WINAPI NtUnmapViewOfSection( HANDLE process, PVOID addr )
             status = STATUS_SUCCESS;
         }
     }
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
     return status;
 }
 
@@ -3777,7 +4310,7 @@ NTSTATUS WINAPI NtFlushVirtualMemory( HANDLE process, LPCVOID *addr_ptr,
         return result.virtual_flush.status;
     }
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
     if (!(view = VIRTUAL_FindView( addr, *size_ptr ))) status = STATUS_INVALID_PARAMETER;
     else
     {
@@ -3787,7 +4320,7 @@ NTSTATUS WINAPI NtFlushVirtualMemory( HANDLE process, LPCVOID *addr_ptr,
         if (msync( addr, *size_ptr, MS_ASYNC )) status = STATUS_NOT_MAPPED_DATA;
 #endif
     }
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
     return status;
 }
 
@@ -3799,6 +4332,7 @@ NTSTATUS WINAPI NtFlushVirtualMemory( HANDLE process, LPCVOID *addr_ptr,
 NTSTATUS WINAPI NtGetWriteWatch( HANDLE process, ULONG flags, PVOID base, SIZE_T size, PVOID *addresses,
                                  ULONG_PTR *count, ULONG *granularity )
 {
+    struct file_view *view;
     NTSTATUS status = STATUS_SUCCESS;
     sigset_t sigset;
 
@@ -3814,9 +4348,15 @@ NTSTATUS WINAPI NtGetWriteWatch( HANDLE process, ULONG flags, PVOID base, SIZE_T
     TRACE( "%p %x %p-%p %p %lu\n", process, flags, base, (char *)base + size,
            addresses, *count );
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
 
-    if (is_write_watch_range( base, size ))
+    if (!(view = find_write_watch_view( base, size ))) status = STATUS_INVALID_PARAMETER;
+    else if (view->protect & VPROT_KERNEL_WRITEWATCH)
+    {
+        kernel_writewatch_get( base, size, flags & WRITE_WATCH_FLAG_RESET, addresses, count );
+        *granularity = page_size;
+    }
+    else
     {
         ULONG_PTR pos = 0;
         char *addr = base;
@@ -3827,13 +4367,12 @@ NTSTATUS WINAPI NtGetWriteWatch( HANDLE process, ULONG flags, PVOID base, SIZE_T
             if (!(get_page_vprot( addr ) & VPROT_WRITEWATCH)) addresses[pos++] = addr;
             addr += page_size;
         }
-        if (flags & WRITE_WATCH_FLAG_RESET) reset_write_watches( base, addr - (char *)base );
+        if (flags & WRITE_WATCH_FLAG_RESET) reset_write_watches( view, base, addr - (char *)base );
         *count = pos;
         *granularity = page_size;
     }
-    else status = STATUS_INVALID_PARAMETER;
 
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
     return status;
 }
 
@@ -3844,6 +4383,7 @@ NTSTATUS WINAPI NtGetWriteWatch( HANDLE process, ULONG flags, PVOID base, SIZE_T
  */
 NTSTATUS WINAPI NtResetWriteWatch( HANDLE process, PVOID base, SIZE_T size )
 {
+    struct file_view *view;
     NTSTATUS status = STATUS_SUCCESS;
     sigset_t sigset;
 
@@ -3854,14 +4394,14 @@ NTSTATUS WINAPI NtResetWriteWatch( HANDLE process, PVOID base, SIZE_T size )
 
     if (!size) return STATUS_INVALID_PARAMETER;
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
 
-    if (is_write_watch_range( base, size ))
-        reset_write_watches( base, size );
+    if ((view = find_write_watch_view( base, size )))
+        reset_write_watches( view, base, size );
     else
         status = STATUS_INVALID_PARAMETER;
 
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
     return status;
 }
 
@@ -3938,7 +4478,7 @@ NTSTATUS WINAPI NtAreMappedFilesTheSame(PVOID addr1, PVOID addr2)
 
     TRACE("%p %p\n", addr1, addr2);
 
-    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    lock_virtual( &sigset );
 
     view1 = VIRTUAL_FindView( addr1, 0 );
     view2 = VIRTUAL_FindView( addr2, 0 );
@@ -3962,6 +4502,6 @@ NTSTATUS WINAPI NtAreMappedFilesTheSame(PVOID addr1, PVOID addr2)
         SERVER_END_REQ;
     }
 
-    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    unlock_virtual( &sigset );
     return status;
 }
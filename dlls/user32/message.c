@@ -2780,14 +2780,15 @@ static int peek_message( MSG *msg, HWND hwnd, UINT first, UINT last, UINT flags,
     size_t buffer_size = 256;
     shmlocal_t *shm = wine_get_shmlocal();
 
-    /* From time to time we are forced to do a wineserver call in
-     * order to update last_msg_time stored for each server thread. */
-    if (shm && GetTickCount() - thread_info->last_get_msg < 500)
+    /* The server only needs to be called if the queue bits say that there may
+     * be a message. The time of the check is stored for the server hung check. */
+    if (shm)
     {
         int filter = flags >> 16;
         if (!filter) filter = QS_ALLINPUT;
         filter |= QS_SENDMESSAGE;
         if (filter & QS_INPUT) filter |= QS_INPUT;
+        shm->last_get_msg = GetTickCount();
         if (!(shm->queue_bits & filter)) return FALSE;
     }
 
@@ -2804,8 +2805,6 @@ static int peek_message( MSG *msg, HWND hwnd, UINT first, UINT last, UINT flags,
 
         thread_info->msg_source = prev_source;
 
-        if (shm) thread_info->last_get_msg = GetTickCount();
-
         SERVER_START_REQ( get_message )
         {
             req->flags     = flags;
@@ -50,6 +50,7 @@ struct __server_request_info
 };
 
 extern unsigned int CDECL wine_server_call( void *req_ptr );
+extern unsigned int CDECL wine_server_call_batch( struct __server_request_info *reqs, unsigned int count );
 extern void CDECL wine_server_send_fd( int fd );
 extern int CDECL wine_server_fd_to_handle( int fd, unsigned int access, unsigned int attributes, HANDLE *handle );
 extern int CDECL wine_server_handle_to_fd( HANDLE handle, unsigned int access, int *unix_fd, unsigned int *options );
@@ -150,5 +151,13 @@ static inline shmlocal_t *wine_get_shmlocal(void)
         while(0); \
     } while(0)
 
+/* initialize a request to be sent with wine_server_call_batch */
+#define SERVER_INIT_REQ(info,type) \
+    do { \
+        memset( &(info)->u.req, 0, sizeof((info)->u.req) ); \
+        (info)->u.req.request_header.req = REQ_##type; \
+        (info)->data_count = 0; \
+    } while(0)
+
 
 #endif  /* __WINE_WINE_SERVER_H */
@@ -1282,6 +1282,54 @@ typedef struct _RTL_HEAP_DEFINITION {
     ULONG Unknown[11];
 } RTL_HEAP_DEFINITION, *PRTL_HEAP_DEFINITION;
 
+#ifdef __WINESRC__
+
+/* Wine specific heap information class for RtlQueryHeapInformation */
+#define HeapWineStatistics  ((HEAP_INFORMATION_CLASS)0x1000)
+
+/* block sizes are split in classes of powers of two, from < 32 bytes upwards */
+#define HEAP_WINE_STATS_CLASSES  20
+
+typedef struct _HEAP_WINE_STATISTICS {
+    SIZE_T    ReservedSize;        /* reserved bytes, including large blocks */
+    SIZE_T    CommittedSize;       /* committed bytes, including large blocks */
+    SIZE_T    FreeSize;            /* bytes in free blocks */
+    SIZE_T    CachedSize;          /* bytes in blocks cached by the low-fragmentation front-end */
+    SIZE_T    LargeSize;           /* bytes in large blocks */
+    ULONG     FreeBlocks;          /* number of free blocks */
+    ULONG     CachedBlocks;        /* number of blocks cached by the low-fragmentation front-end */
+    ULONG     LargeBlocks;         /* number of large blocks */
+    ULONG     SubHeaps;            /* number of sub-heaps */
+    ULONGLONG LockAcquisitions;    /* number of heap lock acquisitions */
+    ULONGLONG LockContentions;     /* number of acquisitions that had to wait */
+    ULONG     FreeBlocksBySize[HEAP_WINE_STATS_CLASSES];  /* free blocks per size class */
+    ULONGLONG AllocationsBySize[HEAP_WINE_STATS_CLASSES]; /* allocation requests per size class */
+} HEAP_WINE_STATISTICS, *PHEAP_WINE_STATISTICS;
+
+#endif /* __WINESRC__ */
+
+#ifdef __WINESRC__
+
+/* Wine specific thread pool statistics, see wine_threadpool_get_statistics */
+/* times are split in classes of powers of two, from < 1 microsecond upwards */
+#define TP_WINE_STATS_CLASSES  24
+
+typedef struct _TP_POOL_WINE_STATISTICS {
+    ULONG     Workers;             /* number of worker threads */
+    ULONG     BusyWorkers;         /* number of workers running a callback */
+    ULONG     MinWorkers;          /* minimum number of workers */
+    ULONG     MaxWorkers;          /* maximum number of workers */
+    ULONG     PendingCallbacks[3]; /* queued callbacks, per priority: high, normal, low */
+    ULONG     Submitted;           /* callbacks submitted */
+    ULONG     Completed;           /* callbacks completed */
+    ULONG     MayRunLong;          /* callbacks marked as long running with TpCallbackMayRunLong */
+    ULONG     ThreadsCreated;      /* worker threads created */
+    ULONG     QueueLatency[TP_WINE_STATS_CLASSES]; /* time from queueing to the start of the callback */
+    ULONG     RunTime[TP_WINE_STATS_CLASSES];      /* callback run time */
+} TP_POOL_WINE_STATISTICS, *PTP_POOL_WINE_STATISTICS;
+
+#endif /* __WINESRC__ */
+
 typedef struct _RTL_RWLOCK {
     RTL_CRITICAL_SECTION rtlCS;
 
@@ -3016,6 +3064,9 @@ NTSYSAPI void      WINAPI TpWaitForWork(TP_WORK *,BOOL);
 NTSYSAPI NTSTATUS CDECL wine_nt_to_unix_file_name( const UNICODE_STRING *nameW, ANSI_STRING *unix_name_ret,
                                                    UINT disposition, BOOLEAN check_case );
 NTSYSAPI NTSTATUS CDECL wine_unix_to_nt_file_name( const ANSI_STRING *name, UNICODE_STRING *nt );
+#ifdef __WINESRC__
+NTSYSAPI NTSTATUS CDECL wine_threadpool_get_statistics( TP_POOL *pool, TP_POOL_WINE_STATISTICS *stats, BOOL reset );
+#endif
 
 
 /***********************************************************************
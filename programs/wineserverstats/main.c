@@ -0,0 +1,152 @@
+/*
+ * Dump the request statistics of the running wineserver
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "config.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ntstatus.h"
+#define WIN32_NO_STATUS
+#include "windef.h"
+#include "winbase.h"
+#include "winternl.h"
+#include "wine/server.h"
+
+static struct request_stats *get_request_stats( int reset, unsigned int *count, timeout_t *start_time )
+{
+    struct request_stats *stats;
+    unsigned int size = 128;
+    NTSTATUS status;
+
+    for (;;)
+    {
+        if (!(stats = malloc( size * sizeof(*stats) ))) return NULL;
+        SERVER_START_REQ( get_server_stats )
+        {
+            req->reset = reset;
+            wine_server_set_reply( req, stats, size * sizeof(*stats) );
+            status = wine_server_call( req );
+            *count = reply->count;
+            *start_time = reply->start_time;
+        }
+        SERVER_END_REQ;
+        if (status != STATUS_BUFFER_TOO_SMALL) break;
+        free( stats );
+        size = *count;
+    }
+    if (!status) return stats;
+    free( stats );
+    return NULL;
+}
+
+static struct process_request_stats *get_process_stats( unsigned int *count )
+{
+    struct process_request_stats *stats;
+    unsigned int size = 64;
+    NTSTATUS status;
+
+    for (;;)
+    {
+        if (!(stats = malloc( size * sizeof(*stats) ))) return NULL;
+        SERVER_START_REQ( get_server_process_stats )
+        {
+            wine_server_set_reply( req, stats, size * sizeof(*stats) );
+            status = wine_server_call( req );
+            *count = reply->count;
+        }
+        SERVER_END_REQ;
+        if (status != STATUS_BUFFER_TOO_SMALL) break;
+        free( stats );
+        size = *count;
+    }
+    if (!status) return stats;
+    free( stats );
+    return NULL;
+}
+
+/* sort requests by decreasing total time */
+static int compare_request_stats( const void *p1, const void *p2 )
+{
+    const struct request_stats *s1 = p1, *s2 = p2;
+
+    if (s1->time != s2->time) return s1->time < s2->time ? 1 : -1;
+    return strcmp( s1->name, s2->name );
+}
+
+static void usage(void)
+{
+    printf( "Usage: wineserverstats [-r]\n\n" );
+    printf( "Dump the request statistics of the wineserver.\n\n" );
+    printf( "  -r  Reset the statistics after dumping them\n" );
+}
+
+int __cdecl main( int argc, char *argv[] )
+{
+    struct request_stats *stats;
+    struct process_request_stats *procs;
+    unsigned int i, j, count, proc_count;
+    timeout_t start_time;
+    LARGE_INTEGER now;
+    double elapsed;
+    int reset = 0;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp( argv[i], "-r" ) || !strcmp( argv[i], "/r" )) reset = 1;
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    /* get the process counters first, they are reset along with the request ones */
+    if (!(procs = get_process_stats( &proc_count )) ||
+        !(stats = get_request_stats( reset, &count, &start_time )))
+    {
+        fprintf( stderr, "wineserverstats: failed to retrieve the server statistics\n" );
+        return 1;
+    }
+    NtQuerySystemTime( &now );
+    elapsed = (now.QuadPart - start_time) / 10000000.0;
+
+    qsort( stats, count, sizeof(*stats), compare_request_stats );
+
+    printf( "Statistics over %.1f seconds\n\n", elapsed );
+    printf( "%-36s %10s %10s %8s  latency histogram (<1us, <2us, <4us, ..., >=16ms)\n",
+            "request", "calls", "total ms", "avg us" );
+    for (i = 0; i < count; i++)
+    {
+        printf( "%-36s %10u %10.1f %8.2f ", stats[i].name, stats[i].count,
+                stats[i].time / 1000000.0, stats[i].time / 1000.0 / stats[i].count );
+        for (j = 0; j < REQUEST_LATENCY_BUCKETS; j++) printf( " %u", stats[i].latency[j] );
+        printf( "\n" );
+    }
+
+    printf( "\n%-8s %10s %10s\n", "pid", "requests", "per sec" );
+    for (i = 0; i < proc_count; i++)
+        printf( "%08x %10u %10.1f\n", procs[i].pid, procs[i].count,
+                elapsed > 0 ? procs[i].count / elapsed : 0.0 );
+
+    free( stats );
+    free( procs );
+    return 0;
+}
@@ -89,6 +89,7 @@
 #include <sys/sysmacros.h>
 #endif
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #ifdef HAVE_SYS_SYSCALL_H
 #include <sys/syscall.h>
@@ -160,6 +161,12 @@ static inline int epoll_wait( int epfd, struct epoll_event *events, int maxevent
 # define USE_EVENT_PORTS
 #endif /* HAVE_PORT_H && HAVE_PORT_CREATE */
 
+#if defined(USE_EPOLL) && defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_SYS_MMAN_H) && defined(__NR_io_uring_setup)
+# include <linux/io_uring.h>
+# include <sys/mman.h>
+# define USE_IO_URING
+#endif
+
 /* Because of the stupid Posix locking semantics, we need to keep
  * track of all file descriptors referencing a given file, and not
  * close a single one until all the locks are gone (sigh).
@@ -383,13 +390,19 @@ static file_pos_t max_unix_offset = OFF_T_MAX;
 
 struct timeout_user
 {
-    struct list           entry;      /* entry in sorted timeout list */
+    struct list           entry;      /* entry in expired timeouts list */
+    int                   index;      /* index in the timeout heap, -1 once expired */
+    unsigned int          seq;        /* insertion sequence number */
     timeout_t             when;       /* timeout expiry (absolute time) */
     timeout_callback      callback;   /* callback function */
     void                 *private;    /* callback private data */
 };
 
-static struct list timeout_list = LIST_INIT(timeout_list);   /* sorted timeouts list */
+static struct timeout_user **timeout_heap;  /* binary min-heap of pending timeouts */
+static int timeout_count;                   /* number of timeouts in the heap */
+static int timeout_heap_size;               /* allocated size of the heap */
+static unsigned int timeout_seq;            /* sequence number of the last added timeout */
+static struct list expired_list = LIST_INIT(expired_list);  /* expired timeouts being processed */
 timeout_t current_time;
 
 static inline void set_current_time(void)
@@ -400,32 +413,101 @@ static inline void set_current_time(void)
     current_time = (timeout_t)now.tv_sec * TICKS_PER_SEC + now.tv_usec * 10 + ticks_1601_to_1970;
 }
 
+/* check if a timeout expires before another one; timeouts added later come first on ties */
+static inline int timeout_before( const struct timeout_user *a, const struct timeout_user *b )
+{
+    if (a->when != b->when) return a->when < b->when;
+    return (int)(a->seq - b->seq) > 0;
+}
+
+/* store a timeout at a given heap position */
+static inline void set_heap_timeout( int index, struct timeout_user *timeout )
+{
+    timeout_heap[index] = timeout;
+    timeout->index = index;
+}
+
+/* move a timeout up the heap until its parent expires before it */
+static void sift_up_timeout( int index )
+{
+    struct timeout_user *timeout = timeout_heap[index];
+
+    while (index)
+    {
+        int parent = (index - 1) / 2;
+        if (!timeout_before( timeout, timeout_heap[parent] )) break;
+        set_heap_timeout( index, timeout_heap[parent] );
+        index = parent;
+    }
+    set_heap_timeout( index, timeout );
+}
+
+/* move a timeout down the heap until its children expire after it */
+static void sift_down_timeout( int index )
+{
+    struct timeout_user *timeout = timeout_heap[index];
+
+    for (;;)
+    {
+        int child = 2 * index + 1;
+        if (child >= timeout_count) break;
+        if (child + 1 < timeout_count && timeout_before( timeout_heap[child + 1], timeout_heap[child] ))
+            child++;
+        if (!timeout_before( timeout_heap[child], timeout )) break;
+        set_heap_timeout( index, timeout_heap[child] );
+        index = child;
+    }
+    set_heap_timeout( index, timeout );
+}
+
+/* remove a timeout from the heap */
+static void remove_heap_timeout( struct timeout_user *timeout )
+{
+    int index = timeout->index;
+    struct timeout_user *last = timeout_heap[--timeout_count];
+
+    timeout->index = -1;
+    if (last == timeout) return;
+    set_heap_timeout( index, last );
+    if (index && timeout_before( last, timeout_heap[(index - 1) / 2] )) sift_up_timeout( index );
+    else sift_down_timeout( index );
+}
+
 /* add a timeout user */
 struct timeout_user *add_timeout_user( timeout_t when, timeout_callback func, void *private )
 {
     struct timeout_user *user;
-    struct list *ptr;
+
+    if (timeout_count == timeout_heap_size)
+    {
+        int new_size = max( 2 * timeout_heap_size, 64 );
+        struct timeout_user **new_heap;
+
+        if (!(new_heap = realloc( timeout_heap, new_size * sizeof(*new_heap) )))
+        {
+            set_error( STATUS_NO_MEMORY );
+            return NULL;
+        }
+        timeout_heap = new_heap;
+        timeout_heap_size = new_size;
+    }
 
     if (!(user = mem_alloc( sizeof(*user) ))) return NULL;
     user->when     = (when > 0) ? when : current_time - when;
+    user->seq      = ++timeout_seq;
     user->callback = func;
     user->private  = private;
 
-    /* Now insert it in the linked list */
-
-    LIST_FOR_EACH( ptr, &timeout_list )
-    {
-        struct timeout_user *timeout = LIST_ENTRY( ptr, struct timeout_user, entry );
-        if (timeout->when >= user->when) break;
-    }
-    list_add_before( ptr, &user->entry );
+    timeout_heap[timeout_count] = user;
+    sift_up_timeout( timeout_count++ );
     return user;
 }
 
 /* remove a timeout user */
 void remove_timeout_user( struct timeout_user *user )
 {
-    list_remove( &user->entry );
+    if (user->index != -1) remove_heap_timeout( user );
+    else list_remove( &user->entry );  /* expired but its callback hasn't been called yet */
     free( user );
 }
 
@@ -482,12 +564,408 @@ static inline void fd_poll_event( struct fd *fd, int event )
     fd->fd_ops->poll_event( fd, event );
 }
 
+/* read or write done by the server on behalf of an async request */
+struct fd_io
+{
+    struct list   entry;      /* entry in the list of pending I/O */
+    struct fd    *fd;         /* fd to use, keeps the unix fd open */
+    struct async *async;      /* async to complete */
+    struct iosb  *iosb;       /* I/O status block of the async */
+    void         *buffer;     /* buffer for the data read */
+    struct iovec  iov;        /* data to transfer */
+    int           write;      /* is it a write? */
+};
+
+/* store the result of an I/O in the iosb and notify the client; res is
+ * the number of bytes transferred or a negative errno */
+static void complete_fd_io( struct fd_io *io, int res )
+{
+    struct iosb *iosb = io->iosb;
+    unsigned int status, error;
+
+    list_remove( &io->entry );
+
+    if (iosb->status == STATUS_PENDING)  /* not cancelled in the meantime */
+    {
+        if (res < 0)
+        {
+            /* this may run in the middle of an unrelated request */
+            error = get_error();
+            errno = -res;
+            file_set_error();
+            status = get_error();
+            set_error( error );
+            res = 0;
+        }
+        else if (!res && io->iov.iov_len && !io->write) status = STATUS_END_OF_FILE;
+        else status = STATUS_SUCCESS;
+
+        iosb->status = status;
+        iosb->result = res;
+        if (!io->write)
+        {
+            iosb->out_size = res;
+            if (res)
+            {
+                iosb->out_data = io->buffer;
+                io->buffer = NULL;
+            }
+        }
+        /* the client fetches the result with get_async_result */
+        async_terminate( io->async, res ? STATUS_ALERTED : status );
+    }
+
+    free( io->buffer );
+    release_object( io->iosb );
+    release_object( io->async );
+    release_object( io->fd );
+    free( io );
+}
+
 #ifdef USE_EPOLL
 
+#ifdef USE_IO_URING
+
+/* io_uring backend, enabled with WINESERVERIOURING=1
+ *
+ * Each fd that has events to wait for gets a one-shot poll request; it is re-armed
+ * after its completion has been processed, and cancelled when the events change.
+ * Completions carry the poll user index and a generation number, so that those
+ * of cancelled requests can be ignored.
+ *
+ * Overlapped reads and writes on regular files are also queued to the ring, the
+ * client is told so at thread init. Their completions finish the async like an
+ * irp, which signals the event or posts to the completion port.
+ */
+
+#define URING_ENTRIES        4096
+#define URING_IGNORE         (~(__u64)0)       /* completion of a poll removal */
+#define URING_TIMEOUT        ((__u64)1 << 63)  /* completion of a loop timeout, ored with its expiry */
+#define URING_IO             ((__u64)1 << 62)  /* completion of a read or write, ored with the fd_io */
+#define URING_GEN_MASK       0x3fffffff
+
+struct uring_user
+{
+    unsigned int gen;       /* generation of the current poll request */
+    int          armed;     /* events of the pending poll request, 0 if none */
+};
+
+static int uring_fd = -1;
+static unsigned int *uring_sq_head, *uring_sq_tail, *uring_sq_mask, *uring_sq_array;
+static unsigned int *uring_cq_head, *uring_cq_tail, *uring_cq_mask;
+static unsigned int uring_sq_entries;
+static struct io_uring_sqe *uring_sqes;
+static struct io_uring_cqe *uring_cqes;
+static unsigned int uring_pending;              /* queued submissions */
+static timeout_t uring_timeout_end;             /* expiry of the earliest pending loop timeout, 0 if none */
+static struct __kernel_timespec uring_timeout;  /* loop timeout, must stay valid until submitted */
+static struct uring_user *uring_users;
+static int uring_users_size;
+static struct list uring_io_list = LIST_INIT( uring_io_list );  /* reads and writes in the ring */
+
+static int init_uring(void)
+{
+    struct io_uring_params params;
+    char *sq_ring, *cq_ring;
+    int fd;
+
+    memset( &params, 0, sizeof(params) );
+    if ((fd = syscall( __NR_io_uring_setup, URING_ENTRIES, &params )) == -1) return 0;
+
+    /* completions must not be dropped if the ring overflows */
+    if (!(params.features & IORING_FEAT_NODROP)) goto error;
+
+    sq_ring = mmap( NULL, params.sq_off.array + params.sq_entries * sizeof(unsigned int),
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING );
+    if (sq_ring == MAP_FAILED) goto error;
+    cq_ring = mmap( NULL, params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe),
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING );
+    if (cq_ring == MAP_FAILED) goto error;
+    uring_sqes = mmap( NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+                       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES );
+    if (uring_sqes == MAP_FAILED) goto error;
+
+    uring_sq_head    = (unsigned int *)(sq_ring + params.sq_off.head);
+    uring_sq_tail    = (unsigned int *)(sq_ring + params.sq_off.tail);
+    uring_sq_mask    = (unsigned int *)(sq_ring + params.sq_off.ring_mask);
+    uring_sq_array   = (unsigned int *)(sq_ring + params.sq_off.array);
+    uring_cq_head    = (unsigned int *)(cq_ring + params.cq_off.head);
+    uring_cq_tail    = (unsigned int *)(cq_ring + params.cq_off.tail);
+    uring_cq_mask    = (unsigned int *)(cq_ring + params.cq_off.ring_mask);
+    uring_cqes       = (struct io_uring_cqe *)(cq_ring + params.cq_off.cqes);
+    uring_sq_entries = params.sq_entries;
+    uring_fd = fd;
+    return 1;
+
+error:
+    close( fd );  /* the mappings keep the ring alive but are harmless */
+    return 0;
+}
+
+/* give up on io_uring; the poll() loop will take over */
+static void close_uring(void)
+{
+    struct fd_io *io, *next;
+
+    if (errno == ENOMEM) fprintf( stderr, "wineserver: out of memory for io_uring, falling back to poll\n" );
+    else perror( "io_uring" );
+    close( uring_fd );
+    uring_fd = -1;
+
+    /* the ring stays mapped and the kernel may still access the buffers, so they are leaked */
+    LIST_FOR_EACH_ENTRY_SAFE( io, next, &uring_io_list, struct fd_io, entry )
+    {
+        if (io->write) grab_object( io->iosb );
+        else io->buffer = NULL;
+        complete_fd_io( io, -EIO );
+    }
+}
+
+/* submit the queued requests, and optionally wait for a completion */
+static int enter_uring( unsigned int min_complete )
+{
+    int ret = syscall( __NR_io_uring_enter, uring_fd, uring_pending, min_complete,
+                       min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0 );
+
+    /* EBUSY means that the completion ring has to be drained first */
+    if (ret == -1) return errno == EINTR || errno == EBUSY;
+    uring_pending -= min( (unsigned int)ret, uring_pending );
+    return 1;
+}
+
+/* get a free submission entry, flushing the queue if it is full */
+static struct io_uring_sqe *get_uring_sqe( __u8 opcode, __u64 user_data )
+{
+    unsigned int tail = *uring_sq_tail, index;
+    struct io_uring_sqe *sqe;
+
+    if (tail - __atomic_load_n( uring_sq_head, __ATOMIC_ACQUIRE ) == uring_sq_entries)
+    {
+        if (!enter_uring( 0 ) ||
+            tail - __atomic_load_n( uring_sq_head, __ATOMIC_ACQUIRE ) == uring_sq_entries)
+            return NULL;
+    }
+    index = tail & *uring_sq_mask;
+    sqe = &uring_sqes[index];
+    memset( sqe, 0, sizeof(*sqe) );
+    sqe->opcode = opcode;
+    sqe->user_data = user_data;
+    uring_sq_array[index] = index;
+    return sqe;
+}
+
+static void queue_uring_sqe(void)
+{
+    __atomic_store_n( uring_sq_tail, *uring_sq_tail + 1, __ATOMIC_RELEASE );
+    uring_pending++;
+}
+
+/* cancel the pending poll request of a user */
+static void disarm_uring_user( int user )
+{
+    struct io_uring_sqe *sqe;
+
+    if (!uring_users[user].armed) return;
+    if (!(sqe = get_uring_sqe( IORING_OP_POLL_REMOVE, URING_IGNORE )))
+    {
+        close_uring();
+        return;
+    }
+    sqe->addr = ((__u64)uring_users[user].gen << 32) | user;
+    queue_uring_sqe();
+    /* ignore the completion of the cancelled request */
+    uring_users[user].gen = (uring_users[user].gen + 1) & URING_GEN_MASK;
+    uring_users[user].armed = 0;
+}
+
+/* queue a poll request for a user */
+static void arm_uring_user( int user, int unix_fd, int events )
+{
+    struct io_uring_sqe *sqe;
+
+    if (!events || uring_users[user].armed) return;
+    if (!(sqe = get_uring_sqe( IORING_OP_POLL_ADD, ((__u64)uring_users[user].gen << 32) | user )))
+    {
+        close_uring();
+        return;
+    }
+    sqe->fd = unix_fd;
+    sqe->poll_events = events;
+    queue_uring_sqe();
+    uring_users[user].armed = events;
+}
+
+/* set the events that io_uring waits for on this fd; helper for set_fd_epoll_events */
+static void set_fd_uring_events( struct fd *fd, int user, int events )
+{
+    if (user >= uring_users_size)
+    {
+        int new_size = max( allocated_users, user + 1 );
+        struct uring_user *new_users;
+
+        if (!(new_users = realloc( uring_users, new_size * sizeof(*new_users) )))
+        {
+            errno = ENOMEM;
+            close_uring();
+            return;
+        }
+        memset( new_users + uring_users_size, 0, (new_size - uring_users_size) * sizeof(*new_users) );
+        uring_users = new_users;
+        uring_users_size = new_size;
+    }
+
+    if (events == -1)  /* stop waiting on this fd completely */
+    {
+        if (pollfd[user].fd == -1) return;  /* already removed */
+        disarm_uring_user( user );
+    }
+    else if (pollfd[user].fd == -1)
+    {
+        if (pollfd[user].events) return;  /* stopped waiting on it, don't restart */
+        arm_uring_user( user, fd->unix_fd, events );
+    }
+    else
+    {
+        if (pollfd[user].events == events) return;  /* nothing to do */
+        disarm_uring_user( user );
+        if (uring_fd != -1) arm_uring_user( user, fd->unix_fd, events );
+    }
+}
+
+static void remove_uring_user( struct fd *fd, int user )
+{
+    if (user < uring_users_size) disarm_uring_user( user );
+}
+
+/* queue a read or write to the ring, it is completed from the main loop */
+static int submit_uring_io( struct fd_io *io, file_pos_t pos )
+{
+    struct io_uring_sqe *sqe;
+
+    if (!(sqe = get_uring_sqe( io->write ? IORING_OP_WRITEV : IORING_OP_READV,
+                               URING_IO | (unsigned long)io )))
+        return 0;
+    sqe->fd   = io->fd->unix_fd;
+    sqe->off  = pos;
+    sqe->addr = (unsigned long)&io->iov;
+    sqe->len  = 1;
+    queue_uring_sqe();
+    list_add_tail( &uring_io_list, &io->entry );
+    return 1;
+}
+
+/* make sure the loop wakes up after the timeout; cancelling the pending timeouts
+ * would complete them and wake the loop up too, so they are left to expire */
+static void set_uring_timeout( int timeout )
+{
+    struct io_uring_sqe *sqe;
+    timeout_t end;
+
+    if (timeout == -1) return;
+    end = current_time + (timeout_t)timeout * 10000;
+    if (uring_timeout_end && uring_timeout_end <= end) return;  /* an earlier one is pending */
+
+    /* the previous timeout has been submitted already, so the timespec can be reused */
+    uring_timeout.tv_sec  = timeout / 1000;
+    uring_timeout.tv_nsec = (timeout % 1000) * 1000000;
+    if (!(sqe = get_uring_sqe( IORING_OP_TIMEOUT, URING_TIMEOUT | end )))
+    {
+        close_uring();
+        return;
+    }
+    sqe->addr = (unsigned long)&uring_timeout;
+    sqe->len  = 1;
+    queue_uring_sqe();
+    uring_timeout_end = end;
+}
+
+static void main_loop_uring(void)
+{
+    struct io_uring_cqe events[128];
+    unsigned int head, tail;
+    int i, ret, timeout;
+
+    assert( POLLIN == EPOLLIN );
+    assert( POLLOUT == EPOLLOUT );
+
+    while (active_users)
+    {
+        timeout = get_next_timeout();
+
+        if (!active_users) break;  /* last user removed by a timeout */
+        if (uring_fd == -1) break;  /* an error occurred with io_uring */
+
+        set_uring_timeout( timeout );
+        if (uring_fd == -1) break;
+        if (!enter_uring( 1 ))
+        {
+            close_uring();
+            break;
+        }
+        set_current_time();
+
+        /* copy the completions first, as the callbacks may queue new requests */
+        head = *uring_cq_head;
+        tail = __atomic_load_n( uring_cq_tail, __ATOMIC_ACQUIRE );
+        for (ret = 0; head != tail && ret < (int)ARRAY_SIZE(events); head++)
+        {
+            struct io_uring_cqe *cqe = &uring_cqes[head & *uring_cq_mask];
+            int user = cqe->user_data & 0xffffffff;
+
+            if (cqe->user_data == URING_IGNORE) continue;
+            if (cqe->user_data & URING_TIMEOUT)
+            {
+                if ((timeout_t)(cqe->user_data & ~URING_TIMEOUT) == uring_timeout_end) uring_timeout_end = 0;
+                continue;
+            }
+            if (cqe->user_data & URING_IO)
+            {
+                events[ret++] = *cqe;
+                continue;
+            }
+            if (user >= uring_users_size || (cqe->user_data >> 32) != uring_users[user].gen) continue;
+            uring_users[user].gen = (uring_users[user].gen + 1) & URING_GEN_MASK;
+            uring_users[user].armed = 0;
+            events[ret++] = *cqe;
+        }
+        __atomic_store_n( uring_cq_head, head, __ATOMIC_RELEASE );
+
+        /* put the events into the pollfd array first, like poll does */
+        for (i = 0; i < ret; i++)
+        {
+            int user = events[i].user_data & 0xffffffff;
+            if (events[i].user_data & URING_IO) continue;
+            pollfd[user].revents = events[i].res < 0 ? POLLERR : events[i].res;
+        }
+
+        /* read events from the pollfd array, as set_fd_events may modify them */
+        for (i = 0; i < ret; i++)
+        {
+            int user = events[i].user_data & 0xffffffff;
+            if (events[i].user_data & URING_IO)
+            {
+                complete_fd_io( (struct fd_io *)(unsigned long)(events[i].user_data & ~URING_IO), events[i].res );
+                continue;
+            }
+            if (pollfd[user].revents) fd_poll_event( poll_users[user], pollfd[user].revents );
+            pollfd[user].revents = 0;
+            /* if we are still interested, poll the fd again */
+            if (uring_fd != -1 && pollfd[user].fd != -1)
+                arm_uring_user( user, pollfd[user].fd, pollfd[user].events );
+        }
+    }
+}
+
+#endif /* USE_IO_URING */
+
 static int epoll_fd = -1;
 
 static inline void init_epoll(void)
 {
+#ifdef USE_IO_URING
+    const char *env = getenv( "WINESERVERIOURING" );
+    if (env && atoi( env ) && init_uring()) return;
+#endif
     epoll_fd = epoll_create( 128 );
 }
 
@@ -497,6 +975,13 @@ static inline void set_fd_epoll_events( struct fd *fd, int user, int events )
     struct epoll_event ev;
     int ctl;
 
+#ifdef USE_IO_URING
+    if (uring_fd != -1)
+    {
+        set_fd_uring_events( fd, user, events );
+        return;
+    }
+#endif
     if (epoll_fd == -1) return;
 
     if (events == -1)  /* stop waiting on this fd completely */
@@ -532,6 +1017,13 @@ static inline void set_fd_epoll_events( struct fd *fd, int user, int events )
 
 static inline void remove_epoll_user( struct fd *fd, int user )
 {
+#ifdef USE_IO_URING
+    if (uring_fd != -1)
+    {
+        remove_uring_user( fd, user );
+        return;
+    }
+#endif
     if (epoll_fd == -1) return;
 
     if (pollfd[user].fd != -1)
@@ -551,6 +1043,13 @@ static inline void main_loop_epoll(void)
     assert( POLLERR == EPOLLERR );
     assert( POLLHUP == EPOLLHUP );
 
+#ifdef USE_IO_URING
+    if (uring_fd != -1)
+    {
+        main_loop_uring();
+        return;
+    }
+#endif
     if (epoll_fd == -1) return;
 
     while (active_users)
@@ -871,23 +1370,19 @@ static void remove_poll_user( struct fd *fd, int user )
 /* process pending timeouts and return the time until the next timeout, in milliseconds */
 static int get_next_timeout(void)
 {
-    if (!list_empty( &timeout_list ))
+    int ret = -1;  /* no pending timeouts */
+
+    if (timeout_count)
     {
-        struct list expired_list, *ptr;
+        struct list *ptr;
 
-        /* first remove all expired timers from the list */
+        /* first remove all expired timers from the heap */
 
-        list_init( &expired_list );
-        while ((ptr = list_head( &timeout_list )) != NULL)
+        while (timeout_count && timeout_heap[0]->when <= current_time)
         {
-            struct timeout_user *timeout = LIST_ENTRY( ptr, struct timeout_user, entry );
-
-            if (timeout->when <= current_time)
-            {
-                list_remove( &timeout->entry );
-                list_add_tail( &expired_list, &timeout->entry );
-            }
-            else break;
+            struct timeout_user *timeout = timeout_heap[0];
+            remove_heap_timeout( timeout );
+            list_add_tail( &expired_list, &timeout->entry );
         }
 
         /* now call the callback for all the removed timers */
@@ -900,15 +1395,18 @@ static int get_next_timeout(void)
             free( timeout );
         }
 
-        if ((ptr = list_head( &timeout_list )) != NULL)
+        if (timeout_count)
         {
-            struct timeout_user *timeout = LIST_ENTRY( ptr, struct timeout_user, entry );
+            struct timeout_user *timeout = timeout_heap[0];
             int diff = (timeout->when - current_time + 9999) / 10000;
             if (diff < 0) diff = 0;
-            return diff;
+            ret = diff;
         }
     }
-    return -1;  /* no pending timeouts */
+
+    /* requests passed in shared memory don't wake up the main loop while it polls */
+    if (ret && poll_request_shm()) ret = 0;
+    return ret;
 }
 
 /* server main poll() loop */
@@ -2337,6 +2835,91 @@ int no_fd_write( struct fd *fd, struct async *async, file_pos_t pos )
     return 0;
 }
 
+/* do a read or write on the unix fd for an async request, through io_uring if possible */
+static int queue_fd_io( struct fd *fd, struct async *async, file_pos_t pos, int write )
+{
+    struct fd_io *io;
+    ssize_t res;
+
+    if (fd->unix_fd == -1)
+    {
+        set_error( fd->no_fd_status );
+        return 0;
+    }
+    if (!(io = mem_alloc( sizeof(*io) ))) return 0;
+
+    list_init( &io->entry );
+    io->iosb   = async_get_iosb( async );
+    io->buffer = NULL;
+    io->write  = write;
+    if (write)
+    {
+        io->iov.iov_base = io->iosb->in_data;
+        io->iov.iov_len  = io->iosb->in_size;
+    }
+    else
+    {
+        io->iov.iov_len = io->iosb->out_size;
+        /* the client does larger reads itself, don't let it pick the size of a server buffer */
+        if (io->iov.iov_len > MAX_ASYNC_FILE_IO_SIZE)
+        {
+            set_error( STATUS_INVALID_PARAMETER );
+            release_object( io->iosb );
+            free( io );
+            return 0;
+        }
+        if (io->iov.iov_len && !(io->buffer = mem_alloc( io->iov.iov_len )))
+        {
+            release_object( io->iosb );
+            free( io );
+            return 0;
+        }
+        io->iov.iov_base = io->buffer;
+    }
+    io->fd    = (struct fd *)grab_object( fd );
+    io->async = (struct async *)grab_object( async );
+
+#ifdef USE_IO_URING
+    if (uring_fd != -1 && submit_uring_io( io, pos ))
+    {
+        set_error( STATUS_PENDING );
+        return 1;
+    }
+#endif
+
+    /* complete it right away, the result is returned with the reply */
+    do
+    {
+        if (write) res = pwrite( fd->unix_fd, io->iov.iov_base, io->iov.iov_len, pos );
+        else res = pread( fd->unix_fd, io->iov.iov_base, io->iov.iov_len, pos );
+    } while (res == -1 && errno == EINTR);
+    complete_fd_io( io, res == -1 ? -errno : res );
+    set_error( STATUS_PENDING );
+    return 1;
+}
+
+/* read() routine for fds with a regular unix file */
+int default_fd_read( struct fd *fd, struct async *async, file_pos_t pos )
+{
+    return queue_fd_io( fd, async, pos, 0 );
+}
+
+/* write() routine for fds with a regular unix file */
+int default_fd_write( struct fd *fd, struct async *async, file_pos_t pos )
+{
+    return queue_fd_io( fd, async, pos, 1 );
+}
+
+/* check if overlapped reads and writes on regular files should be done by the server */
+int is_async_file_io_supported(void)
+{
+#ifdef USE_IO_URING
+    return uring_fd != -1;
+#else
+    return 0;
+#endif
+}
+
 /* default flush() routine */
 int no_fd_flush( struct fd *fd, struct async *async )
 {
@@ -119,8 +119,8 @@ static const struct fd_ops file_fd_ops =
     file_get_poll_events,         /* get_poll_events */
     default_poll_event,           /* poll_event */
     file_get_fd_type,             /* get_fd_type */
-    no_fd_read,                   /* read */
-    no_fd_write,                  /* write */
+    default_fd_read,              /* read */
+    default_fd_write,             /* write */
     file_flush,                   /* flush */
     default_fd_get_file_info,     /* get_file_info */
     no_fd_get_volume_info,        /* get_volume_info */
@@ -64,6 +64,11 @@ static inline int futex_wait_multiple( const struct futex_wait_block *futexes,
     return syscall( __NR_futex, futexes, 31, count, timeout, 0, 0 );
 }
 
+/* mainline replacement for FUTEX_WAIT_MULTIPLE, available since Linux 5.16 */
+#ifndef __NR_futex_waitv
+#define __NR_futex_waitv 449
+#endif
+
 int do_fsync(void)
 {
 #ifdef __linux__
@@ -72,7 +77,12 @@ int do_fsync(void)
     if (do_fsync_cached == -1)
     {
         static const struct timespec zero;
-        futex_wait_multiple( NULL, 0, &zero );
+
+        /* the client uses futex_waitv() when available, the server only needs to wake */
+        if (syscall( __NR_futex_waitv, NULL, 0, 0, NULL, 0 ) == -1 && errno == ENOSYS)
+            futex_wait_multiple( NULL, 0, &zero );
+        else
+            errno = 0;
         do_fsync_cached = getenv("WINEFSYNC") && atoi(getenv("WINEFSYNC")) && errno != ENOSYS;
     }
 
@@ -319,7 +329,7 @@ struct fsync *create_fsync( struct object *root, const struct unicode_str *name,
 #endif
 }
 
-static inline int futex_wake( int *addr, int val )
+int futex_wake( int *addr, int val )
 {
     return syscall( __NR_futex, addr, 1, val, NULL, 0, 0 );
 }
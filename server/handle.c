@@ -27,12 +27,17 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
 #include "windef.h"
 #include "winternl.h"
 
+#include "file.h"
+#include "fsync.h"
 #include "handle.h"
 #include "process.h"
 #include "thread.h"
@@ -53,6 +58,7 @@ struct handle_table
     int                  last;        /* last used entry */
     int                  free;        /* first entry that may be free */
     struct handle_entry *entries;     /* handle entries */
+    handle_shm_t        *shm;         /* shared memory mirror of the entries */
 };
 
 static struct handle_table *global_table;
@@ -190,6 +196,7 @@ static void handle_table_destroy( struct object *obj )
         if (obj) release_object_from_handle( obj );
     }
     free( table->entries );
+    release_shared_memory( -1, table->shm, sizeof(*table->shm) );
 }
 
 /* close all the process handles and free the handle table */
@@ -213,6 +220,7 @@ struct handle_table *alloc_handle_table( struct process *process, int count )
     table->count   = count;
     table->last    = -1;
     table->free    = 0;
+    table->shm     = NULL;
     if ((table->entries = mem_alloc( count * sizeof(*table->entries) ))) return table;
     release_object( table );
     return NULL;
@@ -235,6 +243,42 @@ static int grow_handle_table( struct handle_table *table )
     return 1;
 }
 
+/* update the shared memory mirror of a handle table entry */
+static void update_handle_shm( struct handle_table *table, int index )
+{
+    struct handle_entry *entry = table->entries + index;
+    handle_shm_entry_t *shm;
+    enum fsync_type fsync_type = 0;
+    unsigned int error, seq;
+
+    if (!table->shm || index >= HANDLE_SHM_ENTRIES) return;
+    shm = &table->shm->entries[index];
+
+    seq = shm->seq;
+    __atomic_store_n( &shm->seq, seq + 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+
+    shm->valid      = 0;
+    shm->access     = 0;
+    shm->fsync_idx  = 0;
+    shm->fsync_type = 0;
+    if (entry->ptr)
+    {
+        shm->valid  = 1;
+        shm->access = entry->access & ~RESERVED_ALL;
+        /* same conditions as the get_fsync_idx request */
+        if (do_fsync() && (entry->access & SYNCHRONIZE) && entry->ptr->ops->get_fsync_idx)
+        {
+            error = get_error();
+            shm->fsync_idx  = entry->ptr->ops->get_fsync_idx( entry->ptr, &fsync_type );
+            shm->fsync_type = fsync_type;
+            set_error( error );
+        }
+    }
+
+    __atomic_store_n( &shm->seq, seq + 2, __ATOMIC_RELEASE );
+}
+
 /* allocate the first free entry in the handle table */
 static obj_handle_t alloc_entry( struct handle_table *table, struct object *obj, unsigned int access )
 {
@@ -252,6 +296,7 @@ static obj_handle_t alloc_entry( struct handle_table *table, struct object *obj,
     table->free = i + 1;
     entry->ptr    = grab_object_for_handle( obj );
     entry->access = access;
+    update_handle_shm( table, i );
 
     if (table->process)
         obj->ops->alloc_handle( obj, table->process, index_to_handle(i) );
@@ -407,6 +452,7 @@ unsigned int close_handle( struct process *process, obj_handle_t handle )
     if (!obj->ops->close_handle( obj, process, handle )) return STATUS_HANDLE_NOT_CLOSABLE;
     entry->ptr = NULL;
     table = handle_is_global(handle) ? global_table : process->handles;
+    update_handle_shm( table, entry - table->entries );
     if (entry < table->entries + table->free) table->free = entry - table->entries;
     if (entry == table->entries + table->last) shrink_handle_table( table );
     release_object_from_handle( obj );
@@ -541,6 +587,7 @@ static int set_handle_flags( struct process *process, obj_handle_t handle, int m
     mask  = (mask << RESERVED_SHIFT) & RESERVED_ALL;
     flags = (flags << RESERVED_SHIFT) & mask;
     entry->access = (entry->access & ~mask) | flags;
+    if (!handle_is_global( handle )) update_handle_shm( process->handles, entry - process->handles->entries );
     return (old_access & RESERVED_ALL) >> RESERVED_SHIFT;
 }
 
@@ -582,6 +629,8 @@ obj_handle_t duplicate_handle( struct process *src, obj_handle_t src_handle, str
         {
             if (attr & OBJ_INHERIT) access |= RESERVED_INHERIT;
             entry->access = access;
+            if (!handle_is_global( src_handle ))
+                update_handle_shm( src->handles, entry - src->handles->entries );
             res = src_handle;
         }
         else
@@ -855,3 +904,29 @@ DECL_HANDLER(get_system_handles)
         enum_processes( enum_handles, &info );
     }
 }
+
+/* get file descriptor to the shared memory mirror of the current process handle table */
+DECL_HANDLER(get_handle_shm)
+{
+    struct handle_table *table = current->process->handles;
+    int i, fd;
+
+    if (!table)
+    {
+        set_error( STATUS_PROCESS_IS_TERMINATING );
+        return;
+    }
+    if (table->shm)
+    {
+        set_error( STATUS_INVALID_PARAMETER );
+        return;
+    }
+    if (!allocate_shared_memory( &fd, (void **)&table->shm, sizeof(*table->shm) ))
+    {
+        set_error( STATUS_NOT_SUPPORTED );
+        return;
+    }
+    for (i = 0; i <= table->last; i++) update_handle_shm( table, i );
+    send_client_fd( current->process, fd, 0 );
+    close( fd );
+}
@@ -149,6 +149,65 @@ static const struct object_ops shared_map_ops =
 
 static struct list shared_map_list = LIST_INIT( shared_map_list );
 
+/* pages of a PE image laid out and relocated for a given base address, shared between processes */
+struct image_cache
+{
+    struct object   obj;             /* object header */
+    struct fd      *fd;              /* file descriptor of the mapped PE file */
+    client_ptr_t    base;            /* base address the image is relocated for */
+    file_pos_t      file_size;       /* size of the PE file when the cache was built */
+    time_t          mtime;           /* modification time of the PE file when the cache was built */
+    long            mtime_nsec;      /* nanoseconds part of the modification time */
+    time_t          ctime;           /* change time of the PE file when the cache was built */
+    struct file    *file;            /* temp file holding the image pages */
+    struct list     entry;           /* entry in global image cache list */
+};
+
+static void image_cache_dump( struct object *obj, int verbose );
+static void image_cache_destroy( struct object *obj );
+
+static const struct object_ops image_cache_ops =
+{
+    sizeof(struct image_cache), /* size */
+    image_cache_dump,          /* dump */
+    no_get_type,               /* get_type */
+    no_add_queue,              /* add_queue */
+    NULL,                      /* remove_queue */
+    NULL,                      /* signaled */
+    NULL,                      /* get_esync_fd */
+    NULL,                      /* get_fsync_idx */
+    NULL,                      /* satisfied */
+    no_signal,                 /* signal */
+    no_get_fd,                 /* get_fd */
+    no_map_access,             /* map_access */
+    default_get_sd,            /* get_sd */
+    default_set_sd,            /* set_sd */
+    no_lookup_name,            /* lookup_name */
+    no_link_name,              /* link_name */
+    NULL,                      /* unlink_name */
+    no_open_file,              /* open_file */
+    no_kernel_obj_list,        /* get_kernel_obj_list */
+    no_alloc_handle,           /* alloc_handle */
+    no_close_handle,           /* close_handle */
+    image_cache_destroy        /* destroy */
+};
+
+static struct list image_cache_list = LIST_INIT( image_cache_list );
+
+/* the cache is built synchronously in the server, don't stall it on large images */
+#define IMAGE_CACHE_MAX_SIZE (16 * 1024 * 1024)
+
+static inline long get_mtime_nsec( const struct stat *st )
+{
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    return st->st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC)
+    return st->st_mtimespec.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
 /* memory view mapped in client address space */
 struct memory_view
 {
@@ -156,6 +215,7 @@ struct memory_view
     struct fd      *fd;              /* fd for mapped file */
     struct ranges  *committed;       /* list of committed ranges in this mapping */
     struct shared_map *shared;       /* temp file for shared PE mapping */
+    struct image_cache *cache;       /* image cache the view is mapped from */
     unsigned int    flags;           /* SEC_* flags */
     client_ptr_t    base;            /* view base address (in process addr space) */
     mem_size_t      size;            /* view size */
@@ -171,6 +231,7 @@ struct mapping
     pe_image_info_t image;           /* image info (for PE image mapping) */
     struct ranges  *committed;       /* list of committed ranges in this mapping */
     struct shared_map *shared;       /* temp file for shared PE mapping */
+    struct image_cache *cache;       /* last image cache used for this mapping */
 };
 
 static void mapping_dump( struct object *obj, int verbose );
@@ -257,6 +318,22 @@ static void shared_map_destroy( struct object *obj )
     list_remove( &shared->entry );
 }
 
+static void image_cache_dump( struct object *obj, int verbose )
+{
+    struct image_cache *cache = (struct image_cache *)obj;
+    fprintf( stderr, "Image cache fd=%p base=%x%08x file=%p\n", cache->fd,
+             (unsigned int)(cache->base >> 32), (unsigned int)cache->base, cache->file );
+}
+
+static void image_cache_destroy( struct object *obj )
+{
+    struct image_cache *cache = (struct image_cache *)obj;
+
+    release_object( cache->fd );
+    release_object( cache->file );
+    list_remove( &cache->entry );
+}
+
 /* extend a file beyond the current end of file */
 static int grow_file( int unix_fd, file_pos_t new_size )
 {
@@ -399,6 +476,7 @@ static void free_memory_view( struct memory_view *view )
     if (view->fd) release_object( view->fd );
     if (view->committed) release_object( view->committed );
     if (view->shared) release_object( view->shared );
+    if (view->cache) release_object( view->cache );
     list_remove( &view->entry );
     free( view );
 }
@@ -608,6 +686,217 @@ static int build_shared_mapping( struct mapping *mapping, int fd,
     return 0;
 }
 
+/* apply the base relocations of an image laid out in memory */
+static int relocate_image( char *image, mem_size_t size, const IMAGE_DATA_DIRECTORY *dir, file_pos_t delta )
+{
+    const IMAGE_BASE_RELOCATION *rel;
+    const USHORT *relocs;
+    mem_size_t pos = dir->VirtualAddress, end = pos + dir->Size, offset;
+    unsigned int i, count, len;
+
+    if (end > size || end < pos) return 0;
+    while (pos + sizeof(*rel) <= end)
+    {
+        rel = (const IMAGE_BASE_RELOCATION *)(image + pos);
+        if (!rel->SizeOfBlock) break;
+        if (rel->SizeOfBlock < sizeof(*rel) || rel->SizeOfBlock > end - pos) return 0;
+        count = (rel->SizeOfBlock - sizeof(*rel)) / sizeof(USHORT);
+        relocs = (const USHORT *)(rel + 1);
+        for (i = 0; i < count; i++)
+        {
+            offset = rel->VirtualAddress + (relocs[i] & 0xfff);
+            switch (relocs[i] >> 12)
+            {
+            case IMAGE_REL_BASED_ABSOLUTE: len = 0; break;
+            case IMAGE_REL_BASED_HIGH:
+            case IMAGE_REL_BASED_LOW:      len = sizeof(short); break;
+            case IMAGE_REL_BASED_HIGHLOW:  len = sizeof(int); break;
+            case IMAGE_REL_BASED_DIR64:    len = sizeof(LONGLONG); break;
+            default: return 0;  /* leave the more exotic types to the client loader */
+            }
+            if (offset > size || len > size - offset) return 0;
+            switch (relocs[i] >> 12)
+            {
+            case IMAGE_REL_BASED_ABSOLUTE:
+                break;
+            case IMAGE_REL_BASED_HIGH:
+                *(short *)(image + offset) += delta >> 16;
+                break;
+            case IMAGE_REL_BASED_LOW:
+                *(short *)(image + offset) += delta;
+                break;
+            case IMAGE_REL_BASED_HIGHLOW:
+                *(int *)(image + offset) += delta;
+                break;
+            case IMAGE_REL_BASED_DIR64:
+                *(LONGLONG *)(image + offset) += delta;
+                break;
+            }
+        }
+        pos += rel->SizeOfBlock;
+    }
+    return 1;
+}
+
+/* lay out the sections of an image into a temp file, relocated for the given base address */
+static struct image_cache *build_image_cache( struct mapping *mapping, int unix_fd, client_ptr_t base,
+                                              const struct stat *st )
+{
+    IMAGE_SECTION_HEADER sec[96];
+    IMAGE_FILE_HEADER *file_header;
+    IMAGE_OPTIONAL_HEADER32 *hdr32;
+    IMAGE_OPTIONAL_HEADER64 *hdr64;
+    IMAGE_DATA_DIRECTORY relocs = { 0, 0 };
+    struct image_cache *cache;
+    struct file *file;
+    mem_size_t total_size = mapping->image.map_size;
+    size_t header_size = min( mapping->image.header_size, st->st_size );
+    size_t map_size, file_size;
+    file_pos_t image_base, delta = 0;
+    unsigned int i, nb_sec, nt_pos, opt_size, unaligned = is_fd_removable( mapping->fd ), shared = 0;
+    off_t file_start;
+    ssize_t res;
+    char *image;
+    int cache_fd;
+
+    if (header_size < sizeof(IMAGE_DOS_HEADER) || header_size > total_size)
+    {
+        set_error( STATUS_INVALID_IMAGE_FORMAT );
+        return NULL;
+    }
+    if (total_size > IMAGE_CACHE_MAX_SIZE)
+    {
+        set_error( STATUS_NOT_SUPPORTED );
+        return NULL;
+    }
+    if ((cache_fd = create_temp_file( total_size )) == -1) return NULL;
+    if ((image = mmap( NULL, total_size, PROT_READ | PROT_WRITE, MAP_SHARED, cache_fd, 0 )) == MAP_FAILED)
+    {
+        file_set_error();
+        close( cache_fd );
+        return NULL;
+    }
+
+    set_error( STATUS_INVALID_IMAGE_FORMAT );
+    if (pread( unix_fd, image, header_size, 0 ) != header_size) goto error;
+    nt_pos = ((IMAGE_DOS_HEADER *)image)->e_lfanew;
+    if (nt_pos > header_size - sizeof(DWORD) - sizeof(*file_header)) goto error;
+    file_header = (IMAGE_FILE_HEADER *)(image + nt_pos + sizeof(DWORD));
+    hdr32 = (IMAGE_OPTIONAL_HEADER32 *)(file_header + 1);
+    hdr64 = (IMAGE_OPTIONAL_HEADER64 *)(file_header + 1);
+    opt_size = file_header->SizeOfOptionalHeader;
+    nb_sec = file_header->NumberOfSections;
+    if (nb_sec > ARRAY_SIZE( sec )) goto error;
+    if ((char *)hdr32 + opt_size + nb_sec * sizeof(*sec) > image + header_size) goto error;
+    memcpy( sec, (char *)hdr32 + opt_size, nb_sec * sizeof(*sec) );
+
+    if (hdr32->Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
+    {
+        if (opt_size < offsetof( IMAGE_OPTIONAL_HEADER64, DataDirectory )) goto error;
+        image_base = hdr64->ImageBase;
+        if (opt_size >= offsetof( IMAGE_OPTIONAL_HEADER64, DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC + 1] ) &&
+            hdr64->NumberOfRvaAndSizes > IMAGE_DIRECTORY_ENTRY_BASERELOC)
+            relocs = hdr64->DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
+    }
+    else
+    {
+        if (opt_size < offsetof( IMAGE_OPTIONAL_HEADER32, DataDirectory )) goto error;
+        image_base = hdr32->ImageBase;
+        if (opt_size >= offsetof( IMAGE_OPTIONAL_HEADER32, DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC + 1] ) &&
+            hdr32->NumberOfRvaAndSizes > IMAGE_DIRECTORY_ENTRY_BASERELOC)
+            relocs = hdr32->DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
+    }
+
+    /* only relocate what the client loader would relocate */
+    if (base != image_base && (file_header->Characteristics & IMAGE_FILE_DLL) &&
+        !(file_header->Characteristics & IMAGE_FILE_RELOCS_STRIPPED) &&
+        relocs.VirtualAddress && relocs.Size)
+        delta = base - image_base;
+
+    /* copy the sections, same as map_image() in ntdll would do */
+
+    for (i = 0; i < nb_sec; i++)
+    {
+        get_section_sizes( &sec[i], &map_size, &file_start, &file_size );
+        if (sec[i].VirtualAddress > total_size || map_size > total_size - sec[i].VirtualAddress) goto error;
+        if ((sec[i].Characteristics & IMAGE_SCN_MEM_SHARED) && (sec[i].Characteristics & IMAGE_SCN_MEM_WRITE))
+        {
+            shared = 1;  /* mapped from the shared file by the client */
+            continue;
+        }
+        if (!sec[i].PointerToRawData || !file_size) continue;
+        if (file_start & page_mask) unaligned = 1;
+        if (sec[i].PointerToRawData >= st->st_size) goto error;
+
+        res = pread( unix_fd, image + sec[i].VirtualAddress, file_size, file_start );
+        /* partial sector at EOF is not an error */
+        if (res != file_size && (res < 0 || file_start + res != st->st_size || file_size - res >= 0x200))
+            goto error;
+    }
+
+    /* the shared sections can't be relocated in the cache */
+    if (delta && shared) goto error;
+    if (!unaligned && !delta)
+    {
+        /* the client can map the file directly, the page cache is already shared */
+        set_error( STATUS_NOT_SUPPORTED );
+        goto error;
+    }
+    if (delta)
+    {
+        if (!relocate_image( image, total_size, &relocs, delta )) goto error;
+        if (hdr32->Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC) hdr64->ImageBase = base;
+        else hdr32->ImageBase = base;
+    }
+    munmap( image, total_size );
+    image = NULL;
+
+    clear_error();
+    if (!(file = create_file_for_fd( cache_fd, FILE_GENERIC_READ|FILE_GENERIC_WRITE, 0 ))) return NULL;
+    if (!(cache = alloc_object( &image_cache_ops )))
+    {
+        release_object( file );
+        return NULL;
+    }
+    cache->fd         = (struct fd *)grab_object( mapping->fd );
+    cache->base       = base;
+    cache->file_size  = st->st_size;
+    cache->mtime      = st->st_mtime;
+    cache->mtime_nsec = get_mtime_nsec( st );
+    cache->ctime      = st->st_ctime;
+    cache->file       = file;
+    list_add_head( &image_cache_list, &cache->entry );
+    return cache;
+
+ error:
+    munmap( image, total_size );
+    close( cache_fd );
+    return NULL;
+}
+
+/* find the image cache of a mapping for a given base address, building it if needed */
+static struct image_cache *get_image_cache( struct mapping *mapping, client_ptr_t base )
+{
+    struct image_cache *cache;
+    struct stat st;
+    int unix_fd;
+
+    if ((unix_fd = get_unix_fd( mapping->fd )) == -1) return NULL;
+    if (fstat( unix_fd, &st ) == -1)
+    {
+        file_set_error();
+        return NULL;
+    }
+
+    LIST_FOR_EACH_ENTRY( cache, &image_cache_list, struct image_cache, entry )
+    {
+        if (cache->base != base || cache->file_size != st.st_size || cache->mtime != st.st_mtime ||
+            cache->mtime_nsec != get_mtime_nsec( &st ) || cache->ctime != st.st_ctime) continue;
+        if (is_same_file_fd( cache->fd, mapping->fd )) return (struct image_cache *)grab_object( cache );
+    }
+    return build_image_cache( mapping, unix_fd, base, &st );
+}
+
 /* load the CLR header from its section */
 static int load_clr_header( IMAGE_COR20_HEADER *hdr, size_t va, size_t size, int unix_fd,
                             IMAGE_SECTION_HEADER *sec, unsigned int nb_sec )
@@ -892,6 +1181,7 @@ static struct object *create_mapping( struct object *root, const struct unicode_
     mapping->size        = size;
     mapping->fd          = NULL;
     mapping->shared      = NULL;
+    mapping->cache       = NULL;
     mapping->committed   = NULL;
 
     if (!(mapping->flags = get_mapping_flags( handle, flags ))) goto error;
@@ -1021,6 +1311,7 @@ static void mapping_destroy( struct object *obj )
     if (mapping->fd) release_object( mapping->fd );
     if (mapping->committed) release_object( mapping->committed );
     if (mapping->shared) release_object( mapping->shared );
+    if (mapping->cache) release_object( mapping->cache );
 }
 
 static enum server_fd_type mapping_get_fd_type( struct fd *fd )
@@ -1092,6 +1383,27 @@ DECL_HANDLER(get_mapping_info)
     release_object( mapping );
 }
 
+/* get the shared cache holding the laid out pages of an image mapping */
+DECL_HANDLER(get_image_cache)
+{
+    struct mapping *mapping;
+    struct image_cache *cache;
+
+    if (!(mapping = get_mapping_obj( current->process, req->mapping, SECTION_MAP_READ ))) return;
+
+    if (!(mapping->flags & SEC_IMAGE) || (mapping->image.image_flags & IMAGE_FLAGS_ImageMappedFlat) ||
+        (req->base & page_mask))
+        set_error( STATUS_INVALID_PARAMETER );
+    else if ((cache = get_image_cache( mapping, req->base )))
+    {
+        /* keep it alive until the view is added, see map_view */
+        if (mapping->cache) release_object( mapping->cache );
+        mapping->cache = cache;
+        reply->cache_file = alloc_handle( current->process, cache->file, GENERIC_READ, 0 );
+    }
+    release_object( mapping );
+}
+
 /* add a memory view in the current process */
 DECL_HANDLER(map_view)
 {
@@ -1140,6 +1452,8 @@ DECL_HANDLER(map_view)
         view->fd        = !is_fd_removable( mapping->fd ) ? (struct fd *)grab_object( mapping->fd ) : NULL;
         view->committed = mapping->committed ? (struct ranges *)grab_object( mapping->committed ) : NULL;
         view->shared    = mapping->shared ? (struct shared_map *)grab_object( mapping->shared ) : NULL;
+        view->cache     = mapping->cache && mapping->cache->base == req->base ?
+                          (struct image_cache *)grab_object( mapping->cache ) : NULL;
         list_add_tail( &current->process->views, &view->entry );
     }
 
@@ -544,6 +544,7 @@ struct process *create_process( int fd, struct process *parent, int inherit_all,
     list_init( &process->kernel_object );
     process->esync_fd        = -1;
     process->fsync_idx       = 0;
+    process->request_count   = 0;
     list_init( &process->thread_list );
     list_init( &process->locks );
     list_init( &process->asyncs );
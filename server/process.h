@@ -100,6 +100,7 @@ struct process
     struct list          kernel_object;   /* list of kernel object pointers */
     int                  esync_fd;        /* esync file descriptor (signaled on exit) */
     unsigned int         fsync_idx;
+    unsigned int         request_count;   /* number of requests since the server statistics were reset */
 };
 
 struct process_snapshot
@@ -523,7 +523,10 @@ static inline void update_shm_queue_bits( struct msg_queue *queue )
     shmlocal_t *shm;
     if (!queue->thread) return;
     if ((shm = queue->thread->shm))
-        shm->queue_bits = queue->wake_bits;
+    {
+        shm->queue_bits   = queue->wake_bits;
+        shm->changed_bits = queue->changed_bits;
+    }
 }
 
 /* set some queue bits */
@@ -996,10 +999,15 @@ static void cleanup_results( struct msg_queue *queue )
 static int is_queue_hung( struct msg_queue *queue )
 {
     struct wait_queue_entry *entry;
+    shmlocal_t *shm = queue->thread ? queue->thread->shm : NULL;
 
     if (current_time - queue->last_get_msg <= 5 * TICKS_PER_SEC)
         return 0;  /* less than 5 seconds since last get message -> not hung */
 
+    /* peek calls that found the queue empty through the shared memory don't reach the server */
+    if (shm && get_tick_count() - shm->last_get_msg <= 5000)
+        return 0;
+
     LIST_FOR_EACH_ENTRY( entry, &queue->obj.wait_queue, struct wait_queue_entry, entry )
     {
         if (get_wait_queue_thread(entry)->queue == queue)
@@ -2525,6 +2533,7 @@ DECL_HANDLER(get_queue_status)
         reply->wake_bits    = queue->wake_bits;
         reply->changed_bits = queue->changed_bits;
         queue->changed_bits &= ~req->clear_bits;
+        update_shm_queue_bits( queue );
 
         if (do_fsync() && !is_signaled( queue ))
             fsync_clear( &queue->obj );
@@ -2724,6 +2733,7 @@ DECL_HANDLER(get_message)
     }
     if (filter & QS_INPUT) queue->changed_bits &= ~QS_INPUT;
     if (filter & QS_PAINT) queue->changed_bits &= ~QS_PAINT;
+    update_shm_queue_bits( queue );
 
     /* then check for posted messages */
     if ((filter & QS_POSTMESSAGE) &&
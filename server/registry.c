@@ -35,6 +35,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
 #include <unistd.h>
 
 #include "ntstatus.h"
@@ -67,6 +70,13 @@ struct notify
     struct process   *process;  /* process in which the hkey is valid */
 };
 
+/* hash table indexing the subkeys or values of a key by name */
+struct name_hash
+{
+    unsigned int      size;        /* number of slots (power of 2), 0 if not built */
+    int              *slots;       /* index in the array, or -1 for a free slot */
+};
+
 /* a registry key */
 struct key
 {
@@ -82,6 +92,8 @@ struct key
     int               last_value;  /* last in use value */
     int               nb_values;   /* count of allocated values in array */
     struct key_value *values;      /* values array */
+    struct name_hash  subkey_hash; /* hash table of subkey names */
+    struct name_hash  value_hash;  /* hash table of value names */
     unsigned int      flags;       /* flags */
     timeout_t         modif;       /* last modification time */
     struct list       notify_list; /* list of notifications */
@@ -107,6 +119,7 @@ struct key_value
 
 #define MIN_SUBKEYS  8   /* min. number of allocated subkeys per key */
 #define MIN_VALUES   8   /* min. number of allocated values per key */
+#define MIN_HASHED   16  /* min. number of subkeys or values to build a hash table */
 
 #define MAX_NAME_LEN  256    /* max. length of a key name */
 #define MAX_VALUE_LEN 16383  /* max. length of a value name */
@@ -114,6 +127,23 @@ struct key_value
 /* the root of the registry tree */
 static struct key *root_key;
 
+/* cache of recently opened paths */
+#define PATH_CACHE_SIZE     256
+#define MAX_CACHED_PATH_LEN 128
+
+struct path_cache_entry
+{
+    struct key       *parent;      /* key the path is relative to */
+    struct key       *key;         /* key the path resolved to */
+    unsigned int      generation;  /* tree generation when the entry was stored */
+    unsigned int      flags;       /* wow64 access flags and OBJ_OPENLINK */
+    data_size_t       len;         /* length of the path in bytes */
+    WCHAR             path[MAX_CACHED_PATH_LEN];
+};
+
+static struct path_cache_entry path_cache[PATH_CACHE_SIZE];
+static unsigned int tree_generation = 1;  /* incremented whenever path lookups may resolve differently */
+
 static const timeout_t ticks_1601_to_1970 = (timeout_t)86400 * (369 * 365 + 89) * TICKS_PER_SEC;
 static const timeout_t save_period = 30 * -TICKS_PER_SEC;  /* delay between periodic saves */
 static struct timeout_user *save_timeout_user;  /* saving timer */
@@ -125,13 +155,19 @@ static const WCHAR symlink_value[] = {'S','y','m','b','o','l','i','c','L','i','n
 static const struct unicode_str symlink_str = { symlink_value, sizeof(symlink_value) };
 
 static void set_periodic_save_timer(void);
-static struct key_value *find_value( const struct key *key, const struct unicode_str *name, int *index );
+static struct key_value *find_value( struct key *key, const struct unicode_str *name, int *index );
 
 /* information about where to save a registry branch */
 struct save_branch_info
 {
     struct key  *key;
     const char  *path;
+    char        *hive_path;     /* path of the binary hive */
+    char        *journal_path;  /* path of the binary hive journal */
+    timeout_t    hive_serial;   /* serial of the current binary hive, 0 if none */
+    size_t       hive_size;     /* size of the current binary hive */
+    size_t       journal_size;  /* size of the valid part of the journal */
+    int          text_stale;    /* text file is older than the binary hive */
 };
 
 #define MAX_SAVE_BRANCH_INFO 3
@@ -446,6 +482,8 @@ static void key_destroy( struct object *obj )
         release_object( key->subkeys[i] );
     }
     free( key->subkeys );
+    free( key->subkey_hash.slots );
+    free( key->value_hash.slots );
     /* unconditionally notify everything waiting on this key */
     while ((ptr = list_head( &key->notify_list )))
     {
@@ -512,6 +550,10 @@ static struct key *alloc_key( const struct unicode_str *name, timeout_t modif )
         key->nb_values   = 0;
         key->last_value  = -1;
         key->values      = NULL;
+        key->subkey_hash.size  = 0;
+        key->subkey_hash.slots = NULL;
+        key->value_hash.size   = 0;
+        key->value_hash.slots  = NULL;
         key->modif       = modif;
         key->parent      = NULL;
         list_init( &key->notify_list );
@@ -546,6 +588,16 @@ static void make_clean( struct key *key )
     for (i = 0; i <= key->last_subkey; i++) make_clean( key->subkeys[i] );
 }
 
+/* mark a key and all its subkeys as modified */
+static void make_subtree_dirty( struct key *key )
+{
+    int i;
+
+    if (key->flags & KEY_VOLATILE) return;
+    key->flags |= KEY_DIRTY;
+    for (i = 0; i <= key->last_subkey; i++) make_subtree_dirty( key->subkeys[i] );
+}
+
 /* go through all the notifications and send them if necessary */
 static void check_notify( struct key *key, unsigned int change, int not_subtree )
 {
@@ -573,6 +625,91 @@ static void touch_key( struct key *key, unsigned int change )
         check_notify( k, change, 0 );
 }
 
+/* invalidate all the cached path lookups */
+static void invalidate_path_cache(void)
+{
+    if (++tree_generation) return;
+    /* wrapped around, make sure no old entry can match again */
+    memset( path_cache, 0, sizeof(path_cache) );
+    tree_generation = 1;
+}
+
+/* compute the case-insensitive hash of a key or value name */
+static unsigned int hash_name( const WCHAR *name, data_size_t len )
+{
+    unsigned int i, hash = 2166136261u;
+
+    for (i = 0; i < len / sizeof(WCHAR); i++) hash = (hash ^ tolowerW( name[i] )) * 16777619;
+    return hash;
+}
+
+/* allocate an empty name hash table large enough for count entries */
+static int alloc_name_hash( struct name_hash *hash, int count )
+{
+    unsigned int i, size = 2 * MIN_HASHED;
+
+    while (size < 2 * count) size *= 2;
+    if (!(hash->slots = malloc( size * sizeof(*hash->slots) ))) return 0;
+    for (i = 0; i < size; i++) hash->slots[i] = -1;
+    hash->size = size;
+    return 1;
+}
+
+/* free a name hash table; it will be rebuilt on the next lookup */
+static void free_name_hash( struct name_hash *hash )
+{
+    free( hash->slots );
+    hash->slots = NULL;
+    hash->size  = 0;
+}
+
+/* store an array index in a name hash table */
+static void add_name_hash( struct name_hash *hash, unsigned int value, int index )
+{
+    unsigned int pos, mask = hash->size - 1;
+
+    for (pos = value & mask; hash->slots[pos] != -1; pos = (pos + 1) & mask) /* nothing */;
+    hash->slots[pos] = index;
+}
+
+/* update a name hash table after an entry has been inserted in the array */
+static void insert_name_hash( struct name_hash *hash, const WCHAR *name, data_size_t len,
+                              int index, int count )
+{
+    unsigned int i;
+
+    if (!hash->size) return;
+    if (2 * count > hash->size)  /* too full, rebuild it on the next lookup */
+    {
+        free_name_hash( hash );
+        return;
+    }
+    for (i = 0; i < hash->size; i++) if (hash->slots[i] >= index) hash->slots[i]++;
+    add_name_hash( hash, hash_name( name, len ), index );
+}
+
+/* build the subkey hash table of a key if it has enough subkeys */
+static void build_subkey_hash( struct key *key )
+{
+    int i;
+
+    if (key->last_subkey + 1 < MIN_HASHED) return;
+    if (!alloc_name_hash( &key->subkey_hash, key->last_subkey + 1 )) return;
+    for (i = 0; i <= key->last_subkey; i++)
+        add_name_hash( &key->subkey_hash, hash_name( key->subkeys[i]->name, key->subkeys[i]->namelen ), i );
+}
+
+/* build the value hash table of a key if it has enough values */
+static void build_value_hash( struct key *key )
+{
+    int i;
+
+    if (key->last_value + 1 < MIN_HASHED) return;
+    if (!alloc_name_hash( &key->value_hash, key->last_value + 1 )) return;
+    for (i = 0; i <= key->last_value; i++)
+        add_name_hash( &key->value_hash, hash_name( key->values[i].name, key->values[i].namelen ), i );
+}
+
 /* try to grow the array of subkeys; return 1 if OK, 0 on error */
 static int grow_subkeys( struct key *key )
 {
@@ -623,6 +760,8 @@ static struct key *alloc_subkey( struct key *parent, const struct unicode_str *n
         parent->subkeys[index] = key;
         if (is_wow6432node( key->name, key->namelen ) && !is_wow6432node( parent->name, parent->namelen ))
             parent->flags |= KEY_WOW64;
+        insert_name_hash( &parent->subkey_hash, key->name, key->namelen, index, parent->last_subkey + 1 );
+        invalidate_path_cache();
     }
     return key;
 }
@@ -642,6 +781,8 @@ static void free_subkey( struct key *parent, int index )
     key->flags |= KEY_DELETED;
     key->parent = NULL;
     if (is_wow6432node( key->name, key->namelen )) parent->flags &= ~KEY_WOW64;
+    free_name_hash( &parent->subkey_hash );
+    invalidate_path_cache();
     release_object( key );
 
     /* try to shrink the array */
@@ -658,11 +799,28 @@ static void free_subkey( struct key *parent, int index )
 }
 
 /* find the named child of a given key and return its index */
-static struct key *find_subkey( const struct key *key, const struct unicode_str *name, int *index )
+static struct key *find_subkey( struct key *key, const struct unicode_str *name, int *index )
 {
     int i, min, max, res;
     data_size_t len;
 
+    if (!key->subkey_hash.size) build_subkey_hash( key );
+    if (key->subkey_hash.size)
+    {
+        unsigned int pos, mask = key->subkey_hash.size - 1;
+
+        for (pos = hash_name( name->str, name->len ) & mask;
+             (i = key->subkey_hash.slots[pos]) != -1;
+             pos = (pos + 1) & mask)
+        {
+            if (key->subkeys[i]->namelen != name->len) continue;
+            if (memicmpW( key->subkeys[i]->name, name->str, name->len / sizeof(WCHAR) )) continue;
+            *index = i;
+            return key->subkeys[i];
+        }
+        /* not found, the binary search only has to compute the insertion index */
+    }
+
     min = 0;
     max = key->last_subkey;
     while (min <= max)
@@ -763,12 +921,36 @@ static struct key *open_key_prefix( struct key *key, const struct unicode_str *n
     return key;
 }
 
+/* return the path cache entry that a given path would be stored in */
+static struct path_cache_entry *get_path_cache_entry( struct key *parent, const struct unicode_str *name )
+{
+    unsigned int hash;
+
+    if (name->len > sizeof(path_cache[0].path)) return NULL;
+    hash = hash_name( name->str, name->len ) ^ (unsigned int)((unsigned long)parent >> 4);
+    return &path_cache[hash % PATH_CACHE_SIZE];
+}
+
 /* open a subkey */
 static struct key *open_key( struct key *key, const struct unicode_str *name, unsigned int access,
                              unsigned int attributes )
 {
     int index;
     struct unicode_str token;
+    struct key *parent = key;
+    struct path_cache_entry *entry;
+    unsigned int flags = (access & (KEY_WOW64_32KEY | KEY_WOW64_64KEY)) | (attributes & OBJ_OPENLINK);
+
+    if ((entry = get_path_cache_entry( parent, name )) &&
+        entry->generation == tree_generation && entry->parent == parent &&
+        entry->flags == flags && entry->len == name->len &&
+        !memicmpW( entry->path, name->str, name->len / sizeof(WCHAR) ))
+    {
+        key = entry->key;
+        if (debug_level > 1) dump_operation( key, NULL, "Open" );
+        grab_object( key );
+        return key;
+    }
 
     if (!(key = open_key_prefix( key, name, access, &token, &index ))) return NULL;
 
@@ -783,6 +965,15 @@ static struct key *open_key( struct key *key, const struct unicode_str *name, un
         set_error( STATUS_OBJECT_NAME_NOT_FOUND );
         return NULL;
     }
+    if (entry)
+    {
+        entry->parent     = parent;
+        entry->key        = key;
+        entry->generation = tree_generation;
+        entry->flags      = flags;
+        entry->len        = name->len;
+        memcpy( entry->path, name->str, name->len );
+    }
     if (debug_level > 1) dump_operation( key, NULL, "Open" );
     grab_object( key );
     return key;
@@ -1065,11 +1256,27 @@ static int grow_values( struct key *key )
 }
 
 /* find the named value of a given key and return its index in the array */
-static struct key_value *find_value( const struct key *key, const struct unicode_str *name, int *index )
+static struct key_value *find_value( struct key *key, const struct unicode_str *name, int *index )
 {
     int i, min, max, res;
     data_size_t len;
 
+    if (!key->value_hash.size) build_value_hash( key );
+    if (key->value_hash.size)
+    {
+        unsigned int pos, mask = key->value_hash.size - 1;
+
+        for (pos = hash_name( name->str, name->len ) & mask;
+             (i = key->value_hash.slots[pos]) != -1;
+             pos = (pos + 1) & mask)
+        {
+            if (key->values[i].namelen != name->len) continue;
+            if (memicmpW( key->values[i].name, name->str, name->len / sizeof(WCHAR) )) continue;
+            *index = i;
+            return &key->values[i];
+        }
+    }
+
     min = 0;
     max = key->last_value;
     while (min <= max)
@@ -1113,6 +1320,7 @@ static struct key_value *insert_value( struct key *key, const struct unicode_str
     value->namelen = name->len;
     value->len     = 0;
     value->data    = NULL;
+    insert_name_hash( &key->value_hash, new_name, name->len, index, key->last_value + 1 );
     return value;
 }
 
@@ -1160,6 +1368,7 @@ static void set_value( struct key *key, const struct unicode_str *name,
     value->type  = type;
     value->len   = len;
     value->data  = ptr;
+    if (key->flags & KEY_SYMLINK) invalidate_path_cache();
     touch_key( key, REG_NOTIFY_CHANGE_LAST_SET );
     if (debug_level > 1) dump_operation( key, value, "Set" );
 }
@@ -1251,6 +1460,8 @@ static void delete_value( struct key *key, const struct unicode_str *name )
     free( value->data );
     for (i = index; i < key->last_value; i++) key->values[i] = key->values[i + 1];
     key->last_value--;
+    free_name_hash( &key->value_hash );
+    if (key->flags & KEY_SYMLINK) invalidate_path_cache();
     touch_key( key, REG_NOTIFY_CHANGE_LAST_SET );
 
     /* try to shrink the array */
@@ -1487,7 +1698,11 @@ static int load_key_option( struct key *key, const char *buffer, struct file_loa
         if (!(key->class = memdup( info->tmp, len ))) len = 0;
         key->classlen = len;
     }
-    if (!strncmp( buffer, "#link", 5 )) key->flags |= KEY_SYMLINK;
+    if (!strncmp( buffer, "#link", 5 ))
+    {
+        key->flags |= KEY_SYMLINK;
+        invalidate_path_cache();
+    }
     /* ignore unknown options */
     return 1;
 }
@@ -1542,6 +1757,7 @@ static struct key_value *parse_value_name( struct key *key, const char *buffer,
     (*len)++;
     while (isspace(buffer[*len])) (*len)++;
     if (!(value = find_value( key, &name, &index ))) value = insert_value( key, &name, index );
+    if (key->flags & KEY_SYMLINK) invalidate_path_cache();
     return value;
 
  error:
@@ -1732,33 +1948,627 @@ static void load_registry( struct key *key, obj_handle_t handle )
         {
             load_keys( key, NULL, f, -1 );
             fclose( f );
+            /* the loaded keys have to be written to the journal too */
+            make_subtree_dirty( key );
+            if (key->parent) make_dirty( key->parent );
         }
         else file_set_error();
     }
 }
 
+/* binary hives
+ *
+ * When WINEREGISTRYFORMAT=binary is set, each branch is also stored in a binary
+ * snapshot (<file>.bin) that is mapped and loaded without any parsing, and
+ * periodic saves only append the modified keys to a journal (<file>.log).
+ * The text files are still written on shutdown; the snapshot records the
+ * size and time of the text file it matches, so that editing the text file
+ * makes the server load it instead.
+ */
+
+#define HIVE_VERSION        1
+
+#define HIVE_RECORD_KEY     1     /* contents of a key */
+#define HIVE_RECORD_COMMIT  2     /* end of a journal transaction */
+
+#define HIVE_KEY_SYMLINK    0x01  /* key is a symbolic link */
+#define HIVE_KEY_SUBKEYS    0x02  /* record contains the complete list of subkey names */
+
+static const char hive_magic[8] = {'W','I','N','E','H','I','V','E'};
+static const char journal_magic[8] = {'W','I','N','E','J','R','N','L'};
+
+struct hive_header
+{
+    char          magic[8];    /* hive_magic or journal_magic */
+    unsigned int  version;     /* HIVE_VERSION */
+    unsigned int  arch;        /* prefix type */
+    timeout_t     serial;      /* snapshot identifier, stored in its journal too */
+    file_pos_t    text_size;   /* size of the matching text file, ~0 if it didn't exist */
+    file_pos_t    text_mtime;  /* modification time of the matching text file */
+    file_pos_t    text_ino;    /* inode of the matching text file */
+};
+
+struct hive_record
+{
+    data_size_t   size;        /* size of the record including this header, multiple of 8 */
+    unsigned int  type;        /* HIVE_RECORD_* */
+    timeout_t     modif;       /* key modification time */
+    unsigned int  flags;       /* HIVE_KEY_* */
+    data_size_t   pathlen;     /* length of the path relative to the branch, in bytes */
+    data_size_t   classlen;    /* length of the key class, in bytes */
+    unsigned int  values;      /* number of values */
+    unsigned int  subkeys;     /* number of subkey names */
+    unsigned int  __pad;
+    /* followed by the path and class, then the values and the subkey names, 4-byte aligned */
+};
+
+struct hive_value
+{
+    data_size_t   namelen;     /* length of the name in bytes */
+    unsigned int  type;        /* value type */
+    data_size_t   len;         /* length of the data in bytes */
+    /* followed by the name and data */
+};
+
+/* growable buffer used to build hive data before writing it */
+struct hive_buffer
+{
+    char         *data;
+    size_t        pos;
+    size_t        size;
+};
+
+/* bounds-checked reader for a record of a mapped hive */
+struct hive_reader
+{
+    const char   *start;
+    const char   *ptr;
+    const char   *end;
+};
+
+static int use_binary_hive;  /* save the binary hives, they are loaded in any case */
+
+/* reserve space at the end of a hive buffer */
+static void *reserve_hive_data( struct hive_buffer *buf, size_t size )
+{
+    void *ptr;
+
+    if (!buf->data || size > buf->size - buf->pos)
+    {
+        size_t new_size = max( 2 * buf->size, buf->pos + size + 4096 );
+        char *new_data;
+
+        if (!(new_data = realloc( buf->data, new_size ))) return NULL;
+        buf->data = new_data;
+        buf->size = new_size;
+    }
+    ptr = buf->data + buf->pos;
+    buf->pos += size;
+    return ptr;
+}
+
+static int append_hive_data( struct hive_buffer *buf, const void *data, size_t size )
+{
+    void *ptr = reserve_hive_data( buf, size );
+
+    if (ptr && size) memcpy( ptr, data, size );
+    return ptr != NULL;
+}
+
+static int align_hive_buffer( struct hive_buffer *buf, size_t align )
+{
+    size_t pad = (align - buf->pos % align) % align;
+    void *ptr = reserve_hive_data( buf, pad );
+
+    if (ptr) memset( ptr, 0, pad );
+    return ptr != NULL;
+}
+
+/* append the path of a key relative to the branch base */
+static int append_hive_path( struct hive_buffer *buf, const struct key *key, const struct key *base )
+{
+    static const WCHAR backslash = '\\';
+
+    if (key == base) return 1;
+    if (key->parent != base)
+    {
+        if (!append_hive_path( buf, key->parent, base )) return 0;
+        if (!append_hive_data( buf, &backslash, sizeof(backslash) )) return 0;
+    }
+    return append_hive_data( buf, key->name, key->namelen );
+}
+
+/* append a record containing the contents of a key, and optionally its subkey names */
+static int append_hive_key( struct hive_buffer *buf, const struct key *key, const struct key *base,
+                            int with_subkeys )
+{
+    struct hive_record rec;
+    struct hive_value val;
+    size_t start = buf->pos;
+    int i;
+
+    memset( &rec, 0, sizeof(rec) );
+    rec.type  = HIVE_RECORD_KEY;
+    rec.modif = key->modif;
+    if (key->flags & KEY_SYMLINK) rec.flags |= HIVE_KEY_SYMLINK;
+    if (with_subkeys) rec.flags |= HIVE_KEY_SUBKEYS;
+
+    if (!reserve_hive_data( buf, sizeof(rec) )) return 0;
+    if (!append_hive_path( buf, key, base )) return 0;
+    rec.pathlen = buf->pos - start - sizeof(rec);
+    rec.classlen = key->classlen;
+    if (!append_hive_data( buf, key->class, key->classlen )) return 0;
+    if (!align_hive_buffer( buf, 4 )) return 0;
+
+    for (i = 0; i <= key->last_value; i++)
+    {
+        val.namelen = key->values[i].namelen;
+        val.type    = key->values[i].type;
+        val.len     = key->values[i].len;
+        if (!append_hive_data( buf, &val, sizeof(val) )) return 0;
+        if (!append_hive_data( buf, key->values[i].name, val.namelen )) return 0;
+        if (!append_hive_data( buf, key->values[i].data, val.len )) return 0;
+        if (!align_hive_buffer( buf, 4 )) return 0;
+        rec.values++;
+    }
+
+    for (i = 0; with_subkeys && i <= key->last_subkey; i++)
+    {
+        data_size_t len = key->subkeys[i]->namelen;
+
+        if (key->subkeys[i]->flags & KEY_VOLATILE) continue;
+        if (!append_hive_data( buf, &len, sizeof(len) )) return 0;
+        if (!append_hive_data( buf, key->subkeys[i]->name, len )) return 0;
+        if (!align_hive_buffer( buf, 4 )) return 0;
+        rec.subkeys++;
+    }
+
+    if (!align_hive_buffer( buf, 8 )) return 0;
+    rec.size = buf->pos - start;
+    memcpy( buf->data + start, &rec, sizeof(rec) );
+    return 1;
+}
+
+/* append records for a key and all its non-volatile subkeys */
+static int append_hive_tree( struct hive_buffer *buf, const struct key *key, const struct key *base )
+{
+    int i;
+
+    if (key->flags & KEY_VOLATILE) return 1;
+    if (!append_hive_key( buf, key, base, 0 )) return 0;
+    for (i = 0; i <= key->last_subkey; i++)
+        if (!append_hive_tree( buf, key->subkeys[i], base )) return 0;
+    return 1;
+}
+
+/* append records for the modified keys; a modified key lists its subkeys so that deletions are replayed */
+static int append_hive_dirty_keys( struct hive_buffer *buf, const struct key *key, const struct key *base )
+{
+    int i;
+
+    if ((key->flags & KEY_VOLATILE) || !(key->flags & KEY_DIRTY)) return 1;
+    if (!append_hive_key( buf, key, base, 1 )) return 0;
+    for (i = 0; i <= key->last_subkey; i++)
+        if (!append_hive_dirty_keys( buf, key->subkeys[i], base )) return 0;
+    return 1;
+}
+
+static void init_hive_header( struct hive_header *header, const char *magic, timeout_t serial )
+{
+    memset( header, 0, sizeof(*header) );
+    memcpy( header->magic, magic, sizeof(header->magic) );
+    header->version   = HIVE_VERSION;
+    header->arch      = prefix_type;
+    header->serial    = serial;
+    header->text_size = ~(file_pos_t)0;
+}
+
+static int write_hive_data( int fd, const char *data, size_t size )
+{
+    ssize_t ret;
+
+    while (size)
+    {
+        if ((ret = write( fd, data, size )) == -1)
+        {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        data += ret;
+        size -= ret;
+    }
+    return 1;
+}
+
+static char *get_hive_path( const char *path, const char *ext )
+{
+    char *ret;
+
+    if ((ret = malloc( strlen(path) + strlen(ext) + 1 )))
+    {
+        strcpy( ret, path );
+        strcat( ret, ext );
+    }
+    return ret;
+}
+
+/* write a complete snapshot of a branch and start a new journal */
+static int save_hive( struct save_branch_info *info )
+{
+    struct hive_buffer buf = { NULL, 0, 0 };
+    struct hive_header header;
+    struct stat st;
+    char *tmp;
+    int fd, ret = 0;
+
+    if (!(tmp = get_hive_path( info->hive_path, ".tmp" ))) return 0;
+
+    init_hive_header( &header, hive_magic, max( current_time, info->hive_serial + 1 ));
+    if (!stat( info->path, &st ))
+    {
+        header.text_size  = st.st_size;
+        header.text_mtime = st.st_mtime;
+        header.text_ino   = st.st_ino;
+    }
+    if (!append_hive_data( &buf, &header, sizeof(header) )) goto done;
+    if (!append_hive_tree( &buf, info->key, info->key )) goto done;
+
+    if ((fd = open( tmp, O_CREAT | O_TRUNC | O_WRONLY, 0666 )) == -1) goto done;
+    ret = write_hive_data( fd, buf.data, buf.pos );
+    if (close( fd ) == -1) ret = 0;
+    if (ret) ret = !rename( tmp, info->hive_path );
+    if (!ret)
+    {
+        unlink( tmp );
+        goto done;
+    }
+
+    if (debug_level > 1) fprintf( stderr, "%s: saved %lu bytes\n", info->hive_path, (unsigned long)buf.pos );
+    unlink( info->journal_path );
+    info->hive_serial  = header.serial;
+    info->hive_size    = buf.pos;
+    info->journal_size = 0;
+
+done:
+    free( buf.data );
+    free( tmp );
+    return ret;
+}
+
+/* append the modified keys of a branch to its journal */
+static int save_journal( struct save_branch_info *info )
+{
+    struct hive_buffer buf = { NULL, 0, 0 };
+    struct hive_header header;
+    struct hive_record commit;
+    int fd, ret = 0;
+
+    /* start over from a new snapshot once the journal is larger than it */
+    if (!info->hive_serial || info->journal_size > info->hive_size) return save_hive( info );
+
+    if (!info->journal_size)
+    {
+        init_hive_header( &header, journal_magic, info->hive_serial );
+        if (!append_hive_data( &buf, &header, sizeof(header) )) goto done;
+    }
+    if (!append_hive_dirty_keys( &buf, info->key, info->key )) goto done;
+    memset( &commit, 0, sizeof(commit) );
+    commit.size = sizeof(commit);
+    commit.type = HIVE_RECORD_COMMIT;
+    if (!append_hive_data( &buf, &commit, sizeof(commit) )) goto done;
+
+    if ((fd = open( info->journal_path, O_CREAT | O_WRONLY, 0666 )) == -1) goto done;
+    ret = lseek( fd, info->journal_size, SEEK_SET ) != -1 &&
+          write_hive_data( fd, buf.data, buf.pos ) &&
+          !ftruncate( fd, info->journal_size + buf.pos );
+    /* an incomplete transaction is ignored on load, but don't leave it behind */
+    if (!ret) ftruncate( fd, info->journal_size );
+    if (close( fd ) == -1) ret = 0;
+    if (ret)
+    {
+        if (debug_level > 1) fprintf( stderr, "%s: appended %lu bytes\n", info->journal_path, (unsigned long)buf.pos );
+        info->journal_size += buf.pos;
+    }
+
+done:
+    free( buf.data );
+    return ret;
+}
+
+/* save the modified keys of a branch to its binary hive */
+static int save_branch_hive( struct save_branch_info *info )
+{
+    if (!(info->key->flags & KEY_DIRTY)) return 1;
+    if (!save_journal( info )) return 0;
+    make_clean( info->key );
+    info->text_stale = 1;
+    return 1;
+}
+
+static const void *read_hive_data( struct hive_reader *reader, size_t size )
+{
+    const char *ptr = reader->ptr;
+
+    if (size > (size_t)(reader->end - ptr)) return NULL;
+    reader->ptr += size;
+    return ptr;
+}
+
+static int align_hive_reader( struct hive_reader *reader, size_t align )
+{
+    size_t pad = (align - (reader->ptr - reader->start) % align) % align;
+    return read_hive_data( reader, pad ) != NULL;
+}
+
+/* compare two key names the same way as find_subkey */
+static int compare_key_names( const WCHAR *name1, data_size_t len1, const WCHAR *name2, data_size_t len2 )
+{
+    int res = memicmpW( name1, name2, min( len1, len2 ) / sizeof(WCHAR) );
+    if (!res) res = len1 - len2;
+    return res;
+}
+
+/* delete the subkeys of a key that don't appear in the sorted name list of a journal record */
+static void delete_stale_subkeys( struct key *key, const struct unicode_str *names, int count )
+{
+    int i, res, j = count - 1;
+
+    for (i = key->last_subkey; i >= 0; i--)
+    {
+        struct key *subkey = key->subkeys[i];
+
+        res = -1;
+        while (j >= 0 && (res = compare_key_names( names[j].str, names[j].len,
+                                                   subkey->name, subkey->namelen )) > 0) j--;
+        if (j >= 0 && !res) continue;
+        if (!(subkey->flags & KEY_VOLATILE)) delete_key( subkey, 1 );
+    }
+}
+
+/* replace all the values of a key */
+static void clear_key_values( struct key *key )
+{
+    int i;
+
+    for (i = 0; i <= key->last_value; i++)
+    {
+        free( key->values[i].name );
+        free( key->values[i].data );
+    }
+    key->last_value = -1;
+    free_name_hash( &key->value_hash );
+}
+
+/* load a key record into a branch */
+static int load_hive_key( struct key *base, const struct hive_record *rec )
+{
+    struct hive_reader reader;
+    struct unicode_str path, name, *names = NULL;
+    const struct hive_value *val;
+    const data_size_t *len;
+    struct key_value *value;
+    struct key *key;
+    const void *class, *data;
+    unsigned int i;
+    int index, ret = 0;
+
+    reader.start = (const char *)rec;
+    reader.ptr   = reader.start + sizeof(*rec);
+    reader.end   = reader.start + rec->size;
+
+    if ((rec->pathlen | rec->classlen) % sizeof(WCHAR)) return 0;
+    if (rec->subkeys > rec->size / sizeof(data_size_t)) return 0;
+    if (!(path.str = read_hive_data( &reader, rec->pathlen ))) return 0;
+    path.len = rec->pathlen;
+    if (!(class = read_hive_data( &reader, rec->classlen ))) return 0;
+    if (!align_hive_reader( &reader, 4 )) return 0;
+
+    if (path.len) key = create_key_recursive( base, &path, rec->modif );
+    else key = (struct key *)grab_object( base );
+    if (!key) return 0;
+
+    clear_key_values( key );
+    for (i = 0; i < rec->values; i++)
+    {
+        if (!(val = read_hive_data( &reader, sizeof(*val) ))) goto done;
+        if (val->namelen % sizeof(WCHAR)) goto done;
+        if (!(name.str = read_hive_data( &reader, val->namelen ))) goto done;
+        name.len = val->namelen;
+        if (!(data = read_hive_data( &reader, val->len ))) goto done;
+        if (!align_hive_reader( &reader, 4 )) goto done;
+
+        if ((value = find_value( key, &name, &index ))) free( value->data );
+        else if (!(value = insert_value( key, &name, index ))) goto done;
+        value->type = val->type;
+        value->len  = val->len;
+        value->data = NULL;
+        if (val->len && !(value->data = memdup( data, val->len ))) value->len = 0;
+    }
+
+    if (rec->flags & HIVE_KEY_SUBKEYS)
+    {
+        if (rec->subkeys && !(names = mem_alloc( rec->subkeys * sizeof(*names) ))) goto done;
+        for (i = 0; i < rec->subkeys; i++)
+        {
+            if (!(len = read_hive_data( &reader, sizeof(*len) ))) goto done;
+            if (!(names[i].str = read_hive_data( &reader, *len ))) goto done;
+            names[i].len = *len;
+            if (!align_hive_reader( &reader, 4 )) goto done;
+        }
+        delete_stale_subkeys( key, names, rec->subkeys );
+    }
+
+    free( key->class );
+    key->class = NULL;
+    key->classlen = 0;
+    if (rec->classlen && (key->class = memdup( class, rec->classlen ))) key->classlen = rec->classlen;
+    if (rec->flags & HIVE_KEY_SYMLINK)
+    {
+        key->flags |= KEY_SYMLINK;
+        invalidate_path_cache();
+    }
+    key->modif = rec->modif;
+    ret = 1;
+
+done:
+    free( names );
+    release_object( key );
+    return ret;
+}
+
+/* return the end of the complete records of a hive, or of the committed transactions of a journal */
+static size_t get_hive_records_end( const char *data, size_t size, int journal )
+{
+    const struct hive_record *rec;
+    size_t pos = sizeof(struct hive_header), end = pos;
+
+    while (size - pos >= sizeof(*rec))
+    {
+        rec = (const struct hive_record *)(data + pos);
+        if (rec->size < sizeof(*rec) || rec->size % 8 || rec->size > size - pos) break;
+        if (rec->type != HIVE_RECORD_KEY && (!journal || rec->type != HIVE_RECORD_COMMIT)) break;
+        pos += rec->size;
+        if (!journal || rec->type == HIVE_RECORD_COMMIT) end = pos;
+    }
+    return end;
+}
+
+static void load_hive_records( struct key *base, const char *path, const char *data, size_t end )
+{
+    const struct hive_record *rec;
+    size_t pos;
+
+    for (pos = sizeof(struct hive_header); pos < end; pos += rec->size)
+    {
+        rec = (const struct hive_record *)(data + pos);
+        if (rec->type != HIVE_RECORD_KEY) continue;
+        if (!load_hive_key( base, rec ))
+            fprintf( stderr, "%s:%lu: invalid key record\n", path, (unsigned long)pos );
+    }
+}
+
+/* map a hive file in memory */
+static char *map_hive_file( const char *path, size_t *size )
+{
+    struct stat st;
+    void *ptr;
+    int fd;
+
+    if ((fd = open( path, O_RDONLY )) == -1) return NULL;
+    if (fstat( fd, &st ) == -1 || st.st_size < (off_t)sizeof(struct hive_header) || st.st_size != (size_t)st.st_size)
+    {
+        close( fd );
+        return NULL;
+    }
+    ptr = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if (ptr == MAP_FAILED) return NULL;
+    *size = st.st_size;
+    return ptr;
+}
+
+static const struct hive_header *get_hive_header( const char *data, const char *magic )
+{
+    const struct hive_header *header = (const struct hive_header *)data;
+
+    if (memcmp( header->magic, magic, sizeof(header->magic) )) return NULL;
+    if (header->version != HIVE_VERSION) return NULL;
+    return header;
+}
+
+/* load a branch from its binary hive and journal, if they still match the text file */
+static int load_hive( struct save_branch_info *info )
+{
+    const struct hive_header *header, *journal_header;
+    struct stat st;
+    char *hive, *journal;
+    size_t hive_size, journal_size, end;
+    int ret = 0;
+
+    if (!(hive = map_hive_file( info->hive_path, &hive_size ))) return 0;
+    if (!(header = get_hive_header( hive, hive_magic ))) goto done;
+
+    if (stat( info->path, &st ))
+    {
+        if (header->text_size != ~(file_pos_t)0) goto done;
+    }
+    else if (header->text_size != st.st_size || header->text_mtime != st.st_mtime ||
+             header->text_ino != st.st_ino) goto done;
+
+    if (header->arch != PREFIX_UNKNOWN)
+    {
+        if (prefix_type == PREFIX_UNKNOWN) prefix_type = header->arch;
+        else if (header->arch != prefix_type) goto done;
+    }
+    if (get_hive_records_end( hive, hive_size, 0 ) != hive_size) goto done;
+
+    load_hive_records( info->key, info->hive_path, hive, hive_size );
+    info->hive_serial  = header->serial;
+    info->hive_size    = hive_size;
+    info->journal_size = 0;
+    ret = 1;
+
+    if ((journal = map_hive_file( info->journal_path, &journal_size )))
+    {
+        if ((journal_header = get_hive_header( journal, journal_magic )) &&
+            journal_header->serial == header->serial)
+        {
+            end = get_hive_records_end( journal, journal_size, 1 );
+            load_hive_records( info->key, info->journal_path, journal, end );
+            /* the text file doesn't contain the journal changes */
+            if (end > sizeof(*journal_header)) info->text_stale = 1;
+            info->journal_size = end;
+        }
+        munmap( journal, journal_size );
+    }
+    make_clean( info->key );
+
+done:
+    munmap( hive, hive_size );
+    return ret;
+}
+
 /* load one of the initial registry files */
 static int load_init_registry_from_file( const char *filename, struct key *key )
 {
+    struct save_branch_info *info;
     FILE *f;
+    int ret = 1;
+
+    assert( save_branch_count < MAX_SAVE_BRANCH_INFO );
 
-    if ((f = fopen( filename, "r" )))
+    info = &save_branch_info[save_branch_count];
+    info->path = filename;
+    info->key  = key;
+    info->hive_path    = get_hive_path( filename, ".bin" );
+    info->journal_path = get_hive_path( filename, ".log" );
+    if (!info->hive_path || !info->journal_path) fatal_error( "out of memory\n" );
+
+    /* the hive is loaded even with text files, its journal may contain changes that never
+     * made it to the text file if the server didn't exit cleanly while using binary hives */
+    if (load_hive( info ))
+    {
+        if (!use_binary_hive && info->text_stale) make_dirty( key );
+    }
+    else
     {
-        load_keys( key, filename, f, 0 );
-        fclose( f );
-        if (get_error() == STATUS_NOT_REGISTRY_FILE)
+        if ((f = fopen( filename, "r" )))
         {
-            fprintf( stderr, "%s is not a valid registry file\n", filename );
-            return 1;
+            load_keys( key, filename, f, 0 );
+            fclose( f );
+            if (get_error() == STATUS_NOT_REGISTRY_FILE)
+            {
+                fprintf( stderr, "%s is not a valid registry file\n", filename );
+                return 1;
+            }
         }
+        ret = (f != NULL);
     }
 
-    assert( save_branch_count < MAX_SAVE_BRANCH_INFO );
-
-    save_branch_info[save_branch_count].path = filename;
-    save_branch_info[save_branch_count++].key = (struct key *)grab_object( key );
+    save_branch_count++;
+    grab_object( key );
     make_object_static( &key->obj );
-    return (f != NULL);
+    return ret;
 }
 
 static WCHAR *format_user_registry_path( const SID *sid, struct unicode_str *path )
@@ -1834,6 +2644,8 @@ void init_registry(void)
 
     if (fchdir( config_dir_fd ) == -1) fatal_error( "chdir to config dir: %s\n", strerror( errno ));
 
+    if ((p = getenv( "WINEREGISTRYFORMAT" )) && !strcmp( p, "binary" )) use_binary_hive = 1;
+
     /* create the root key */
     root_key = alloc_key( &root_name, current_time );
     assert( root_key );
@@ -1878,6 +2690,7 @@ void init_registry(void)
         if ((key = create_key_recursive( hklm, &classes_name, current_time )))
         {
             key->flags |= KEY_WOWSHARE;
+            invalidate_path_cache();
             release_object( key );
         }
         /* FIXME: handle HKCU too */
@@ -2028,8 +2841,15 @@ static void periodic_save( void *arg )
 
     if (fchdir( config_dir_fd ) == -1) return;
     save_timeout_user = NULL;
-    for (i = 0; i < save_branch_count; i++)
-        save_branch( save_branch_info[i].key, save_branch_info[i].path );
+    if (use_binary_hive)
+    {
+        for (i = 0; i < save_branch_count; i++) save_branch_hive( &save_branch_info[i] );
+    }
+    else
+    {
+        for (i = 0; i < save_branch_count; i++)
+            save_branch( save_branch_info[i].key, save_branch_info[i].path );
+    }
     if (fchdir( server_dir_fd ) == -1) fatal_error( "chdir to server dir: %s\n", strerror( errno ));
     set_periodic_save_timer();
 }
@@ -2049,10 +2869,22 @@ void flush_registry(void)
     if (fchdir( config_dir_fd ) == -1) return;
     for (i = 0; i < save_branch_count; i++)
     {
-        if (!save_branch( save_branch_info[i].key, save_branch_info[i].path ))
+        struct save_branch_info *info = &save_branch_info[i];
+        int dirty;
+
+        if (info->text_stale) make_dirty( info->key );
+        dirty = info->key->flags & KEY_DIRTY;
+        if (!save_branch( info->key, info->path ))
+        {
+            fprintf( stderr, "wineserver: could not save registry branch to %s", info->path );
+            perror( " " );
+            continue;
+        }
+        info->text_stale = 0;
+        /* the snapshot has to be rewritten to match the new text file */
+        if (use_binary_hive && (dirty || !info->hive_serial) && !save_hive( info ))
         {
-            fprintf( stderr, "wineserver: could not save registry branch to %s",
-                     save_branch_info[i].path );
+            fprintf( stderr, "wineserver: could not save registry branch to %s", info->hive_path );
             perror( " " );
         }
     }
@@ -67,6 +67,7 @@
 #include "process.h"
 #include "thread.h"
 #include "security.h"
+#include "fsync.h"
 #define WANT_REQUEST_HANDLERS
 #include "request.h"
 
@@ -135,6 +136,7 @@ int config_dir_fd = -1;    /* file descriptor for the config dir */
 
 static struct master_socket *master_socket;  /* the master socket object */
 static struct timeout_user *master_timeout;
+static int in_batch;  /* currently performing a request of a batch */
 
 /* complain about a protocol error and terminate the client connection */
 void fatal_protocol_error( struct thread *thread, const char *err, ... )
@@ -254,6 +256,22 @@ void write_reply( struct thread *thread )
         fatal_protocol_error( thread, "reply write: %s\n", strerror( errno ));
 }
 
+/* send a reply through the request shared memory */
+static void send_shm_reply( union generic_reply *reply )
+{
+    request_shm_t *shm = current->request_shm;
+
+    current->shm_request = 0;
+    memcpy( shm->data, reply, sizeof(*reply) );
+    if (current->reply_size)
+        memcpy( shm->data + sizeof(*reply), current->reply_data, current->reply_size );
+    free( current->reply_data );
+    current->reply_data = NULL;
+    __atomic_store_n( &shm->state, REQUEST_SHM_REPLY, __ATOMIC_SEQ_CST );
+    /* the client sets client_waiting before checking the state a last time */
+    if (__atomic_load_n( &shm->client_waiting, __ATOMIC_SEQ_CST )) futex_wake( &shm->state, 1 );
+}
+
 /* send a reply to the current thread */
 static void send_reply( union generic_reply *reply )
 {
@@ -296,11 +314,55 @@ static void send_reply( union generic_reply *reply )
         fatal_protocol_error( current, "reply write: %s\n", strerror( errno ));
 }
 
+/* statistics of the calls to a request handler */
+struct req_stats
+{
+    unsigned int     count;
+    unsigned __int64 time;
+    unsigned int     latency[REQUEST_LATENCY_BUCKETS];
+};
+
+static struct req_stats req_stats[REQ_NB_REQUESTS];
+static timeout_t req_stats_start;  /* time of the last statistics reset */
+
+/* get a monotonic time in nanoseconds for the request statistics */
+static inline unsigned __int64 get_req_stats_time(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * (unsigned __int64)1000000000 + ts.tv_nsec;
+#else
+    struct timeval tv;
+
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec * (unsigned __int64)1000000000 + tv.tv_usec * 1000;
+#endif
+}
+
+/* account for a handler call in the request statistics */
+static inline void add_req_stats( enum request req, unsigned __int64 time )
+{
+    struct req_stats *stats = &req_stats[req];
+    unsigned int bucket = 0, usec = time / 1000;
+
+    while (usec && bucket < REQUEST_LATENCY_BUCKETS - 1)
+    {
+        usec >>= 1;
+        bucket++;
+    }
+    stats->count++;
+    stats->time += time;
+    stats->latency[bucket]++;
+}
+
 /* call a request handler */
 static void call_req_handler( struct thread *thread )
 {
     union generic_reply reply;
     enum request req = thread->req.request_header.req;
+    unsigned __int64 start;
 
     current = thread;
     current->reply_size = 0;
@@ -310,7 +372,12 @@ static void call_req_handler( struct thread *thread )
     if (debug_level) trace_request();
 
     if (req < REQ_NB_REQUESTS)
+    {
+        current->process->request_count++;
+        start = get_req_stats_time();
         req_handlers[req]( &current->req, &reply );
+        add_req_stats( req, get_req_stats_time() - start );
+    }
     else
         set_error( STATUS_NOT_IMPLEMENTED );
 
@@ -321,7 +388,8 @@ static void call_req_handler( struct thread *thread )
             reply.reply_header.error = current->error;
             reply.reply_header.reply_size = current->reply_size;
             if (debug_level) trace_reply( req, &reply );
-            send_reply( &reply );
+            if (current->shm_request) send_shm_reply( &reply );
+            else send_reply( &reply );
         }
         else
         {
@@ -332,6 +400,117 @@ static void call_req_handler( struct thread *thread )
     current = NULL;
 }
 
+/* handle a request passed in the request shared memory */
+static void read_shm_request( struct thread *thread )
+{
+    request_shm_t *shm = thread->request_shm;
+    data_size_t size;
+
+    memcpy( &thread->req, shm->data, sizeof(thread->req) );
+    size = thread->req.request_header.request_size;
+    if (size > sizeof(shm->data) - sizeof(thread->req) ||
+        thread->req.request_header.reply_size > sizeof(shm->data) - sizeof(union generic_reply))
+    {
+        fatal_protocol_error( thread, "request %d too large for shared memory\n",
+                              thread->req.request_header.req );
+        return;
+    }
+    if (size)
+    {
+        if (!(thread->req_data = malloc( size )))
+        {
+            fatal_protocol_error( thread, "no memory for %u bytes request %d\n",
+                                  size, thread->req.request_header.req );
+            return;
+        }
+        memcpy( thread->req_data, shm->data + sizeof(thread->req), size );
+    }
+    thread->shm_request = 1;
+    call_req_handler( thread );
+    free( thread->req_data );
+    thread->req_data = NULL;
+}
+
+static struct list request_shm_threads = LIST_INIT( request_shm_threads );
+static int request_shm_spin = -1;  /* number of polls before blocking */
+
+static inline void small_pause(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__( "rep;nop" : : : "memory" );
+#else
+    __asm__ __volatile__( "" : : : "memory" );
+#endif
+}
+
+/* handle all the requests stored in shared memory while the server was polling */
+static int handle_polled_requests(void)
+{
+    struct thread *thread;
+    int expected, count = 0;
+
+    for (;;)
+    {
+        LIST_FOR_EACH_ENTRY( thread, &request_shm_threads, struct thread, request_shm_entry )
+        {
+            expected = REQUEST_SHM_REQUEST;
+            if (__atomic_compare_exchange_n( &thread->request_shm->state, &expected, REQUEST_SHM_RUNNING,
+                                             0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ))
+                break;
+        }
+        if (&thread->request_shm_entry == &request_shm_threads) return count;
+
+        /* move it to the tail so that other threads get their turn */
+        list_remove( &thread->request_shm_entry );
+        list_add_tail( &request_shm_threads, &thread->request_shm_entry );
+        grab_object( thread );
+        read_shm_request( thread );
+        release_object( thread );
+        count++;
+    }
+}
+
+static void set_server_polling( int polling )
+{
+    struct thread *thread;
+
+    LIST_FOR_EACH_ENTRY( thread, &request_shm_threads, struct thread, request_shm_entry )
+        __atomic_store_n( &thread->request_shm->server_polling, polling, __ATOMIC_SEQ_CST );
+}
+
+/* poll the request shared memory for a while before the main loop blocks */
+/* returns the number of requests handled */
+int poll_request_shm(void)
+{
+    int i, count = 0;
+
+    if (list_empty( &request_shm_threads ) || !request_shm_spin) return 0;
+
+    set_server_polling( 1 );
+    for (i = 0; i < request_shm_spin && !count; i++)
+    {
+        if (!(count = handle_polled_requests())) small_pause();
+    }
+    set_server_polling( 0 );
+    /* a client that saw the flag still set didn't ring the doorbell */
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    return count + handle_polled_requests();
+}
+
+/* wake up a client waiting on its request shared memory and unmap it */
+void release_request_shm( struct thread *thread )
+{
+    request_shm_t *shm = thread->request_shm;
+
+    if (!shm) return;
+    list_remove( &thread->request_shm_entry );
+    __atomic_store_n( &shm->state, REQUEST_SHM_CLOSED, __ATOMIC_RELEASE );
+    futex_wake( &shm->state, 1 );
+    release_shared_memory( -1, shm, sizeof(*shm) );
+    thread->request_shm = NULL;
+    thread->shm_request = 0;
+}
+
 /* read a request from a thread */
 void read_request( struct thread *thread )
 {
@@ -340,7 +519,19 @@ void read_request( struct thread *thread )
     if (!thread->req_toread)  /* no pending request */
     {
         if ((ret = read( get_unix_fd( thread->request_fd ), &thread->req,
-                         sizeof(thread->req) )) != sizeof(thread->req)) goto error;
+                         sizeof(thread->req) )) != sizeof(thread->req))
+        {
+            /* a single byte signals a request in shared memory */
+            if (ret == 1 && thread->request_shm)
+            {
+                if (__atomic_load_n( &thread->request_shm->state, __ATOMIC_ACQUIRE ) != REQUEST_SHM_SIGNALED)
+                    fatal_protocol_error( thread, "no request in shared memory\n" );
+                else
+                    read_shm_request( thread );
+                return;
+            }
+            goto error;
+        }
         if (!(thread->req_toread = thread->req.request_header.request_size))
         {
             /* no data, handle request at once */
@@ -475,6 +666,13 @@ int send_client_fd( struct process *process, int fd, obj_handle_t handle )
     struct msghdr msghdr;
     int ret;
 
+    if (in_batch && current && process == current->process)
+    {
+        /* the batch caller doesn't receive fds, it would be picked up by a later call */
+        set_error( STATUS_NOT_SUPPORTED );
+        return -1;
+    }
+
 #ifdef HAVE_STRUCT_MSGHDR_MSG_ACCRIGHTS
     msghdr.msg_accrightslen = sizeof(fd);
     msghdr.msg_accrights = (void *)&fd;
@@ -916,3 +1114,221 @@ void close_master_socket( timeout_t timeout )
 
     master_timeout = add_timeout_user( timeout, close_socket_timeout, NULL );
 }
+
+/* check if a request can be performed as part of a batch */
+/* only requests that always reply at once and never send a file descriptor are allowed */
+static int is_batch_request_allowed( enum request req )
+{
+    switch (req)
+    {
+    case REQ_close_handle:
+    case REQ_dup_handle:
+    case REQ_set_handle_info:
+    case REQ_get_object_info:
+    case REQ_get_object_type:
+    case REQ_event_op:
+    case REQ_query_event:
+    case REQ_release_semaphore:
+    case REQ_query_semaphore:
+    case REQ_release_mutex:
+    case REQ_query_mutex:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* perform several independent requests in a single round-trip */
+DECL_HANDLER(batch)
+{
+    struct thread *thread = current;
+    const union generic_request batch_req = current->req;
+    void *batch_data = current->req_data;
+    const char *ptr = get_req_data(), *end = ptr + get_req_data_size();
+    data_size_t pos = 0, max_size = get_reply_max_size();
+    unsigned int error = STATUS_SUCCESS;
+    union generic_reply sub_reply;
+    char *replies = NULL;
+
+    if (max_size && !(replies = mem_alloc( max_size ))) return;
+
+    while (ptr < end)
+    {
+        enum request sub_req;
+        data_size_t size;
+
+        if (end - ptr < sizeof(union generic_request))
+        {
+            error = STATUS_INVALID_PARAMETER;
+            break;
+        }
+        memcpy( &thread->req, ptr, sizeof(thread->req) );
+        ptr += sizeof(union generic_request);
+        sub_req = thread->req.request_header.req;
+        size = thread->req.request_header.request_size;
+        if (size > end - ptr)
+        {
+            error = STATUS_INVALID_PARAMETER;
+            break;
+        }
+        if (sizeof(sub_reply) + BATCH_DATA_ALIGN( thread->req.request_header.reply_size ) > max_size - pos)
+        {
+            error = STATUS_BUFFER_OVERFLOW;
+            break;
+        }
+        thread->req_data = (void *)ptr;
+        ptr += BATCH_DATA_ALIGN( size );
+
+        thread->reply_size = 0;
+        thread->reply_data = NULL;
+        clear_error();
+        memset( &sub_reply, 0, sizeof(sub_reply) );
+
+        if (debug_level) trace_request();
+
+        if (is_batch_request_allowed( sub_req ))
+        {
+            in_batch = 1;
+            req_handlers[sub_req]( &thread->req, &sub_reply );
+            in_batch = 0;
+        }
+        else if (sub_req < REQ_NB_REQUESTS)
+            set_error( STATUS_NOT_SUPPORTED );
+        else
+            set_error( STATUS_NOT_IMPLEMENTED );
+
+        if (!current) break;  /* thread got killed */
+
+        sub_reply.reply_header.error = thread->error;
+        sub_reply.reply_header.reply_size = thread->reply_size;
+        if (debug_level) trace_reply( sub_req, &sub_reply );
+
+        memcpy( replies + pos, &sub_reply, sizeof(sub_reply) );
+        pos += sizeof(sub_reply);
+        if (thread->reply_size) memcpy( replies + pos, thread->reply_data, thread->reply_size );
+        pos += BATCH_DATA_ALIGN( thread->reply_size );
+        free( thread->reply_data );
+        thread->reply_data = NULL;
+    }
+
+    free( thread->reply_data );
+    thread->req = batch_req;
+    thread->req_data = batch_data;
+    thread->reply_size = 0;
+    thread->reply_data = NULL;
+
+    if (!current)
+    {
+        free( replies );
+        return;
+    }
+    set_error( error );
+    set_reply_data_ptr( replies, pos );
+}
+
+/* get file descriptor to the request shared memory of the current thread */
+DECL_HANDLER(get_request_shm)
+{
+    int fd;
+
+    if (current->request_shm)
+    {
+        set_error( STATUS_INVALID_PARAMETER );
+        return;
+    }
+    if (!allocate_shared_memory( &fd, (void **)&current->request_shm, sizeof(*current->request_shm) ))
+    {
+        set_error( STATUS_NOT_SUPPORTED );
+        return;
+    }
+    if (request_shm_spin == -1)
+    {
+        const char *str = getenv( "WINESERVERSHMSPIN" );
+        if (str) request_shm_spin = max( atoi( str ), 0 );
+        else request_shm_spin = sysconf( _SC_NPROCESSORS_ONLN ) > 1 ? 2000 : 0;
+    }
+    list_add_tail( &request_shm_threads, &current->request_shm_entry );
+    send_client_fd( current->process, fd, 0 );
+    close( fd );
+}
+
+static int reset_process_stats( struct process *process, void *arg )
+{
+    process->request_count = 0;
+    return 0;
+}
+
+/* retrieve the statistics of the requests handled by the server */
+DECL_HANDLER(get_server_stats)
+{
+    struct request_stats *stats;
+    unsigned int i, count = 0;
+
+    for (i = 0; i < REQ_NB_REQUESTS; i++) if (req_stats[i].count) count++;
+
+    reply->start_time = req_stats_start ? req_stats_start : server_start_time;
+    reply->count = count;
+
+    if (get_reply_max_size() < count * sizeof(*stats))
+    {
+        set_error( STATUS_BUFFER_TOO_SMALL );
+        return;
+    }
+    if (!(stats = set_reply_data_size( count * sizeof(*stats) ))) return;
+
+    for (i = 0; i < REQ_NB_REQUESTS; i++)
+    {
+        if (!req_stats[i].count) continue;
+        memset( stats, 0, sizeof(*stats) );
+        snprintf( stats->name, sizeof(stats->name), "%s", get_req_name( i ));
+        stats->count = req_stats[i].count;
+        stats->time  = req_stats[i].time;
+        memcpy( stats->latency, req_stats[i].latency, sizeof(stats->latency) );
+        stats++;
+    }
+
+    if (req->reset)
+    {
+        memset( req_stats, 0, sizeof(req_stats) );
+        req_stats_start = current_time;
+        enum_processes( reset_process_stats, NULL );
+    }
+}
+
+struct process_stats_info
+{
+    struct process_request_stats *stats;
+    unsigned int                  count;
+};
+
+static int get_process_stats( struct process *process, void *arg )
+{
+    struct process_stats_info *info = arg;
+
+    if (info->stats)
+    {
+        info->stats[info->count].pid   = process->id;
+        info->stats[info->count].count = process->request_count;
+    }
+    info->count++;
+    return 0;
+}
+
+/* retrieve the number of requests sent by each process */
+DECL_HANDLER(get_server_process_stats)
+{
+    struct process_stats_info info;
+
+    info.stats = NULL;
+    info.count = 0;
+    enum_processes( get_process_stats, &info );
+    reply->count = info.count;
+
+    if (get_reply_max_size() < info.count * sizeof(*info.stats))
+        set_error( STATUS_BUFFER_TOO_SMALL );
+    else if ((info.stats = set_reply_data_size( info.count * sizeof(*info.stats) )))
+    {
+        info.count = 0;
+        enum_processes( get_process_stats, &info );
+    }
+}
@@ -195,6 +195,10 @@ static inline void init_thread_structure( struct thread *thread )
     thread->request_fd      = NULL;
     thread->reply_fd        = NULL;
     thread->wait_fd         = NULL;
+    thread->request_shm     = NULL;
+    thread->shm_request     = 0;
+    thread->shm_fd          = -1;
+    thread->shm             = NULL;
     thread->state           = RUNNING;
     thread->exit_code       = 0;
     thread->priority        = 0;
@@ -325,6 +329,10 @@ static void cleanup_thread( struct thread *thread )
     if (thread->request_fd) release_object( thread->request_fd );
     if (thread->reply_fd) release_object( thread->reply_fd );
     if (thread->wait_fd) release_object( thread->wait_fd );
+    release_request_shm( thread );
+    release_shared_memory( thread->shm_fd, thread->shm, sizeof(*thread->shm) );
+    thread->shm_fd = -1;
+    thread->shm = NULL;
     free( thread->suspend_context );
     cleanup_clipboard_thread(thread);
     destroy_thread_windows( thread );
@@ -1404,6 +1412,7 @@ DECL_HANDLER(init_thread)
     reply->server_start = server_start_time;
     reply->all_cpus     = supported_cpus & get_prefix_cpu_mask();
     reply->suspend      = (current->suspend || process->suspend);
+    reply->async_file_io = is_async_file_io_supported();
     return;
 
  error:
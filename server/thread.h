@@ -71,6 +71,11 @@ struct thread
     struct fd             *request_fd;    /* fd for receiving client requests */
     struct fd             *reply_fd;      /* fd to send a reply to a client */
     struct fd             *wait_fd;       /* fd to use to wake a sleeping client */
+    request_shm_t         *request_shm;   /* shared memory for passing requests */
+    struct list            request_shm_entry; /* entry in the list of threads using request_shm */
+    int                    shm_fd;        /* file descriptor for thread local shared memory */
+    shmlocal_t            *shm;           /* thread local shared memory pointer */
+    int                    shm_request;   /* current request was passed in shared memory */
     enum run_state         state;         /* running state */
     int                    exit_code;     /* thread exit code */
     int                    unix_pid;      /* Unix pid of client */